@@ -272,6 +272,7 @@ bool SniffJokeCli::printSJStat(const uint8_t *statblock, uint32_t blocklen)
         /* this are the possibile used storave variables */
         bool boolvar = false;
         uint16_t intvar = 0;
+        uint32_t longvar = 0;
         char charvar[MEDIUMBUF];
         memset(charvar, 0x00, MEDIUMBUF);
         /* starting the parsing of the blocks */
@@ -365,6 +366,58 @@ bool SniffJokeCli::printSJStat(const uint8_t *statblock, uint32_t blocklen)
             memcpy(&charvar, pointed_data, singleData->len);
             printf("single plugin:\t\t%s\n", charvar);
             break;
+        case STAT_POOL_SLOTS:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("packet pool slots:\t%u\n", longvar);
+            break;
+        case STAT_POOL_SLOTSIZE:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("packet pool slot size:\t%u\n", longvar);
+            break;
+        case STAT_POOL_HUGEPAGES:
+            boolvar = (bool)(*(uint8_t *) pointed_data);
+            printf("packet pool memory:\t%s\n", boolvar ? "hugepages" : "normal pages");
+            break;
+        case STAT_POOL_USED:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("packet pool in use:\t%u\n", longvar);
+            break;
+        case STAT_POOL_PEAK:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("packet pool peak:\t%u\n", longvar);
+            break;
+        case STAT_POOL_HEAP:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("heap packet buffers:\t%u\n", longvar);
+            break;
+        case STAT_POOL_PKTS:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("packets in use:\t\t%u\n", longvar);
+            break;
+        case STAT_POOL_PKTSPEAK:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("packets peak:\t\t%u\n", longvar);
+            break;
+        case STAT_REJ_IPHDR:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("rejected, ip header:\t%u\n", longvar);
+            break;
+        case STAT_REJ_TCPHDR:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("rejected, tcp header:\t%u\n", longvar);
+            break;
+        case STAT_REJ_UDPHDR:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("rejected, udp header:\t%u\n", longvar);
+            break;
+        case STAT_REJ_ICMPHDR:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("rejected, icmp header:\t%u\n", longvar);
+            break;
+        case STAT_REJ_GSO:
+            memcpy(&longvar, pointed_data, singleData->len);
+            printf("rejected, offload:\t%u\n", longvar);
+            break;
         default:
             break;
         }
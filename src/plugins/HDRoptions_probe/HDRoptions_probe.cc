@@ -151,7 +151,7 @@ public:
 
     virtual void apply(const Packet &origpkt, uint8_t availableScrambles)
     {
-        Packet * pkt = new Packet(origpkt);
+        PacketHandle pkt(new Packet(origpkt));
 
         pkt->randomizeID();
 
@@ -169,8 +169,8 @@ public:
                    CorruptionSet == NOT_CORRUPT ? "NOT CORRUPT": "CORRUPT",
                    origpkt.SjPacketId);
 
-        upgradeChainFlag(pkt);
-        pktVector.push_back(pkt);
+        upgradeChainFlag(pkt.get());
+        injectPacket(pkt);
     }
 };
 
@@ -68,7 +68,7 @@ public:
 
     virtual void apply(const Packet &origpkt, uint8_t availableScrambles)
     {
-        Packet * const pkt = new Packet(origpkt);
+        PacketHandle pkt(new Packet(origpkt, CLONE_COW));
 
         pkt->randomizeID();
 
@@ -89,9 +89,9 @@ public:
         pkt->wtf = pktRandomDamage(availableScrambles, supportedScrambles);
         pkt->choosableScramble = availableScrambles & supportedScrambles;
 
-        upgradeChainFlag(pkt);
+        upgradeChainFlag(pkt.get());
 
-        pktVector.push_back(pkt);
+        injectPacket(pkt);
     }
 };
 
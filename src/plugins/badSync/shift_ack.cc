@@ -71,7 +71,7 @@ public:
 
     virtual void apply(const Packet &origpkt, uint8_t availableScrambles)
     {
-        Packet * const pkt = new Packet(origpkt);
+        PacketHandle pkt(new Packet(origpkt, CLONE_COW));
 
         pkt->randomizeID();
 
@@ -83,9 +83,9 @@ public:
         pkt->choosableScramble = (availableScrambles & supportedScrambles);
         pkt->payloadRandomFill();
 
-        upgradeChainFlag(pkt);
+        upgradeChainFlag(pkt.get());
 
-        pktVector.push_back(pkt);
+        injectPacket(pkt);
     }
 };
 
@@ -109,7 +109,7 @@ public:
         return ret;
     }
 
-    void fixPushFin(Packet * const pkt, uint8_t availableScrambles)
+    void fixPushFin(PacketHandle &pkt, uint8_t availableScrambles)
     {
         pkt->randomizeID();
         pkt->tcp->fin = 1;
@@ -120,8 +120,6 @@ public:
         pkt->choosableScramble = (availableScrambles & supportedScrambles);
 
         pkt->chainflag = FINALHACK;
-
-        pktVector.push_back(pkt);
     }
 
     virtual void apply(const Packet &origpkt, uint8_t availableScrambles)
@@ -129,7 +127,7 @@ public:
         /* the sniffer trust the FIN because has the last sequence number + 1 */
         if (random_percent(80))
         {
-            Packet * const pkt = new Packet(origpkt);
+            PacketHandle pkt(new Packet(origpkt, CLONE_COW));
 
             pkt->tcp->seq = htonl(ntohl(pkt->tcp->seq) - pkt->tcppayloadlen + 1);
             pkt->tcppayloadResize(0);
@@ -139,17 +137,21 @@ public:
 
             pLH.completeLog("injection with seq/push modification, id %d (psh %d ack %d)", 
                 ntohs(pkt->ip->id), pkt->tcp->psh, pkt->tcp->ack );
+
+            injectPacket(pkt);
         }
 
          /* the sniffer trust the FIN because does see a coherent ack_seq in answer */
         if (random_percent(80))
         {
-            Packet * const pkt = new Packet(origpkt);
+            PacketHandle pkt(new Packet(origpkt));
 
             fixPushFin(pkt, availableScrambles);
 
             pLH.completeLog("injection with seq/push coherence keeping, id %d (psh %d ack %d)", 
                 ntohs(pkt->ip->id), pkt->tcp->psh, pkt->tcp->ack);
+
+            injectPacket(pkt);
         }
     }
 };
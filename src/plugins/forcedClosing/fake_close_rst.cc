@@ -114,7 +114,7 @@ public:
 
     virtual void apply(const Packet &origpkt, uint8_t availableScrambles)
     {
-        Packet * const pkt = new Packet(origpkt);
+        PacketHandle pkt(new Packet(origpkt, CLONE_COW));
 
         pkt->randomizeID();
 
@@ -133,7 +133,7 @@ public:
 
         pkt->chainflag = FINALHACK;
 
-        pktVector.push_back(pkt);
+        injectPacket(pkt);
     }
 };
 
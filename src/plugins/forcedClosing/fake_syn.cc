@@ -69,7 +69,7 @@ public:
     {
         for (uint8_t pkts = 0; pkts < 2; pkts++)
         {
-            Packet * const pkt = new Packet(origpkt);
+            PacketHandle pkt(new Packet(origpkt));
 
             pkt->randomizeID();
 
@@ -105,9 +105,9 @@ public:
             pkt->wtf = pktRandomDamage(availableScrambles, supportedScrambles);
             pkt->choosableScramble = (availableScrambles & supportedScrambles);
 
-            upgradeChainFlag(pkt);
+            upgradeChainFlag(pkt.get());
 
-            pktVector.push_back(pkt);
+            injectPacket(pkt);
         }
     }
 };
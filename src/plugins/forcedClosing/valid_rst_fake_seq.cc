@@ -122,7 +122,7 @@ public:
 
     virtual void apply(const Packet &origpkt, uint8_t availableScrambles)
     {
-        Packet * const pkt = new Packet(origpkt);
+        PacketHandle pkt(new Packet(origpkt, CLONE_COW));
 
         pkt->randomizeID();
 
@@ -146,7 +146,7 @@ public:
            is an INNOCENT RST based on the seq... */
         pkt->chainflag = FINALHACK;
 
-        pktVector.push_back(pkt);
+        injectPacket(pkt);
     }
 };
 
@@ -53,16 +53,16 @@ class fake_data : public Plugin
 
 private:
 
-    Packet* fake_fragment(const Packet &origpkt)
+    void fake_fragment(const Packet &origpkt, PacketHandle &out)
     {
-        Packet * const pkt = new Packet(origpkt);
+        PacketHandle pkt(new Packet(origpkt));
 
-        return pkt;
+        pkt.transfer(out);
     }
 
-    Packet* fake_segment(const Packet &origpkt)
+    void fake_segment(const Packet &origpkt, PacketHandle &out)
     {
-        Packet * const pkt = new Packet(origpkt);
+        PacketHandle pkt(new Packet(origpkt, CLONE_COW));
 
         pkt->tcp->rst = 0;
         pkt->tcp->fin = 0;
@@ -82,14 +82,14 @@ private:
         }
 #endif
 
-        return pkt;
+        pkt.transfer(out);
     }
 
-    Packet* fake_datagram(const Packet &origpkt)
+    void fake_datagram(const Packet &origpkt, PacketHandle &out)
     {
-        Packet * const pkt = new Packet(origpkt);
+        PacketHandle pkt(new Packet(origpkt, CLONE_COW));
 
-        return pkt;
+        pkt.transfer(out);
     }
 
 public:
@@ -126,7 +126,7 @@ public:
     {
         judge_t selectedScramble = pktRandomDamage(availableScrambles, supportedScrambles);
 
-        Packet * (fake_data::*perProtoFunction)(const Packet &) = NULL;
+        void (fake_data::*perProtoFunction)(const Packet &, PacketHandle &) = NULL;
 
         if (origpkt.fragment == false)
         {
@@ -145,7 +145,8 @@ public:
 
         for (uint8_t pkts = 0; pkts < 2; pkts++)
         {
-            Packet* pkt = (this->*perProtoFunction)(origpkt);
+            PacketHandle pkt;
+            (this->*perProtoFunction)(origpkt, pkt);
 
             pkt->randomizeID();
 
@@ -160,9 +161,9 @@ public:
             pkt->choosableScramble = (availableScrambles & supportedScrambles);
             pkt->tcppayloadRandomFill();
 
-            upgradeChainFlag(pkt);
+            upgradeChainFlag(pkt.get());
 
-            pktVector.push_back(pkt);
+            injectPacket(pkt);
         }
     }
 };
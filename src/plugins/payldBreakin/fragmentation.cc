@@ -113,9 +113,9 @@ public:
         return ret;
     }
 
-    Packet * create_fragment(const Packet &origpkt, uint16_t since, uint16_t len)
+    void create_fragment(const Packet &origpkt, PacketHandle &out, uint16_t since, uint16_t len)
     {
-        Packet * ret = new Packet(origpkt, since, len, MIN_USABLE_MTU);
+        PacketHandle ret(new Packet(origpkt, since, len, MIN_USABLE_MTU));
 
         ret->source = PLUGIN;
 
@@ -127,16 +127,16 @@ public:
         ret->wtf = origpkt.wtf;
 
         /* will be re-hacked, of couse, also if not all plugins supports frag */
-        upgradeChainFlag(ret);
+        upgradeChainFlag(ret.get());
 
-        return ret;
+        ret.transfer(out);
     }
 
     virtual void apply(const Packet &origpkt, uint8_t availableScrambles)
     {
         uint16_t start = 0;
         uint16_t tobesend = origpkt.ippayloadlen;
-        Packet * fragPkt;
+        PacketHandle fragPkt;
 
         /* fragDataLen is 544 byte of ip payload */
         uint16_t fragDataLen = (MIN_USABLE_MTU - (sizeof(struct iphdr) + MIN_OPTION_RESERVED) );
@@ -158,7 +158,7 @@ public:
         /* create the 1st (and 2nd ?) fragments */
         do 
         {
-            fragPkt = create_fragment(origpkt, start, fragDataLen);
+            create_fragment(origpkt, fragPkt, start, fragDataLen);
             fragPkt->choosableScramble = (availableScrambles & supportedScrambles);
 
             fragPkt->ip->frag_off = htons( (start >> 3) & IP_OFFMASK);
@@ -169,7 +169,7 @@ public:
 
             fragPkt->ip->frag_off |= htons(IP_MF);
 
-            pktVector.push_back(fragPkt);
+            injectPacket(fragPkt);
 
             start += fragDataLen;
             tobesend -= fragDataLen;
@@ -177,17 +177,17 @@ public:
         } while(--not_last_pkts);
 
         /* create the last fragment */
-        fragPkt = create_fragment(origpkt, start, tobesend);
+        create_fragment(origpkt, fragPkt, start, tobesend);
         fragPkt->choosableScramble = (availableScrambles & supportedScrambles);
 
         fragPkt->ip->frag_off = htons( (start >> 3) & IP_OFFMASK);
 
-        pktVector.push_back(fragPkt);
-
         pLH.completeLog("final fragment (Sj#%u) size %d start %d (frag_off %u) orig seq %u", 
                         fragPkt->SjPacketId, fragPkt->pbuf.size(), start,
                         ntohs(fragPkt->ip->frag_off), ntohl(origpkt.tcp->seq) );
 
+        injectPacket(fragPkt);
+
         removeOrigPkt = true;
     }
 };
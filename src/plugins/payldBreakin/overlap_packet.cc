@@ -62,9 +62,9 @@ private:
      */
     PluginCache OVRLAPcache;
 
-    Packet * create_segment(const Packet &pkt, uint32_t seqOff, uint16_t newTcplen, bool cache, bool psh, bool ackkeep)
+    void create_segment(const Packet &pkt, PacketHandle &out, uint32_t seqOff, uint16_t newTcplen, bool cache, bool psh, bool ackkeep)
     {
-        Packet * ret = new Packet(pkt);
+        PacketHandle ret(new Packet(pkt, CLONE_COW));
 
         ret->randomizeID();
         ret->tcp->seq = htonl( ntohl(ret->tcp->seq) + seqOff );
@@ -94,7 +94,7 @@ private:
         ret->source = PLUGIN;
         ret->wtf = INNOCENT;
         ret->choosableScramble = SCRAMBLE_INNOCENT;
-        upgradeChainFlag(ret);
+        upgradeChainFlag(ret.get());
 
         if(cache)
         {
@@ -110,7 +110,7 @@ private:
             pLH.completeLog("? debug: orig seq %u ack_seq %u pushed len %d (w/out cache)", ntohl(ret->tcp->seq), (dbg), newTcplen );
         }
 
-        return ret;
+        ret.transfer(out);
     }
 
 public:
@@ -119,6 +119,7 @@ public:
     Plugin(PLUGIN_NAME, AGG_RARE),
     pLH(PLUGIN_NAME, PKT_LOG)
     {
+        handleIncoming = true;
     }
 
     virtual bool init(uint8_t configuredScramble, char *pluginOption, struct sjEnviron *sjE)
@@ -177,21 +178,25 @@ public:
 
     virtual void apply(const Packet &origpkt, uint8_t availableScrambles)
     {
-        Packet * const pkt1 = create_segment(origpkt, 0, 60, false, false, true);
+        PacketHandle pkt1;
+        create_segment(origpkt, pkt1, 0, 60, false, false, true);
         pkt1->position = ANTICIPATION;
-        pktVector.push_back(pkt1);
+        injectPacket(pkt1);
 
-        Packet * const pkt2 = create_segment(origpkt, 40, 80, true, false, false);
+        PacketHandle pkt2;
+        create_segment(origpkt, pkt2, 40, 80, true, false, false);
         pkt2->position = ANTICIPATION;
-        pktVector.push_back(pkt2);
+        injectPacket(pkt2);
 
-        Packet * const pkt3 = create_segment(origpkt, 0, origpkt.tcppayloadlen, false, true, false);
+        PacketHandle pkt3;
+        create_segment(origpkt, pkt3, 0, origpkt.tcppayloadlen, false, true, false);
         pkt3->position = ANTICIPATION;
-        pktVector.push_back(pkt3);
+        injectPacket(pkt3);
 
-        Packet * const pkt4 = create_segment(origpkt, 120, 80, false, false, false);
+        PacketHandle pkt4;
+        create_segment(origpkt, pkt4, 120, 80, false, false, false);
         pkt4->position = POSTICIPATION;
-        pktVector.push_back(pkt4);
+        injectPacket(pkt4);
 
         removeOrigPkt = true;
     }
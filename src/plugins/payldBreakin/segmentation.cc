@@ -72,6 +72,7 @@ public:
     Plugin(PLUGIN_NAME, AGG_RARE),
     pLH(PLUGIN_NAME, PKT_LOG)
     {
+        handleIncoming = true;
     };
 
     virtual bool init(uint8_t configuredScramble, char *pluginOption, struct sjEnviron *sjE)
@@ -138,31 +139,25 @@ public:
 
         for (uint8_t pkts = 0; pkts < pkts_n; pkts++)
         {
-            Packet * const pkt = new Packet(origpkt);
+            const bool last = (pkts == (pkts_n - 1));
+            const uint32_t resizeAndCopy = last ? carry : split_size;
+
+            /* only the payload slice of the segment is copied, and summed in the copy */
+            PacketHandle pkt(new Packet(origpkt, pkts * split_size, resizeAndCopy));
 
             pkt->randomizeID();
 
             pkt->tcp->seq = htonl(starting_seq + (pkts * split_size));
 
-            uint32_t resizeAndCopy = 0;
-            if (pkts < (pkts_n - 1)) /* first (pkt - 1) segments */
+            if (!last) /* first (pkt - 1) segments */
             {
                 pkt->tcp->fin = 0;
                 pkt->tcp->rst = 0;
 
                 /* if the PUSH is present, it's keept only in the lasy data pkt */
                 pkt->tcp->psh = 0;
-
-                resizeAndCopy = split_size;
-            }
-            else /* last segment */
-            {
-                resizeAndCopy = carry;
             }
 
-            pkt->tcppayloadResize(resizeAndCopy);
-            memcpy(pkt->tcppayload, &origpkt.tcppayload[pkts * split_size], resizeAndCopy);
-
             pkt->source = PLUGIN;
 
             /*
@@ -186,12 +181,12 @@ public:
             pkt->choosableScramble = (availableScrambles & supportedScrambles);
 
             /* I was tempted to set it FINALHACK, but Sj supports fragment, lets see */
-            upgradeChainFlag(pkt);
-
-            pktVector.push_back(pkt);
+            upgradeChainFlag(pkt.get());
 
             pLH.completeLog("%d/%d chunk seq|%x sjPacketId %d size %d", 
                             (pkts + 1), pkts_n, ntohl(pkt->tcp->seq), pkt->SjPacketId, resizeAndCopy);
+
+            injectPacket(pkt);
         }
 
         cache.add(origpkt);
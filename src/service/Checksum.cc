@@ -0,0 +1,250 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2008 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+Checksum::sum_f Checksum::sumKernel = &Checksum::portableSum;
+Checksum::copysum_f Checksum::copySumKernel = &Checksum::portableCopySum;
+const char *Checksum::kernelName = "portable";
+
+static uint32_t fold64(uint64_t sum)
+{
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+
+    return (uint32_t) sum;
+}
+
+/*
+ * the words are read with memcpy: the packet bytes have no alignment.
+ * four 32 bit words each round, in two accumulators so that the adds of
+ * a round do not wait one for the other.
+ */
+static uint64_t wordsSum(const unsigned char *data, uint32_t len)
+{
+    uint64_t sum = 0, sum1 = 0;
+    uint32_t w[4];
+
+    for (; len >= sizeof (w); data += sizeof (w), len -= sizeof (w))
+    {
+        memcpy(w, data, sizeof (w));
+        sum += (uint64_t) w[0] + w[1];
+        sum1 += (uint64_t) w[2] + w[3];
+    }
+
+    sum += sum1;
+
+    for (; len >= sizeof (w[0]); data += sizeof (w[0]), len -= sizeof (w[0]))
+    {
+        memcpy(&w[0], data, sizeof (w[0]));
+        sum += w[0];
+    }
+
+    if (len >= sizeof (uint16_t))
+    {
+        uint16_t hw;
+        memcpy(&hw, data, sizeof (hw));
+        sum += hw;
+        data += sizeof (uint16_t);
+        len -= sizeof (uint16_t);
+    }
+
+    if (len)
+        sum += *data;
+
+    return sum;
+}
+
+uint32_t Checksum::portableSum(const unsigned char *data, uint32_t len)
+{
+    return fold64(wordsSum(data, len));
+}
+
+static uint64_t wordsCopySum(unsigned char *dst, const unsigned char *src, uint32_t len)
+{
+    uint64_t sum = 0, sum1 = 0;
+    uint32_t w[4];
+
+    for (; len >= sizeof (w); dst += sizeof (w), src += sizeof (w), len -= sizeof (w))
+    {
+        memcpy(w, src, sizeof (w));
+        memcpy(dst, w, sizeof (w));
+        sum += (uint64_t) w[0] + w[1];
+        sum1 += (uint64_t) w[2] + w[3];
+    }
+
+    sum += sum1;
+
+    for (; len >= sizeof (w[0]); dst += sizeof (w[0]), src += sizeof (w[0]), len -= sizeof (w[0]))
+    {
+        memcpy(&w[0], src, sizeof (w[0]));
+        memcpy(dst, &w[0], sizeof (w[0]));
+        sum += w[0];
+    }
+
+    if (len >= sizeof (uint16_t))
+    {
+        uint16_t hw;
+        memcpy(&hw, src, sizeof (hw));
+        memcpy(dst, &hw, sizeof (hw));
+        sum += hw;
+        dst += sizeof (uint16_t);
+        src += sizeof (uint16_t);
+        len -= sizeof (uint16_t);
+    }
+
+    if (len)
+    {
+        *dst = *src;
+        sum += *src;
+    }
+
+    return sum;
+}
+
+uint32_t Checksum::portableCopySum(unsigned char *dst, const unsigned char *src, uint32_t len)
+{
+    return fold64(wordsCopySum(dst, src, len));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * the 32 bit lanes are widened to 64 bit by the unpack with zero, then
+ * added; the bytes left start at an even offset, the words are the same.
+ */
+__attribute__((target("sse2")))
+uint32_t Checksum::sse2Sum(const unsigned char *data, uint32_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum0 = _mm_setzero_si128(), sum1 = _mm_setzero_si128();
+
+    for (; len >= 16; data += 16, len -= 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *) data);
+
+        sum0 = _mm_add_epi64(sum0, _mm_unpacklo_epi32(v, zero));
+        sum1 = _mm_add_epi64(sum1, _mm_unpackhi_epi32(v, zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, _mm_add_epi64(sum0, sum1));
+
+    return fold64(lanes[0] + lanes[1] + wordsSum(data, len));
+}
+
+__attribute__((target("sse2")))
+uint32_t Checksum::sse2CopySum(unsigned char *dst, const unsigned char *src, uint32_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum0 = _mm_setzero_si128(), sum1 = _mm_setzero_si128();
+
+    for (; len >= 16; dst += 16, src += 16, len -= 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *) src);
+
+        _mm_storeu_si128((__m128i *) dst, v);
+        sum0 = _mm_add_epi64(sum0, _mm_unpacklo_epi32(v, zero));
+        sum1 = _mm_add_epi64(sum1, _mm_unpackhi_epi32(v, zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, _mm_add_epi64(sum0, sum1));
+
+    return fold64(lanes[0] + lanes[1] + wordsCopySum(dst, src, len));
+}
+
+__attribute__((target("avx2")))
+uint32_t Checksum::avx2Sum(const unsigned char *data, uint32_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+
+    for (; len >= 32; data += 32, len -= 32)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *) data);
+
+        sum0 = _mm256_add_epi64(sum0, _mm256_unpacklo_epi32(v, zero));
+        sum1 = _mm256_add_epi64(sum1, _mm256_unpackhi_epi32(v, zero));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(sum0, sum1));
+
+    return fold64(lanes[0] + lanes[1] + lanes[2] + lanes[3] + wordsSum(data, len));
+}
+
+__attribute__((target("avx2")))
+uint32_t Checksum::avx2CopySum(unsigned char *dst, const unsigned char *src, uint32_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+
+    for (; len >= 32; dst += 32, src += 32, len -= 32)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *) src);
+
+        _mm256_storeu_si256((__m256i *) dst, v);
+        sum0 = _mm256_add_epi64(sum0, _mm256_unpacklo_epi32(v, zero));
+        sum1 = _mm256_add_epi64(sum1, _mm256_unpackhi_epi32(v, zero));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(sum0, sum1));
+
+    return fold64(lanes[0] + lanes[1] + lanes[2] + lanes[3] + wordsCopySum(dst, src, len));
+}
+
+#endif
+
+/* called once at the service startup, before any packet is handled */
+void Checksum::init(void)
+{
+    sumKernel = &Checksum::portableSum;
+    copySumKernel = &Checksum::portableCopySum;
+    kernelName = "portable";
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        sumKernel = &Checksum::avx2Sum;
+        copySumKernel = &Checksum::avx2CopySum;
+        kernelName = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        sumKernel = &Checksum::sse2Sum;
+        copySumKernel = &Checksum::sse2CopySum;
+        kernelName = "sse2";
+    }
+#endif
+
+    LOG_VERBOSE("internet checksum computed by the %s kernel", kernelName);
+}
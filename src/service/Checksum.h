@@ -0,0 +1,79 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2008 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SJ_CHECKSUM_H
+#define SJ_CHECKSUM_H
+
+#include "Utils.h"
+
+/*
+ * the sum of the 16 bit words used by the internet checksum, the kernel of
+ * Packet::computeHalfSum(). the words are accumulated 32 or 64 bits at a
+ * time in 64 bit counters: the SSE2 and the AVX2 versions are chosen by
+ * init() at the startup when the cpu has them, the portable one otherwise.
+ *
+ * the result is folded to 16 bits, it is not the same number of the plain
+ * word by word sum but the same value in one's complement arithmetic: the
+ * checksum computed from it is the same. as in the original routine, an
+ * odd trailing byte is added as it is.
+ *
+ * copySum() is the same sum computed while the bytes are copied, for the
+ * packets built from a slice of another: it is the sum of the words of
+ * the destination when it starts at an even offset of the packet.
+ */
+class Checksum
+{
+private:
+
+    typedef uint32_t(*sum_f)(const unsigned char *, uint32_t);
+    typedef uint32_t(*copysum_f)(unsigned char *, const unsigned char *, uint32_t);
+
+    static sum_f sumKernel;
+    static copysum_f copySumKernel;
+
+public:
+
+    static const char *kernelName;
+
+    static void init(void);
+
+    static uint32_t portableSum(const unsigned char *, uint32_t);
+    static uint32_t portableCopySum(unsigned char *, const unsigned char *, uint32_t);
+#if defined(__x86_64__) || defined(__i386__)
+    static uint32_t sse2Sum(const unsigned char *, uint32_t);
+    static uint32_t sse2CopySum(unsigned char *, const unsigned char *, uint32_t);
+    static uint32_t avx2Sum(const unsigned char *, uint32_t);
+    static uint32_t avx2CopySum(unsigned char *, const unsigned char *, uint32_t);
+#endif
+
+    static uint32_t halfSum(const unsigned char *data, uint32_t len)
+    {
+        return sumKernel(data, len);
+    };
+
+    static uint32_t copySum(unsigned char *dst, const unsigned char *src, uint32_t len)
+    {
+        return copySumKernel(dst, src, len);
+    };
+};
+
+#endif /* SJ_CHECKSUM_H */
@@ -0,0 +1,75 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2008 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SJ_IOBACKEND_H
+#define SJ_IOBACKEND_H
+
+#include "Utils.h"
+#include "TCPTrack.h"
+
+/*
+ * the I/O side of sniffjoke: a backend feeds the conntrack with the packets
+ * coming from the tunnel and from the network, runs the queue analysis and
+ * delivers the SEND queue. NetIO is the live one, working on a tun device
+ * and a packet socket; PcapIO replays capture files.
+ */
+class IOBackend
+{
+protected:
+
+    TCPTrack *conntrack;
+
+public:
+
+    IOBackend(void) :
+    conntrack(NULL)
+    {
+    };
+
+    virtual ~IOBackend(void)
+    {
+    };
+
+    void prepareConntrack(TCPTrack *ct)
+    {
+        conntrack = ct;
+    };
+
+    /* with more queues, called by every worker to keep only its own */
+    virtual void selectQueue(uint16_t)
+    {
+    };
+
+    /* called in the root process when the port configuration changes */
+    virtual void refreshRules(void)
+    {
+    };
+
+    /* called in the service processes when the port configuration changes */
+    virtual void refreshFilter(void)
+    {
+    };
+
+    virtual void networkIO(void) = 0;
+};
+
+#endif /* SJ_IOBACKEND_H */
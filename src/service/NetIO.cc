@@ -28,9 +28,27 @@
 #include <linux/if_tun.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/if_link.h>
+#include <stddef.h>
 
 extern auto_ptr<UserConf> userconf;
 
+/*
+ * io_uring user_data: the two posted reads have fixed tags, the writes
+ * carry their Packet pointer, with the lowest bit set when bound to tunfd.
+ */
+#define URING_NETRECV       1
+#define URING_TUNREAD       2
+#define URING_TUNWRITE      1
+
+#define URING_NETBGID       0
+#define URING_TUNBGID       1
+
 void NetIO::setupNET()
 {
     int tmpflags;
@@ -76,268 +94,2253 @@ void NetIO::setupNET()
     else
         RUNTIME_EXCEPTION("unable to get netfd mtu(SIOCGIFMTU): %s", strerror(errno));
     userconf->runcfg.net_iface_mtu = tmpifr.ifr_mtu;
+    Packet::netMTU = tmpifr.ifr_mtu;
 
     close(tmpfd);
+
+    net_queue_fds.push_back(netfd);
+
+    if (userconf->runcfg.tun_queues > 1)
+        setupNETFANOUT();
+
+    if (!userconf->runcfg.net_xdp)
+        setupNETFILTER();
+
+    if (userconf->runcfg.net_mmap)
+        setupNETMMAP();
+    else if (userconf->runcfg.net_batch)
+        setupNETBATCH();
+    else if (userconf->runcfg.net_xdp)
+        setupNETXDP();
+    else if (userconf->runcfg.tun_vnet_hdr || userconf->runcfg.net_csum_offload)
+        setupNETVNET();
 }
 
-void NetIO::setupTUN()
+/*
+ * opens a packet socket for every additional tun queue and joins all of them,
+ * in queue order, to a PACKET_FANOUT_HASH group. the fanout uses the same
+ * symmetric flow hash used by the tun device to select the queue of the
+ * outgoing packets, so both directions of a session reach the same worker.
+ * the replies to a ttl probe, sent from a puppet port, do not belong to the
+ * session: the process receiving them relays them to the owner of the probe
+ * (TCPTrack::relayTTLReply and SniffJoke::relayTTLReplies).
+ */
+void NetIO::setupNETFANOUT()
 {
-    const char *tundev = "/dev/net/tun";
-
     int tmpflags;
     int tmpfd;
-    struct ifreq tmpifr;
+    const int fanout = (getpid() & 0xFFFF) | (PACKET_FANOUT_HASH << 16);
 
-    memset(&tmpifr, 0x00, sizeof (tmpifr));
+    for (uint16_t i = 1; i < userconf->runcfg.tun_queues; ++i)
+    {
+        if ((tmpfd = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_IP))) == -1)
+            RUNTIME_EXCEPTION("unable to open datalink layer packet for queue %u: %s", i, strerror(errno));
 
-    if ((tunfd = open(tundev, O_RDWR)) != -1)
-        LOG_DEBUG("%s opened successfully", tundev);
+        if (((tmpflags = fcntl(tmpfd, F_GETFD)) == -1) || (fcntl(tmpfd, F_SETFD, tmpflags | FD_CLOEXEC) == -1))
+            RUNTIME_EXCEPTION("unable to set flag FD_CLOEXEC on netfd queue %u (F_SETFD): %s", i, strerror(errno));
+
+        if (bind(tmpfd, (struct sockaddr *) &send_ll, sizeof (send_ll)) == -1)
+            RUNTIME_EXCEPTION("unable to bind datalink layer interface for queue %u: %s", i, strerror(errno));
+
+        net_queue_fds.push_back(tmpfd);
+    }
+
+    for (uint16_t i = 0; i < net_queue_fds.size(); ++i)
+    {
+        if (setsockopt(net_queue_fds[i], SOL_PACKET, PACKET_FANOUT, &fanout, sizeof (fanout)) == -1)
+            RUNTIME_EXCEPTION("unable to join the fanout group with netfd queue %u (PACKET_FANOUT): %s", i, strerror(errno));
+    }
+
+    LOG_DEBUG("%u datalink layer sockets joined in a PACKET_FANOUT_HASH group", net_queue_fds.size());
+}
+
+static struct sock_filter bpfInsn(uint16_t code, uint8_t jt, uint8_t jf, uint32_t k)
+{
+    struct sock_filter insn;
+
+    insn.code = code;
+    insn.jt = jt;
+    insn.jf = jf;
+    insn.k = k;
+
+    return insn;
+}
+
+/* jump targets of bpfInsn, resolved by bpfResolve when the program is complete */
+#define BPF_TO_DROP     0xFE
+#define BPF_TO_ACCEPT   0xFF
+
+static void bpfResolve(vector<struct sock_filter> &code)
+{
+    /* the program ends with "drop: ret #0" and "accept: ret #-1" */
+    const uint32_t drop = code.size() - 2;
+    const uint32_t accept = code.size() - 1;
+
+    for (uint32_t i = 0; i < drop; ++i)
+    {
+        if (BPF_CLASS(code[i].code) != BPF_JMP)
+            continue;
+
+        if (code[i].jt == BPF_TO_DROP || code[i].jt == BPF_TO_ACCEPT)
+            code[i].jt = ((code[i].jt == BPF_TO_DROP) ? drop : accept) - (i + 1);
+
+        if (code[i].jf == BPF_TO_DROP || code[i].jf == BPF_TO_ACCEPT)
+            code[i].jf = ((code[i].jf == BPF_TO_DROP) ? drop : accept) - (i + 1);
+    }
+}
+
+/*
+ * attaches a classic BPF program to every packet socket, so that only the
+ * packets addressed to our ip are copied in userspace: broadcast, multicast
+ * and our own outgoing copies stay on the kernel path. with
+ * --net-filter-proto only icmp and the mangled protocols are admitted too.
+ * netfd is a SOCK_DGRAM socket: the offsets start at the ip header.
+ *
+ *         ld [daddr]
+ *         jeq #net_iface_ip, next, drop
+ *         ldb [protocol]                 (--net-filter-proto only)
+ *         jeq #IPPROTO_x, accept, next   (one for every admitted protocol)
+ *
+ * with --net-selective-in only the packets used by sniffjoke are admitted,
+ * the same classes dropped by the iptables rules of setupINTERCEPT():
+ *
+ *         ldb [protocol]
+ *         jeq #IPPROTO_ICMP, accept, next
+ *         ldh [frag_off]
+ *         jset #0x3fff, accept, next     (MF or an offset: a fragment)
+ *         jeq #IPPROTO_TCP, next, drop   (on the protocol loaded again)
+ *         ldxb 4 * ([0] & 0xf)
+ *         ldb [x + 13]
+ *         and #(SYN | ACK)
+ *         jeq #(SYN | ACK), accept, next
+ *         ldh [x + 0]                    (the plugins mangling the incoming
+ *         jge #first, next, +1            packets need the hackable ports:
+ *         jgt #last, next, accept         a pair for every range)
+ *
+ * drop:   ret #0
+ * accept: ret #-1
+ *
+ * it's attached again by refreshFilter() when the ports change.
+ */
+void NetIO::setupNETFILTER()
+{
+    vector<struct sock_filter> code;
+    vector<uint8_t> protos;
+    struct sock_fprog fprog;
+
+    code.push_back(bpfInsn(BPF_LD | BPF_W | BPF_ABS, 0, 0, offsetof(struct iphdr, daddr)));
+    code.push_back(bpfInsn(BPF_JMP | BPF_JEQ | BPF_K, 0, BPF_TO_DROP, ntohl(inet_addr(userconf->runcfg.net_iface_ip))));
+
+    if (userconf->runcfg.net_selective_in)
+    {
+        const uint8_t synack = 0x12; /* TH_SYN | TH_ACK */
+
+        code.push_back(bpfInsn(BPF_LD | BPF_B | BPF_ABS, 0, 0, offsetof(struct iphdr, protocol)));
+        code.push_back(bpfInsn(BPF_JMP | BPF_JEQ | BPF_K, BPF_TO_ACCEPT, 0, IPPROTO_ICMP));
+        code.push_back(bpfInsn(BPF_LD | BPF_H | BPF_ABS, 0, 0, offsetof(struct iphdr, frag_off)));
+        code.push_back(bpfInsn(BPF_JMP | BPF_JSET | BPF_K, BPF_TO_ACCEPT, 0, IP_MF | IP_OFFMASK));
+        code.push_back(bpfInsn(BPF_LD | BPF_B | BPF_ABS, 0, 0, offsetof(struct iphdr, protocol)));
+        code.push_back(bpfInsn(BPF_JMP | BPF_JEQ | BPF_K, 0, BPF_TO_DROP, IPPROTO_TCP));
+        code.push_back(bpfInsn(BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0));
+        code.push_back(bpfInsn(BPF_LD | BPF_B | BPF_IND, 0, 0, 13));
+        code.push_back(bpfInsn(BPF_ALU | BPF_AND | BPF_K, 0, 0, synack));
+        code.push_back(bpfInsn(BPF_JMP | BPF_JEQ | BPF_K, BPF_TO_ACCEPT, 0, synack));
+
+        if (userconf->runcfg.plugins_incoming && !userconf->runcfg.no_tcp)
+        {
+            vector<pair<uint16_t, uint16_t> > ranges;
+            hackablePorts(ranges);
+
+            if (ranges.size() > SELECTIVE_IN_MAXPORTRANGES)
+            {
+                code.push_back(bpfInsn(BPF_JMP | BPF_JA, 0, 0, 1)); /* over the drop */
+            }
+            else
+            {
+                code.push_back(bpfInsn(BPF_LD | BPF_H | BPF_IND, 0, 0, 0));
+
+                for (uint32_t i = 0; i < ranges.size(); ++i)
+                {
+                    code.push_back(bpfInsn(BPF_JMP | BPF_JGE | BPF_K, 0, 1, ranges[i].first));
+                    code.push_back(bpfInsn(BPF_JMP | BPF_JGT | BPF_K, 0, BPF_TO_ACCEPT, ranges[i].second));
+                }
+            }
+        }
+    }
     else
-        RUNTIME_EXCEPTION("unable to open %s: %s, check the kernel module", tundev, strerror(errno));
+    {
+        if (userconf->runcfg.net_filter_proto)
+        {
+            protos.push_back(IPPROTO_ICMP);
+            if (!userconf->runcfg.no_tcp)
+                protos.push_back(IPPROTO_TCP);
+            if (!userconf->runcfg.no_udp)
+                protos.push_back(IPPROTO_UDP);
 
-    if (((tmpflags = fcntl(tunfd, F_GETFD)) != -1) && (fcntl(tunfd, F_SETFD, tmpflags | FD_CLOEXEC) != -1))
-        LOG_DEBUG("flag FD_CLOEXEC set successfully on tunfd (F_SETFD)");
+            code.push_back(bpfInsn(BPF_LD | BPF_B | BPF_ABS, 0, 0, offsetof(struct iphdr, protocol)));
+
+            for (uint8_t i = 0; i < protos.size(); ++i)
+                code.push_back(bpfInsn(BPF_JMP | BPF_JEQ | BPF_K, BPF_TO_ACCEPT, 0, protos[i]));
+        }
+        else
+        {
+            /* only the destination is checked */
+            code.push_back(bpfInsn(BPF_JMP | BPF_JA, 0, 0, 1)); /* over the drop */
+        }
+    }
+
+    code.push_back(bpfInsn(BPF_RET | BPF_K, 0, 0, 0));
+    code.push_back(bpfInsn(BPF_RET | BPF_K, 0, 0, 0xFFFFFFFF));
+
+    bpfResolve(code);
+
+    fprog.len = code.size();
+    fprog.filter = &(code[0]);
+
+    for (uint16_t i = 0; i < net_queue_fds.size(); ++i)
+    {
+        if (setsockopt(net_queue_fds[i], SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof (fprog)) == -1)
+            RUNTIME_EXCEPTION("unable to attach the socket filter on netfd queue %u (SO_ATTACH_FILTER): %s", i, strerror(errno));
+    }
+
+    LOG_DEBUG("socket filter of %u instructions attached: only %s%s copied in userspace", code.size(),
+              userconf->runcfg.net_iface_ip, userconf->runcfg.net_selective_in ? " and the intercepted classes" :
+              (protos.empty() ? "" : " and the mangled protocols"));
+}
+
+void NetIO::setupNETMMAP()
+{
+    int tmpflags;
+    int tpversion;
+    int qdisc_bypass = 1;
+    struct tpacket_req3 rxreq;
+    struct tpacket_req txreq;
+    struct sockaddr_ll tx_ll;
+
+    rx_block_size = userconf->runcfg.mmap_block_kb * 1024;
+    rx_block_nr = userconf->runcfg.mmap_ring_blocks;
+
+    /* RX: TPACKET_V3 ring on netfd, variable length frames packed in blocks */
+    tpversion = TPACKET_V3;
+    if (setsockopt(netfd, SOL_PACKET, PACKET_VERSION, &tpversion, sizeof (tpversion)) != -1)
+        LOG_DEBUG("TPACKET_V3 selected on netfd (PACKET_VERSION)");
     else
-        RUNTIME_EXCEPTION("unable to set flag FD_CLOEXEC on tunfd (F_SETFD): %s", strerror(errno));
+        RUNTIME_EXCEPTION("unable to select TPACKET_V3 on netfd (PACKET_VERSION): %s", strerror(errno));
 
-    strncpy(tmpifr.ifr_name, TUN_IF_NAME, sizeof (tmpifr.ifr_name));
-    tmpifr.ifr_flags = IFF_TUN | IFF_NO_PI;
-    if (ioctl(tunfd, TUNSETIFF, &tmpifr) != -1)
-        LOG_DEBUG("flags set successfully on tunfd (TUNSETIFF)");
+    memset(&rxreq, 0x00, sizeof (rxreq));
+    rxreq.tp_block_size = rx_block_size;
+    rxreq.tp_block_nr = rx_block_nr;
+    rxreq.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    rxreq.tp_frame_nr = (rx_block_size * rx_block_nr) / rxreq.tp_frame_size;
+    rxreq.tp_retire_blk_tov = NETMMAP_RETIRE_TIMEOUT;
+
+    if (setsockopt(netfd, SOL_PACKET, PACKET_RX_RING, &rxreq, sizeof (rxreq)) != -1)
+        LOG_DEBUG("rx ring of %u blocks x %u bytes set on netfd (PACKET_RX_RING)", rx_block_nr, rx_block_size);
     else
-        RUNTIME_EXCEPTION("unable to set flags on tunfd (TUNSETIFF): %s", strerror(errno));
+        RUNTIME_EXCEPTION("unable to set rx ring on netfd (PACKET_RX_RING): %s", strerror(errno));
 
-    tmpfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    rx_ring = (unsigned char *) mmap(NULL, rx_block_size * rx_block_nr, PROT_READ | PROT_WRITE, MAP_SHARED, netfd, 0);
+    if (rx_ring == MAP_FAILED)
+    {
+        rx_ring = NULL;
+        RUNTIME_EXCEPTION("unable to mmap netfd rx ring: %s", strerror(errno));
+    }
 
-    if (ioctl(tmpfd, SIOCGIFFLAGS, &tmpifr) != -1)
-        LOG_DEBUG("tunfd flags correctly read (SIOCGIFFLAGS)");
+    /*
+     * TX: a dedicated socket with protocol 0, so it never receives;
+     * the frame must contain the TPACKET_V2 header plus a full mtu packet.
+     */
+    if ((netfd_tx = socket(PF_PACKET, SOCK_DGRAM, 0)) != -1)
+        LOG_DEBUG("datalink layer tx socket packet opened successfully");
     else
-        RUNTIME_EXCEPTION("unable to get tunfd flags (SIOCGIFFLAGS): %s", strerror(errno));
-    tmpifr.ifr_flags |= IFF_UP | IFF_RUNNING | IFF_POINTOPOINT;
+        RUNTIME_EXCEPTION("unable to open datalink layer tx packet: %s", strerror(errno));
 
-    if (ioctl(tmpfd, SIOCSIFFLAGS, &tmpifr) != -1)
-        LOG_DEBUG("tunfd flags correctly set (SIOCSIFFLAGS)");
+    if (((tmpflags = fcntl(netfd_tx, F_GETFD)) != -1) && (fcntl(netfd_tx, F_SETFD, tmpflags | FD_CLOEXEC) != -1))
+        LOG_DEBUG("flag FD_CLOEXEC set successfully in netfd_tx (F_SETFD)");
     else
-        RUNTIME_EXCEPTION("unable to get tunfd flags (SIOCSIFFLAGS): %s", strerror(errno));
+        RUNTIME_EXCEPTION("unable to set flag FD_CLOEXEC on netfd_tx (F_SETFD): %s", strerror(errno));
 
-    userconf->runcfg.tun_iface_mtu = userconf->runcfg.net_iface_mtu - TUN_IF_MTU_DIFF;
-    tmpifr.ifr_mtu = userconf->runcfg.tun_iface_mtu;
-    if (ioctl(tmpfd, SIOCSIFMTU, &tmpifr) != -1)
-        LOG_DEBUG("tunfd mtu correctly set to %u (SIOCSIFMTU)", userconf->runcfg.tun_iface_mtu);
+    tpversion = TPACKET_V2;
+    if (setsockopt(netfd_tx, SOL_PACKET, PACKET_VERSION, &tpversion, sizeof (tpversion)) != -1)
+        LOG_DEBUG("TPACKET_V2 selected on netfd_tx (PACKET_VERSION)");
     else
-        RUNTIME_EXCEPTION("unable to set tunfd mtu to %u (SIOCSIFMTU): %s", userconf->runcfg.tun_iface_mtu, strerror(errno));
+        RUNTIME_EXCEPTION("unable to select TPACKET_V2 on netfd_tx (PACKET_VERSION): %s", strerror(errno));
 
-    ((struct sockaddr_in *) &tmpifr.ifr_addr)->sin_family = AF_INET;
-    ((struct sockaddr_in *) &tmpifr.ifr_addr)->sin_addr.s_addr = inet_addr(userconf->runcfg.net_iface_ip);
-    if (ioctl(tmpfd, SIOCSIFADDR, &tmpifr) != -1)
-        LOG_DEBUG("tunfd local addr correctly set to %s", userconf->runcfg.net_iface_ip);
+    if (setsockopt(netfd_tx, SOL_PACKET, PACKET_QDISC_BYPASS, &qdisc_bypass, sizeof (qdisc_bypass)) != -1)
+        LOG_DEBUG("qdisc bypass enabled on netfd_tx (PACKET_QDISC_BYPASS)");
     else
-        RUNTIME_EXCEPTION("unable to set tunfd local addr to %s: %s", userconf->runcfg.net_iface_ip, strerror(errno));
+        LOG_VERBOSE("unable to bypass the qdisc on netfd_tx (PACKET_QDISC_BYPASS): %s", strerror(errno));
 
-    ((struct sockaddr_in *) &tmpifr.ifr_addr)->sin_family = AF_INET;
-    ((struct sockaddr_in *) &tmpifr.ifr_addr)->sin_addr.s_addr = inet_addr(DEFAULT_FAKE_IPADDR);
-    memcpy(userconf->runcfg.tun_iface_ip, DEFAULT_FAKE_IPADDR, strlen(DEFAULT_FAKE_IPADDR));
-    if (ioctl(tmpfd, SIOCSIFDSTADDR, &tmpifr) != -1)
-        LOG_DEBUG("tunfd point-to-point dest addr correctly set to %s", DEFAULT_FAKE_IPADDR);
+    for (tx_frame_size = TPACKET_ALIGNMENT << 7; tx_frame_size < TPACKET2_HDRLEN + userconf->runcfg.net_iface_mtu;)
+        tx_frame_size <<= 1;
+
+    if (tx_frame_size > rx_block_size)
+        RUNTIME_EXCEPTION("mmap-block-kb %u too small for the mtu %u", userconf->runcfg.mmap_block_kb, userconf->runcfg.net_iface_mtu);
+
+    memset(&txreq, 0x00, sizeof (txreq));
+    txreq.tp_block_size = rx_block_size;
+    txreq.tp_block_nr = rx_block_nr;
+    txreq.tp_frame_size = tx_frame_size;
+    txreq.tp_frame_nr = (rx_block_size / tx_frame_size) * rx_block_nr;
+    tx_frame_nr = txreq.tp_frame_nr;
+    tx_frame_cur = 0;
+
+    if (setsockopt(netfd_tx, SOL_PACKET, PACKET_TX_RING, &txreq, sizeof (txreq)) != -1)
+        LOG_DEBUG("tx ring of %u frames x %u bytes set on netfd_tx (PACKET_TX_RING)", tx_frame_nr, tx_frame_size);
     else
-        RUNTIME_EXCEPTION("unable to set tunfd point-to-point dest addr  to %s: %s", DEFAULT_FAKE_IPADDR, strerror(errno));
+        RUNTIME_EXCEPTION("unable to set tx ring on netfd_tx (PACKET_TX_RING): %s", strerror(errno));
 
+    tx_ring = (unsigned char *) mmap(NULL, rx_block_size * rx_block_nr, PROT_READ | PROT_WRITE, MAP_SHARED, netfd_tx, 0);
+    if (tx_ring == MAP_FAILED)
+    {
+        tx_ring = NULL;
+        RUNTIME_EXCEPTION("unable to mmap netfd_tx tx ring: %s", strerror(errno));
+    }
 
-    close(tmpfd);
+    memcpy(&tx_ll, &send_ll, sizeof (tx_ll));
+    tx_ll.sll_protocol = 0;
+    if (bind(netfd_tx, (struct sockaddr *) &tx_ll, sizeof (tx_ll)) != -1)
+        LOG_DEBUG("binding datalink layer tx interface successfully");
+    else
+        RUNTIME_EXCEPTION("unable to bind datalink layer tx interface: %s", strerror(errno));
 }
 
-NetIO::NetIO(void)
+void NetIO::setupNETBATCH()
 {
-    LOG_DEBUG("");
+    const uint32_t nr = userconf->runcfg.net_batch_size;
+    const uint32_t mtu = userconf->runcfg.net_iface_mtu;
 
-    char cmd[MEDIUMBUF];
+    batch_buf.resize(nr * mtu);
+    batch_rx.resize(nr);
+    batch_rx_iov.resize(nr);
+    batch_tx.resize(nr);
+    batch_tx_iov.resize(nr);
+    batch_tx_pkt.resize(nr);
 
-    if (getuid() || geteuid())
-        RUNTIME_EXCEPTION("required root privileges");
+    memset(&(batch_rx[0]), 0x00, sizeof (struct mmsghdr) * nr);
+    memset(&(batch_tx[0]), 0x00, sizeof (struct mmsghdr) * nr);
 
-    /* pseudo sanity check of received data, sjconf had already make something */
-    if (strlen(userconf->runcfg.gw_ip_addr) < 7 || strlen(userconf->runcfg.gw_ip_addr) > 17)
-        RUNTIME_EXCEPTION("invalid ip address [%s] is not an IPv4, check the config", userconf->runcfg.gw_ip_addr);
+    for (uint32_t i = 0; i < nr; ++i)
+    {
+        batch_rx_iov[i].iov_base = &(batch_buf[i * mtu]);
+        batch_rx_iov[i].iov_len = mtu;
+        batch_rx[i].msg_hdr.msg_iov = &(batch_rx_iov[i]);
+        batch_rx[i].msg_hdr.msg_iovlen = 1;
+
+        batch_tx[i].msg_hdr.msg_name = &send_ll;
+        batch_tx[i].msg_hdr.msg_namelen = sizeof (send_ll);
+        batch_tx[i].msg_hdr.msg_iov = &(batch_tx_iov[i]);
+        batch_tx[i].msg_hdr.msg_iovlen = 1;
+    }
 
-    if (strlen(userconf->runcfg.gw_mac_str) != 17)
-        RUNTIME_EXCEPTION("invalid mac address [%s] is not a MAC, check the config", userconf->runcfg.gw_mac_str);
+    LOG_DEBUG("recvmmsg/sendmmsg batches of %u frames prepared on netfd", nr);
+}
 
-    setupNET();
-    setupTUN();
+/*
+ * builds the ethernet header of the frames written on the sockets where
+ * the link layer is up to us: gateway <- our nic.
+ */
+void NetIO::setupETHHDR()
+{
+    int tmpfd;
+    struct ifreq tmpifr;
+    const uint16_t ethproto = htons(ETH_P_IP);
 
-    fds[0].fd = tunfd;
-    fds[1].fd = netfd;
+    memset(&tmpifr, 0x00, sizeof (tmpifr));
+    strncpy(tmpifr.ifr_name, userconf->runcfg.net_iface_name, sizeof (tmpifr.ifr_name));
 
-    snprintf(cmd, sizeof (cmd), "route del default");
-    LOG_VERBOSE("deleting default gateway in routing table");
-    execOSCmd(cmd);
+    tmpfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
 
-    snprintf(cmd, sizeof (cmd), "route add default gw %s", DEFAULT_FAKE_IPADDR"");
-    LOG_VERBOSE("setting default gateway our fake TUN endpoint ip address: %s", DEFAULT_FAKE_IPADDR);
-    execOSCmd(cmd);
+    if (ioctl(tmpfd, SIOCGIFHWADDR, &tmpifr) != -1)
+        LOG_DEBUG("ioctl(SIOCGIFHWADDR) executed successfully on interface %s", userconf->runcfg.net_iface_name);
+    else
+        RUNTIME_EXCEPTION("unable to execute ioctl(SIOCGIFHWADDR) on interface %s: %s", userconf->runcfg.net_iface_name, strerror(errno));
 
-    snprintf(cmd, sizeof (cmd), "iptables -A INPUT -m mac --mac-source %s -j DROP", userconf->runcfg.gw_mac_str);
-    LOG_ALL("dropping all traffic from the gateway [%s]", cmd);
-    execOSCmd(cmd);
+    close(tmpfd);
+
+    memcpy(net_ethhdr, userconf->runcfg.gw_mac_addr, ETH_ALEN);
+    memcpy(net_ethhdr + ETH_ALEN, tmpifr.ifr_hwaddr.sa_data, ETH_ALEN);
+    memcpy(net_ethhdr + 2 * ETH_ALEN, &ethproto, sizeof (ethproto));
 }
 
-NetIO::~NetIO(void)
+/*
+ * PACKET_VNET_HDR is accepted only by SOCK_RAW sockets: the packets with
+ * their virtio-net header (read from the tun, or asking the checksum
+ * offload) are sent by netfd_tx, which never receives, while netfd stops
+ * seeing them as outgoing copies.
+ */
+void NetIO::setupNETVNET()
 {
-    LOG_DEBUG("");
+    int tmpflags;
+    const int one = 1;
+    struct sockaddr_ll tx_ll;
 
-    char cmd[MEDIUMBUF];
+    if ((netfd_tx = socket(PF_PACKET, SOCK_RAW, 0)) != -1)
+        LOG_DEBUG("datalink layer raw tx socket packet opened successfully");
+    else
+        RUNTIME_EXCEPTION("unable to open datalink layer raw tx packet: %s", strerror(errno));
 
-    if (getuid() || geteuid())
-        LOG_VERBOSE("this process (%d) is not root: unable to restore default gw", getpid());
+    if (((tmpflags = fcntl(netfd_tx, F_GETFD)) != -1) && (fcntl(netfd_tx, F_SETFD, tmpflags | FD_CLOEXEC) != -1))
+        LOG_DEBUG("flag FD_CLOEXEC set successfully in netfd_tx (F_SETFD)");
     else
-    {
-        snprintf(cmd, sizeof (cmd), "route del default");
-        LOG_VERBOSE("root process (%d): deleting our default gw [route del default]", getpid());
-        execOSCmd(cmd);
+        RUNTIME_EXCEPTION("unable to set flag FD_CLOEXEC on netfd_tx (F_SETFD): %s", strerror(errno));
 
-        snprintf(cmd, sizeof (cmd), "ifconfig %s down", TUN_IF_NAME);
-        LOG_VERBOSE("shutting down  interface [%s]", TUN_IF_NAME, cmd);
-        execOSCmd(cmd);
+    if (setsockopt(netfd_tx, SOL_PACKET, PACKET_VNET_HDR, &one, sizeof (one)) != -1)
+        LOG_DEBUG("virtio-net header enabled on netfd_tx (PACKET_VNET_HDR)");
+    else
+        RUNTIME_EXCEPTION("unable to enable the virtio-net header on netfd_tx (PACKET_VNET_HDR): %s", strerror(errno));
 
-        snprintf(cmd, sizeof (cmd), "route add default gw %s", userconf->runcfg.gw_ip_addr);
-        LOG_VERBOSE("restoring previous default gateway [%s]", cmd);
-        execOSCmd(cmd);
+    memcpy(&tx_ll, &send_ll, sizeof (tx_ll));
+    tx_ll.sll_protocol = 0;
+    if (bind(netfd_tx, (struct sockaddr *) &tx_ll, sizeof (tx_ll)) != -1)
+        LOG_DEBUG("binding datalink layer raw tx interface successfully");
+    else
+        RUNTIME_EXCEPTION("unable to bind datalink layer raw tx interface: %s", strerror(errno));
 
-        snprintf(cmd, sizeof (cmd), "iptables -D INPUT -m mac --mac-source %s -j DROP", userconf->runcfg.gw_mac_str);
-        LOG_VERBOSE("deleting the filtering rule: [%s]", cmd);
-        execOSCmd(cmd);
+    for (uint16_t i = 0; i < net_queue_fds.size(); ++i)
+    {
+        if (setsockopt(net_queue_fds[i], SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof (one)) == -1)
+            RUNTIME_EXCEPTION("unable to ignore the outgoing packets on netfd queue %u (PACKET_IGNORE_OUTGOING): %s", i, strerror(errno));
     }
 
-    close(tunfd);
-    close(netfd);
+    setupETHHDR();
 }
 
-void NetIO::prepareConntrack(TCPTrack *ct)
+/* the poll() datapath never waits in a read or in a write */
+void NetIO::setupNONBLOCK()
 {
-    conntrack = ct;
+    vector<int> nbfds(tun_queue_fds);
+    int tmpflags;
+
+    nbfds.insert(nbfds.end(), net_queue_fds.begin(), net_queue_fds.end());
+    if (netfd_tx != -1)
+        nbfds.push_back(netfd_tx);
+
+    for (uint16_t i = 0; i < nbfds.size(); ++i)
+    {
+        if (((tmpflags = fcntl(nbfds[i], F_GETFL)) == -1) || (fcntl(nbfds[i], F_SETFL, tmpflags | O_NONBLOCK) == -1))
+            RUNTIME_EXCEPTION("unable to set flag O_NONBLOCK on fd %d (F_SETFL): %s", nbfds[i], strerror(errno));
+    }
+
+    LOG_DEBUG("flag O_NONBLOCK set successfully on %u fds (F_SETFL)", nbfds.size());
 }
 
-void NetIO::networkIO(void)
+/*
+ * replaces the packet socket with an AF_XDP socket: registers the UMEM,
+ * maps the four rings, binds the socket to the selected nic queue and
+ * attaches the redirect program to the interface.
+ */
+void NetIO::setupNETXDP()
 {
-    /*
-     * This is a critical function for sniffjoke operativity.
-     *
-     * this function implements a variable poll step
+    int tmpflags;
+    struct xdp_umem_reg umemreg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    socklen_t optlen = sizeof (off);
+    const uint32_t ringsize = XDP_RING_SIZE;
 
-     * if there is some data to send out the poll timout is set to
-     * infinite because it's important to force data flush.
-     *
-     * if there is no data to send out the poll timeout is always
-     * set to 1 ms;
-     *
-     * with a max cycle count of 10 and a poll timeout of 1ms
-     * we will exit if:
-     *    - a burst of 20 pkts (10 network + 10 tunnel) has been received;
-     *    - a delay of 10ms has passed.
-     *
-     * read, read, read and than re-read all comments hundred times
-     * before thinking to change this :P
-     *
-     */
-    uint32_t max_cycle = NETIOBURSTSIZE;
+    close(netfd);
 
-    vector<unsigned char> pktbuf(userconf->runcfg.net_iface_mtu);
+    if ((netfd = socket(AF_XDP, SOCK_RAW, 0)) != -1)
+        LOG_DEBUG("AF_XDP socket opened successfully");
+    else
+        RUNTIME_EXCEPTION("unable to open AF_XDP socket: %s", strerror(errno));
 
-    ssize_t ret;
+    net_queue_fds[0] = netfd;
 
-    Packet *pkt_tun = conntrack->readpacket(TUNNEL);
-    Packet *pkt_net = conntrack->readpacket(NETWORK);
+    if (((tmpflags = fcntl(netfd, F_GETFD)) != -1) && (fcntl(netfd, F_SETFD, tmpflags | FD_CLOEXEC) != -1))
+        LOG_DEBUG("flag FD_CLOEXEC set successfully in netfd (F_SETFD)");
+    else
+        RUNTIME_EXCEPTION("unable to set flag FD_CLOEXEC on netfd (F_SETFD): %s", strerror(errno));
 
-    while (pkt_tun != NULL || pkt_net != NULL || max_cycle)
+    /*
+     * MAP_SHARED: the UMEM is pinned by the kernel here, in the root process,
+     * and a private mapping would be copied in the service child at the fork.
+     */
+    umem = (unsigned char *) mmap(NULL, XDP_UMEM_FRAME_NR * XDP_UMEM_FRAME_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (umem == MAP_FAILED)
     {
-        if (max_cycle != 0) max_cycle--;
-
-        if (pkt_tun != NULL || pkt_net != NULL)
-        {
-            /*
-             * if there is some data to flush out the poll
-             * timeout is set to infinite
-             */
+        umem = NULL;
+        RUNTIME_EXCEPTION("unable to allocate the UMEM area: %s", strerror(errno));
+    }
 
-            fds[0].events = (pkt_net != NULL) ? POLLIN | POLLOUT : POLLIN;
-            fds[1].events = (pkt_tun != NULL) ? POLLIN | POLLOUT : POLLIN;
+    memset(&umemreg, 0x00, sizeof (umemreg));
+    umemreg.addr = (uintptr_t) umem;
+    umemreg.len = XDP_UMEM_FRAME_NR * XDP_UMEM_FRAME_SIZE;
+    umemreg.chunk_size = XDP_UMEM_FRAME_SIZE;
+    umemreg.headroom = 0;
 
-            nfds = poll(fds, 2, -1);
-        }
-        else
-        {
-            /*
-             * if there are not data to flush out the poll
-             * timeout is set to 1ms
-             */
-
-            fds[0].events = POLLIN;
-            fds[1].events = POLLIN;
-
-            timespec timeout;
-            timeout.tv_sec = 0;
-            timeout.tv_nsec = 1000000;
-            nfds = ppoll(fds, 2, &timeout, NULL);
-        }
+    if (setsockopt(netfd, SOL_XDP, XDP_UMEM_REG, &umemreg, sizeof (umemreg)) != -1)
+        LOG_DEBUG("UMEM of %u frames x %u bytes registered (XDP_UMEM_REG)", XDP_UMEM_FRAME_NR, XDP_UMEM_FRAME_SIZE);
+    else
+        RUNTIME_EXCEPTION("unable to register the UMEM (XDP_UMEM_REG): %s", strerror(errno));
 
-        if (!nfds)
-            continue;
+    if (setsockopt(netfd, SOL_XDP, XDP_UMEM_FILL_RING, &ringsize, sizeof (ringsize)) == -1 ||
+        setsockopt(netfd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ringsize, sizeof (ringsize)) == -1 ||
+        setsockopt(netfd, SOL_XDP, XDP_RX_RING, &ringsize, sizeof (ringsize)) == -1 ||
+        setsockopt(netfd, SOL_XDP, XDP_TX_RING, &ringsize, sizeof (ringsize)) == -1)
+        RUNTIME_EXCEPTION("unable to size the AF_XDP rings to %u entries: %s", ringsize, strerror(errno));
 
-        /* in the three cases poll/ppoll is set, now we check the nfds return value */
-        if (nfds == -1)
-            RUNTIME_EXCEPTION("strange and dangerous error in ppoll: %s", strerror(errno));
+    if (getsockopt(netfd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1)
+        RUNTIME_EXCEPTION("unable to get the AF_XDP rings offsets (XDP_MMAP_OFFSETS): %s", strerror(errno));
 
-        if (fds[0].revents & POLLIN) /* it's possibile to read from tunfd */
-        {
-            ret = read(tunfd, &(pktbuf[0]), userconf->runcfg.tun_iface_mtu);
+    setupXDPRING(xdp_fill, XDP_UMEM_PGOFF_FILL_RING, off.fr, sizeof (uint64_t));
+    setupXDPRING(xdp_comp, XDP_UMEM_PGOFF_COMPLETION_RING, off.cr, sizeof (uint64_t));
+    setupXDPRING(xdp_rx, XDP_PGOFF_RX_RING, off.rx, sizeof (struct xdp_desc));
+    setupXDPRING(xdp_tx, XDP_PGOFF_TX_RING, off.tx, sizeof (struct xdp_desc));
 
-            if (ret == -1)
-                RUNTIME_EXCEPTION("error reading from tunnel: %s", strerror(errno));
+    /* the first XDP_RING_SIZE frames fill the fill ring, the others are free for tx */
+    for (uint32_t i = 0; i < XDP_RING_SIZE; ++i)
+        ((uint64_t *) xdp_fill.descs)[i] = (uint64_t) i * XDP_UMEM_FRAME_SIZE;
 
-            conntrack->writepacket(TUNNEL, &(pktbuf[0]), ret);
-        }
+    __sync_synchronize();
+    *xdp_fill.producer = XDP_RING_SIZE;
 
-        if (fds[0].revents & POLLOUT) /* it's possibile to write in tunfd */
-        {
-            ret = write(tunfd, &(pkt_net->pbuf[0]), pkt_net->pbuf.size());
+    for (uint32_t i = XDP_RING_SIZE; i < XDP_UMEM_FRAME_NR; ++i)
+        xdp_tx_free.push_back((uint64_t) i * XDP_UMEM_FRAME_SIZE);
 
-            if (ret == -1) /* on single thread applications after a poll a write returns -1 only on error's case. */
-                RUNTIME_EXCEPTION("error writing in tunnel: %s", strerror(errno));
+    memset(&sxdp, 0x00, sizeof (sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = send_ll.sll_ifindex;
+    sxdp.sxdp_queue_id = userconf->runcfg.xdp_queue;
+    sxdp.sxdp_flags = (userconf->runcfg.xdp_zerocopy ? XDP_ZEROCOPY : XDP_COPY) | XDP_USE_NEED_WAKEUP;
 
-            /* correctly written in tunfd */
-            delete pkt_net;
-            pkt_net = conntrack->readpacket(NETWORK);
-        }
+    if (bind(netfd, (struct sockaddr *) &sxdp, sizeof (sxdp)) != -1)
+        LOG_DEBUG("AF_XDP socket bound to queue %u in %s mode", userconf->runcfg.xdp_queue, userconf->runcfg.xdp_zerocopy ? "zero-copy" : "copy");
+    else
+        RUNTIME_EXCEPTION("unable to bind AF_XDP socket to queue %u in %s mode: %s",
+                          userconf->runcfg.xdp_queue, userconf->runcfg.xdp_zerocopy ? "zero-copy" : "copy", strerror(errno));
 
-        if (fds[1].revents & POLLIN) /* it's possible to read from netfd */
-        {
-            ret = recv(netfd, &(pktbuf[0]), userconf->runcfg.net_iface_mtu, 0);
+    setupETHHDR();
+    setupXDPPROG();
+}
 
-            if (ret == -1)
-                RUNTIME_EXCEPTION("error reading from network: %s", strerror(errno));
+void NetIO::setupXDPRING(struct xdp_ring &ring, off_t pgoff, const struct xdp_ring_offset &off, size_t descsize)
+{
+    ring.maplen = off.desc + XDP_RING_SIZE * descsize;
+    ring.map = mmap(NULL, ring.maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, netfd, pgoff);
+    if (ring.map == MAP_FAILED)
+    {
+        ring.map = NULL;
+        RUNTIME_EXCEPTION("unable to mmap the AF_XDP ring at offset 0x%lx: %s", (unsigned long) pgoff, strerror(errno));
+    }
 
-            conntrack->writepacket(NETWORK, &(pktbuf[0]), ret);
-        }
+    ring.producer = (uint32_t *) ((unsigned char *) ring.map + off.producer);
+    ring.consumer = (uint32_t *) ((unsigned char *) ring.map + off.consumer);
+    ring.flags = (uint32_t *) ((unsigned char *) ring.map + off.flags);
+    ring.descs = (unsigned char *) ring.map + off.desc;
+    ring.mask = XDP_RING_SIZE - 1;
+}
 
-        if (fds[1].revents & POLLOUT) /* it's possibile to write in netfd */
-        {
-            ret = sendto(netfd, &(pkt_tun->pbuf[0]), pkt_tun->pbuf.size(), 0x00, (struct sockaddr *) &send_ll, sizeof (send_ll));
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof (*attr));
+}
 
-            if (ret == -1) /* on single thread applications after a poll a write returns -1 only on error's case. */
-                RUNTIME_EXCEPTION("error writing in network: %s", strerror(errno));
+static struct bpf_insn bpf_insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+    struct bpf_insn insn;
 
-            /* correctly written in netfd */
-            delete pkt_tun;
-            pkt_tun = conntrack->readpacket(TUNNEL);
-        }
-    }
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
 
-    /*
-     * If the flow control arrives here:
-     *   - output data has been flushed entirely
-     *   - there is some input data to handle (maximum 20 pkts i/o) or
-     *     a max delay of 10ms it's passed.
-     */
-    conntrack->analyzePacketQueue();
+    return insn;
 }
 
+/*
+ * creates the XSKMAP, loads the redirect program and attaches it to the
+ * interface with a bpf link: the program is detached by the kernel when
+ * the last process holding the link exits.
+ *
+ * the program, hand assembled to avoid a dependency on libbpf, redirects
+ * to the socket of the rx queue every IPv4 frame whose source is the
+ * gateway mac address; everything else goes on through the stack:
+ *
+ *       r2 = ctx->data, r3 = ctx->data_end
+ *       if (r2 + ETH_HLEN > r3) goto pass
+ *       if (eth->h_proto != ETH_P_IP) goto pass
+ *       if (eth->h_source != gw_mac_addr) goto pass
+ *       return bpf_redirect_map(xskmap, ctx->rx_queue_index, XDP_PASS)
+ * pass: return XDP_PASS
+ */
+void NetIO::setupXDPPROG()
+{
+    union bpf_attr attr;
+    uint32_t key = userconf->runcfg.xdp_queue;
+    uint16_t ethproto = htons(ETH_P_IP);
+    uint32_t gwmac_hi;
+    uint16_t gwmac_lo;
+    const char *license = "GPL";
+
+    /* immediates compared with the packet bytes loaded in host order */
+    memcpy(&gwmac_hi, userconf->runcfg.gw_mac_addr, sizeof (gwmac_hi));
+    memcpy(&gwmac_lo, userconf->runcfg.gw_mac_addr + sizeof (gwmac_hi), sizeof (gwmac_lo));
+
+    memset(&attr, 0x00, sizeof (attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof (uint32_t);
+    attr.value_size = sizeof (uint32_t);
+    attr.max_entries = key + 1;
+
+    if ((xdp_map_fd = sys_bpf(BPF_MAP_CREATE, &attr)) != -1)
+        LOG_DEBUG("XSKMAP of %u entries created", attr.max_entries);
+    else
+        RUNTIME_EXCEPTION("unable to create the XSKMAP: %s", strerror(errno));
+
+    const struct bpf_insn prog[] = {
+        bpf_insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, 0, 0),
+        bpf_insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_1, 4, 0),
+        bpf_insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+        bpf_insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, ETH_HLEN),
+        bpf_insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 15, 0),
+        bpf_insn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 2 * ETH_ALEN, 0),
+        bpf_insn(BPF_ALU | BPF_MOV | BPF_K, BPF_REG_6, 0, 0, ethproto),
+        bpf_insn(BPF_JMP | BPF_JNE | BPF_X, BPF_REG_5, BPF_REG_6, 12, 0),
+        bpf_insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_5, BPF_REG_2, ETH_ALEN, 0),
+        bpf_insn(BPF_ALU | BPF_MOV | BPF_K, BPF_REG_6, 0, 0, gwmac_hi),
+        bpf_insn(BPF_JMP | BPF_JNE | BPF_X, BPF_REG_5, BPF_REG_6, 9, 0),
+        bpf_insn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, ETH_ALEN + 4, 0),
+        bpf_insn(BPF_ALU | BPF_MOV | BPF_K, BPF_REG_6, 0, 0, gwmac_lo),
+        bpf_insn(BPF_JMP | BPF_JNE | BPF_X, BPF_REG_5, BPF_REG_6, 6, 0),
+        bpf_insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, 16, 0),
+        bpf_insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, xdp_map_fd),
+        bpf_insn(0, 0, 0, 0, 0),
+        bpf_insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+        bpf_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        bpf_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        bpf_insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+        bpf_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+    };
+
+    vector<char> verifier_log(GARGANTUABUF);
+
+    memset(&attr, 0x00, sizeof (attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t) prog;
+    attr.insn_cnt = sizeof (prog) / sizeof (prog[0]);
+    attr.license = (uintptr_t) license;
+    attr.log_buf = (uintptr_t) &(verifier_log[0]);
+    attr.log_size = verifier_log.size();
+    attr.log_level = 1;
+
+    if ((xdp_prog_fd = sys_bpf(BPF_PROG_LOAD, &attr)) != -1)
+        LOG_DEBUG("XDP redirect program loaded successfully");
+    else
+        RUNTIME_EXCEPTION("unable to load the XDP redirect program: %s\n%s", strerror(errno), &(verifier_log[0]));
+
+    memset(&attr, 0x00, sizeof (attr));
+    attr.link_create.prog_fd = xdp_prog_fd;
+    attr.link_create.target_ifindex = send_ll.sll_ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = userconf->runcfg.xdp_zerocopy ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+
+    if ((xdp_link_fd = sys_bpf(BPF_LINK_CREATE, &attr)) != -1)
+        LOG_DEBUG("XDP program attached to %s in %s mode", userconf->runcfg.net_iface_name, userconf->runcfg.xdp_zerocopy ? "driver" : "generic");
+    else
+        RUNTIME_EXCEPTION("unable to attach the XDP program to %s: %s", userconf->runcfg.net_iface_name, strerror(errno));
+
+    memset(&attr, 0x00, sizeof (attr));
+    attr.map_fd = xdp_map_fd;
+    attr.key = (uintptr_t) &key;
+    attr.value = (uintptr_t) &netfd;
+    attr.flags = BPF_ANY;
+
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) != -1)
+        LOG_DEBUG("AF_XDP socket inserted in the XSKMAP at queue %u", key);
+    else
+        RUNTIME_EXCEPTION("unable to insert the AF_XDP socket in the XSKMAP: %s", strerror(errno));
+}
+
+/*
+ * creates the io_uring of the process, maps its rings, registers the
+ * provided buffer rings and posts the reads on both the file descriptors.
+ */
+void NetIO::setupURING()
+{
+    struct io_uring_params params;
+    unsigned char *ring;
+
+    memset(&params, 0x00, sizeof (params));
+
+    if ((uring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params)) != -1)
+        LOG_DEBUG("io_uring of %u entries created by process %d", params.sq_entries, getpid());
+    else
+        RUNTIME_EXCEPTION("unable to create the io_uring: %s", strerror(errno));
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG))
+        RUNTIME_EXCEPTION("the io_uring of the running kernel is too old (features 0x%x)", params.features);
+
+    uring_maplen = params.sq_off.array + params.sq_entries * sizeof (uint32_t);
+    if (uring_maplen < params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe))
+        uring_maplen = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+
+    uring_map = mmap(NULL, uring_maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_SQ_RING);
+    if (uring_map == MAP_FAILED)
+    {
+        uring_map = NULL;
+        RUNTIME_EXCEPTION("unable to mmap the io_uring rings: %s", strerror(errno));
+    }
+
+    uring_sq.sqes = (struct io_uring_sqe *) mmap(NULL, params.sq_entries * sizeof (struct io_uring_sqe),
+                                                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_SQES);
+    if (uring_sq.sqes == MAP_FAILED)
+    {
+        uring_sq.sqes = NULL;
+        RUNTIME_EXCEPTION("unable to mmap the io_uring sqes: %s", strerror(errno));
+    }
+
+    ring = (unsigned char *) uring_map;
+
+    uring_sq.head = (uint32_t *) (ring + params.sq_off.head);
+    uring_sq.tail = (uint32_t *) (ring + params.sq_off.tail);
+    uring_sq.array = (uint32_t *) (ring + params.sq_off.array);
+    uring_sq.mask = *(uint32_t *) (ring + params.sq_off.ring_mask);
+    uring_sq.entries = params.sq_entries;
+    uring_sq.tail_local = *uring_sq.tail;
+
+    uring_cq.head = (uint32_t *) (ring + params.cq_off.head);
+    uring_cq.tail = (uint32_t *) (ring + params.cq_off.tail);
+    uring_cq.mask = *(uint32_t *) (ring + params.cq_off.ring_mask);
+    uring_cq.cqes = (struct io_uring_cqe *) (ring + params.cq_off.cqes);
+
+    setupURINGBUFS(uring_netbufs, URING_NETBGID, userconf->runcfg.net_iface_mtu);
+    setupURINGBUFS(uring_tunbufs, URING_TUNBGID, userconf->runcfg.tun_iface_mtu);
+
+    armURINGRECV();
+    armURINGREAD();
+}
+
+void NetIO::setupURINGBUFS(struct uring_bufgroup &group, uint16_t bgid, uint32_t bufsize)
+{
+    struct io_uring_buf_reg reg;
+
+    group.ring = (struct io_uring_buf *) mmap(NULL, URING_BUFFERS * sizeof (struct io_uring_buf),
+                                              PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (group.ring == MAP_FAILED)
+    {
+        group.ring = NULL;
+        RUNTIME_EXCEPTION("unable to allocate the provided buffer ring %u: %s", bgid, strerror(errno));
+    }
+
+    group.mem = (unsigned char *) mmap(NULL, URING_BUFFERS * bufsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (group.mem == MAP_FAILED)
+    {
+        group.mem = NULL;
+        RUNTIME_EXCEPTION("unable to allocate the buffers of the provided buffer ring %u: %s", bgid, strerror(errno));
+    }
+
+    /* the ring tail overlays the reserved field of the first entry */
+    group.tail = (uint16_t *) ((unsigned char *) group.ring + offsetof(struct io_uring_buf, resv));
+    group.tail_local = 0;
+    group.bufsize = bufsize;
+
+    memset(&reg, 0x00, sizeof (reg));
+    reg.ring_addr = (uintptr_t) group.ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = bgid;
+
+    if (syscall(__NR_io_uring_register, uring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != -1)
+        LOG_DEBUG("provided buffer ring %u of %u buffers x %u bytes registered", bgid, URING_BUFFERS, bufsize);
+    else
+        RUNTIME_EXCEPTION("unable to register the provided buffer ring %u (IORING_REGISTER_PBUF_RING): %s", bgid, strerror(errno));
+
+    for (uint16_t bid = 0; bid < URING_BUFFERS; ++bid)
+        provideURINGBUF(group, bid);
+
+    __sync_synchronize();
+    *group.tail = group.tail_local;
+}
+
+void NetIO::setupTUN()
+{
+    const char *tundev = "/dev/net/tun";
+
+    int tmpflags;
+    int tmpfd;
+    struct ifreq tmpifr;
+
+    memset(&tmpifr, 0x00, sizeof (tmpifr));
+
+    if ((tunfd = open(tundev, O_RDWR)) != -1)
+        LOG_DEBUG("%s opened successfully", tundev);
+    else
+        RUNTIME_EXCEPTION("unable to open %s: %s, check the kernel module", tundev, strerror(errno));
+
+    if (((tmpflags = fcntl(tunfd, F_GETFD)) != -1) && (fcntl(tunfd, F_SETFD, tmpflags | FD_CLOEXEC) != -1))
+        LOG_DEBUG("flag FD_CLOEXEC set successfully on tunfd (F_SETFD)");
+    else
+        RUNTIME_EXCEPTION("unable to set flag FD_CLOEXEC on tunfd (F_SETFD): %s", strerror(errno));
+
+    strncpy(tmpifr.ifr_name, TUN_IF_NAME, sizeof (tmpifr.ifr_name));
+    tmpifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+    if (userconf->runcfg.tun_queues > 1)
+        tmpifr.ifr_flags |= IFF_MULTI_QUEUE;
+    if (userconf->runcfg.tun_vnet_hdr)
+        tmpifr.ifr_flags |= IFF_VNET_HDR;
+    if (ioctl(tunfd, TUNSETIFF, &tmpifr) != -1)
+        LOG_DEBUG("flags set successfully on tunfd (TUNSETIFF)");
+    else
+        RUNTIME_EXCEPTION("unable to set flags on tunfd (TUNSETIFF): %s", strerror(errno));
+
+    if (userconf->runcfg.tun_vnet_hdr)
+    {
+        /* the kernel stops segmenting at the tun mtu: a read returns up to a whole TSO packet */
+        if (ioctl(tunfd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4) != -1)
+            LOG_DEBUG("checksum and TSO4 offload enabled on tunfd (TUNSETOFFLOAD)");
+        else
+            RUNTIME_EXCEPTION("unable to enable the offloads on tunfd (TUNSETOFFLOAD): %s", strerror(errno));
+
+        vnet_buf.resize(IP_MAXPACKET);
+    }
+
+    tun_queue_fds.push_back(tunfd);
+
+    /* every further TUNSETIFF on the same name attaches a new queue */
+    for (uint16_t i = 1; i < userconf->runcfg.tun_queues; ++i)
+    {
+        if ((tmpfd = open(tundev, O_RDWR)) == -1)
+            RUNTIME_EXCEPTION("unable to open %s for queue %u: %s", tundev, i, strerror(errno));
+
+        if (((tmpflags = fcntl(tmpfd, F_GETFD)) == -1) || (fcntl(tmpfd, F_SETFD, tmpflags | FD_CLOEXEC) == -1))
+            RUNTIME_EXCEPTION("unable to set flag FD_CLOEXEC on tunfd queue %u (F_SETFD): %s", i, strerror(errno));
+
+        if (ioctl(tmpfd, TUNSETIFF, &tmpifr) == -1)
+            RUNTIME_EXCEPTION("unable to attach tun queue %u (TUNSETIFF): %s", i, strerror(errno));
+
+        tun_queue_fds.push_back(tmpfd);
+    }
+
+    if (userconf->runcfg.tun_queues > 1)
+        LOG_DEBUG("%u queues attached to %s (IFF_MULTI_QUEUE)", tun_queue_fds.size(), TUN_IF_NAME);
+
+    tmpfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+
+    if (ioctl(tmpfd, SIOCGIFFLAGS, &tmpifr) != -1)
+        LOG_DEBUG("tunfd flags correctly read (SIOCGIFFLAGS)");
+    else
+        RUNTIME_EXCEPTION("unable to get tunfd flags (SIOCGIFFLAGS): %s", strerror(errno));
+    tmpifr.ifr_flags |= IFF_UP | IFF_RUNNING | IFF_POINTOPOINT;
+
+    if (ioctl(tmpfd, SIOCSIFFLAGS, &tmpifr) != -1)
+        LOG_DEBUG("tunfd flags correctly set (SIOCSIFFLAGS)");
+    else
+        RUNTIME_EXCEPTION("unable to get tunfd flags (SIOCSIFFLAGS): %s", strerror(errno));
+
+    userconf->runcfg.tun_iface_mtu = userconf->runcfg.net_iface_mtu - TUN_IF_MTU_DIFF;
+    tmpifr.ifr_mtu = userconf->runcfg.tun_iface_mtu;
+    if (ioctl(tmpfd, SIOCSIFMTU, &tmpifr) != -1)
+        LOG_DEBUG("tunfd mtu correctly set to %u (SIOCSIFMTU)", userconf->runcfg.tun_iface_mtu);
+    else
+        RUNTIME_EXCEPTION("unable to set tunfd mtu to %u (SIOCSIFMTU): %s", userconf->runcfg.tun_iface_mtu, strerror(errno));
+
+    ((struct sockaddr_in *) &tmpifr.ifr_addr)->sin_family = AF_INET;
+    ((struct sockaddr_in *) &tmpifr.ifr_addr)->sin_addr.s_addr = inet_addr(userconf->runcfg.net_iface_ip);
+    if (ioctl(tmpfd, SIOCSIFADDR, &tmpifr) != -1)
+        LOG_DEBUG("tunfd local addr correctly set to %s", userconf->runcfg.net_iface_ip);
+    else
+        RUNTIME_EXCEPTION("unable to set tunfd local addr to %s: %s", userconf->runcfg.net_iface_ip, strerror(errno));
+
+    ((struct sockaddr_in *) &tmpifr.ifr_addr)->sin_family = AF_INET;
+    ((struct sockaddr_in *) &tmpifr.ifr_addr)->sin_addr.s_addr = inet_addr(DEFAULT_FAKE_IPADDR);
+    memcpy(userconf->runcfg.tun_iface_ip, DEFAULT_FAKE_IPADDR, strlen(DEFAULT_FAKE_IPADDR));
+    if (ioctl(tmpfd, SIOCSIFDSTADDR, &tmpifr) != -1)
+        LOG_DEBUG("tunfd point-to-point dest addr correctly set to %s", DEFAULT_FAKE_IPADDR);
+    else
+        RUNTIME_EXCEPTION("unable to set tunfd point-to-point dest addr  to %s: %s", DEFAULT_FAKE_IPADDR, strerror(errno));
+
+
+    close(tmpfd);
+}
+
+/*
+ * --selective-route: the applications keep the default gateway of the
+ * system, and the rules below send to SELECTIVE_ROUTE_TABLE, whose only
+ * route is the tun, the traffic that sniffjoke could hack:
+ *
+ *   PRIO      lookup main suppress_prefixlength 0   (the local networks)
+ *   PRIO + 1  to <blacklisted> lookup main | to <whitelisted> goto PRIO + 3
+ *   PRIO + 2  lookup main                            (whitelist only)
+ *   PRIO + 3  ipproto tcp dport <ports not NONE> | ipproto udp: lookup TABLE
+ *
+ * the lists are loaded once, while the ports change with "sniffjokectl set",
+ * so the last group is rebuilt by refreshRouting().
+ */
+void NetIO::setupROUTE()
+{
+    char cmd[MEDIUMBUF];
+    char rule[MEDIUMBUF];
+    struct in_addr addr;
+
+    snprintf(cmd, sizeof (cmd), "ip route add default dev %s table %u", TUN_IF_NAME, SELECTIVE_ROUTE_TABLE);
+    LOG_VERBOSE("routing table %u has the tun as default gateway [%s]", SELECTIVE_ROUTE_TABLE, cmd);
+    execOSCmd(cmd);
+
+    /* the reply of a connection routed through the network comes anyway from the tun */
+    snprintf(cmd, sizeof (cmd), "echo 2 > /proc/sys/net/ipv4/conf/%s/rp_filter", TUN_IF_NAME);
+    execOSCmd(cmd);
+
+    snprintf(rule, sizeof (rule), "lookup main suppress_prefixlength 0 priority %u", SELECTIVE_ROUTE_PRIO);
+    addSysRule(route_rules, "ip rule add", rule);
+
+    if (userconf->runcfg.use_blacklist)
+    {
+        for (IPListMap::iterator it = userconf->runcfg.blacklist->begin(); it != userconf->runcfg.blacklist->end(); ++it)
+        {
+            addr.s_addr = it->first;
+            snprintf(rule, sizeof (rule), "to %s lookup main priority %u", inet_ntoa(addr), SELECTIVE_ROUTE_PRIO + 1);
+            addSysRule(route_rules, "ip rule add", rule);
+        }
+    }
+    else if (userconf->runcfg.use_whitelist)
+    {
+        for (IPListMap::iterator it = userconf->runcfg.whitelist->begin(); it != userconf->runcfg.whitelist->end(); ++it)
+        {
+            addr.s_addr = it->first;
+            snprintf(rule, sizeof (rule), "to %s goto %u priority %u", inet_ntoa(addr), SELECTIVE_ROUTE_PRIO + 3, SELECTIVE_ROUTE_PRIO + 1);
+            addSysRule(route_rules, "ip rule add", rule);
+        }
+
+        snprintf(rule, sizeof (rule), "lookup main priority %u", SELECTIVE_ROUTE_PRIO + 2);
+        addSysRule(route_rules, "ip rule add", rule);
+    }
+
+    route_port_rules = route_rules.size();
+    setupROUTEPORTS();
+
+    LOG_ALL("routing to the tun only the hackable traffic: %u policy rules installed", (uint32_t) route_rules.size());
+}
+
+/*
+ * a rule for every contiguous range of tcp ports with an aggressivity.
+ * the kernel doesn't accept the ports 0 and 65535 in a range: they are
+ * left on the kernel path.
+ */
+void NetIO::setupROUTEPORTS()
+{
+    char rule[MEDIUMBUF];
+    vector<pair<uint16_t, uint16_t> > ranges;
+
+    if (!userconf->runcfg.no_tcp)
+    {
+        hackablePorts(ranges);
+
+        if (ranges.size() > SELECTIVE_ROUTE_MAXPORTRULES)
+        {
+            LOG_ALL("the tcp ports with an aggressivity form %u ranges (max %u): routing all the tcp to the tun",
+                    (uint32_t) ranges.size(), SELECTIVE_ROUTE_MAXPORTRULES);
+
+            snprintf(rule, sizeof (rule), "ipproto tcp lookup %u priority %u", SELECTIVE_ROUTE_TABLE, SELECTIVE_ROUTE_PRIO + 3);
+            addSysRule(route_rules, "ip rule add", rule);
+        }
+        else
+        {
+            for (uint32_t i = 0; i < ranges.size(); ++i)
+            {
+                const uint16_t first = ranges[i].first ? ranges[i].first : 1;
+                const uint16_t last = (ranges[i].second == PORTSNUMBER - 1) ? PORTSNUMBER - 2 : ranges[i].second;
+
+                if (first > last)
+                    continue;
+
+                snprintf(rule, sizeof (rule), "ipproto tcp dport %u-%u lookup %u priority %u",
+                         first, last, SELECTIVE_ROUTE_TABLE, SELECTIVE_ROUTE_PRIO + 3);
+                addSysRule(route_rules, "ip rule add", rule);
+            }
+        }
+    }
+
+    /* every udp port is at least COMMON */
+    if (!userconf->runcfg.no_udp)
+    {
+        snprintf(rule, sizeof (rule), "ipproto udp lookup %u priority %u", SELECTIVE_ROUTE_TABLE, SELECTIVE_ROUTE_PRIO + 3);
+        addSysRule(route_rules, "ip rule add", rule);
+    }
+}
+
+/*
+ * --net-selective-in: in place of all the traffic of the gateway, only the
+ * incoming packets that sniffjoke uses are dropped from the kernel path,
+ * the same classes admitted by the socket filter (see setupNETFILTER):
+ * icmp, the fragments, the tcp syn+ack and, if a plugin mangles the
+ * incoming packets, the tcp coming from the hackable ports. as the filter,
+ * the rules match only the packets addressed to the local ip.
+ */
+void NetIO::setupINTERCEPT()
+{
+    const char * const classes[] = { "-p icmp", "-f", "-p tcp --tcp-flags SYN,ACK SYN,ACK" };
+    char rule[MEDIUMBUF];
+
+    for (uint8_t i = 0; i < sizeof (classes) / sizeof (classes[0]); ++i)
+    {
+        snprintf(rule, sizeof (rule), "INPUT -m mac --mac-source %s -d %s %s -j DROP",
+                 userconf->runcfg.gw_mac_str, userconf->runcfg.net_iface_ip, classes[i]);
+        addSysRule(drop_rules, "iptables -A", rule);
+    }
+
+    drop_port_rules = drop_rules.size();
+    setupINTERCEPTPORTS();
+
+    LOG_ALL("dropping from the gateway only the traffic sniffjoke handles: %u iptables rules installed", (uint32_t) drop_rules.size());
+}
+
+/* the port rules are known only when the service has loaded the plugins */
+void NetIO::setupINTERCEPTPORTS()
+{
+    char rule[MEDIUMBUF];
+    vector<pair<uint16_t, uint16_t> > ranges;
+
+    if (userconf->runcfg.no_tcp || !userconf->runcfg.plugins_incoming)
+        return;
+
+    hackablePorts(ranges);
+
+    if (ranges.size() > SELECTIVE_IN_MAXPORTRANGES)
+    {
+        snprintf(rule, sizeof (rule), "INPUT -m mac --mac-source %s -d %s -p tcp -j DROP",
+                 userconf->runcfg.gw_mac_str, userconf->runcfg.net_iface_ip);
+        addSysRule(drop_rules, "iptables -A", rule);
+        return;
+    }
+
+    for (uint32_t i = 0; i < ranges.size(); ++i)
+    {
+        snprintf(rule, sizeof (rule), "INPUT -m mac --mac-source %s -d %s -p tcp --sport %u:%u -j DROP",
+                 userconf->runcfg.gw_mac_str, userconf->runcfg.net_iface_ip, ranges[i].first, ranges[i].second);
+        addSysRule(drop_rules, "iptables -A", rule);
+    }
+}
+
+/*
+ * the rule dropping from the kernel path the traffic of the gateway: the
+ * socket filter copies in userspace only the packets addressed to the
+ * local ip, so the rule matches only them and the rest (broadcast,
+ * multicast, other local addresses) stays on the kernel path. the XDP
+ * program redirects every IPv4 frame of the gateway instead.
+ */
+string NetIO::gatewayDropRule(void)
+{
+    char rule[MEDIUMBUF];
+
+    if (userconf->runcfg.net_xdp)
+        snprintf(rule, sizeof (rule), "INPUT -m mac --mac-source %s -j DROP", userconf->runcfg.gw_mac_str);
+    else
+        snprintf(rule, sizeof (rule), "INPUT -m mac --mac-source %s -d %s -j DROP",
+                 userconf->runcfg.gw_mac_str, userconf->runcfg.net_iface_ip);
+
+    return rule;
+}
+
+/* the contiguous ranges of ports with an aggressivity different from NONE */
+void NetIO::hackablePorts(vector<pair<uint16_t, uint16_t> > &ranges)
+{
+    uint32_t first = PORTSNUMBER;
+
+    ranges.clear();
+
+    for (uint32_t port = 0; port <= PORTSNUMBER; ++port)
+    {
+        const bool hackable = (port < PORTSNUMBER && userconf->runcfg.portconf[port] != AGG_NONE);
+
+        if (hackable && first == PORTSNUMBER)
+        {
+            first = port;
+        }
+        else if (!hackable && first != PORTSNUMBER)
+        {
+            ranges.push_back(make_pair((uint16_t) first, (uint16_t) (port - 1)));
+            first = PORTSNUMBER;
+        }
+    }
+}
+
+/* tool is the command adding the rule, as "ip rule add" */
+void NetIO::addSysRule(vector<string> &rules, const char *tool, const char *rule)
+{
+    char cmd[MEDIUMBUF];
+
+    snprintf(cmd, sizeof (cmd), "%s %s 2>&1", tool, rule);
+
+    /* ip and iptables are silent on success */
+    const string error = execOSCmd(cmd);
+    if (!error.empty())
+    {
+        LOG_ALL("unable to add the rule [%s %s]: %s", tool, rule, error.c_str());
+        return;
+    }
+
+    LOG_DEBUG("added rule [%s %s]", tool, rule);
+    rules.push_back(rule);
+}
+
+/* deletes the rules installed since the index first; tool is the command deleting one, as "ip rule del" */
+void NetIO::delSysRules(vector<string> &rules, const char *tool, size_t first)
+{
+    char cmd[MEDIUMBUF];
+
+    while (rules.size() > first)
+    {
+        snprintf(cmd, sizeof (cmd), "%s %s", tool, rules.back().c_str());
+        execOSCmd(cmd);
+        rules.pop_back();
+    }
+}
+
+NetIO::NetIO(void) :
+netfd_tx(-1),
+rx_ring(NULL),
+rx_block_size(0),
+rx_block_nr(0),
+rx_block_cur(0),
+tx_ring(NULL),
+tx_frame_size(0),
+tx_frame_nr(0),
+tx_frame_cur(0),
+xdp_map_fd(-1),
+xdp_prog_fd(-1),
+xdp_link_fd(-1),
+umem(NULL),
+xdp_tx_pending(NULL),
+uring_fd(-1),
+uring_map(NULL),
+uring_maplen(0),
+route_port_rules(0),
+drop_port_rules(0)
+{
+    LOG_DEBUG("");
+
+    memset(&xdp_fill, 0x00, sizeof (xdp_fill));
+    memset(&xdp_comp, 0x00, sizeof (xdp_comp));
+    memset(&xdp_rx, 0x00, sizeof (xdp_rx));
+    memset(&xdp_tx, 0x00, sizeof (xdp_tx));
+    memset(&uring_sq, 0x00, sizeof (uring_sq));
+    memset(&uring_cq, 0x00, sizeof (uring_cq));
+    memset(&uring_netbufs, 0x00, sizeof (uring_netbufs));
+    memset(&uring_tunbufs, 0x00, sizeof (uring_tunbufs));
+
+    struct out_ring * const out_rings[] = { &tun_out, &net_out };
+    for (uint8_t i = 0; i < sizeof (out_rings) / sizeof (out_rings[0]); ++i)
+    {
+        out_rings[i]->slot.resize(NETIO_OUTRING_SIZE);
+        out_rings[i]->head = out_rings[i]->count = out_rings[i]->drops = 0;
+    }
+
+    char cmd[MEDIUMBUF];
+
+    if (getuid() || geteuid())
+        RUNTIME_EXCEPTION("required root privileges");
+
+    /* pseudo sanity check of received data, sjconf had already make something */
+    if (strlen(userconf->runcfg.gw_ip_addr) < 7 || strlen(userconf->runcfg.gw_ip_addr) > 17)
+        RUNTIME_EXCEPTION("invalid ip address [%s] is not an IPv4, check the config", userconf->runcfg.gw_ip_addr);
+
+    if (strlen(userconf->runcfg.gw_mac_str) != 17)
+        RUNTIME_EXCEPTION("invalid mac address [%s] is not a MAC, check the config", userconf->runcfg.gw_mac_str);
+
+    setupNET();
+    setupTUN();
+
+    /* the other datapaths wait on their rings or on io_uring */
+    if (!(userconf->runcfg.net_mmap || userconf->runcfg.net_batch || userconf->runcfg.net_xdp || userconf->runcfg.io_uring))
+        setupNONBLOCK();
+
+    fds[0].fd = tunfd;
+    fds[1].fd = netfd;
+
+    if (userconf->runcfg.selective_route)
+    {
+        setupROUTE();
+    }
+    else
+    {
+        snprintf(cmd, sizeof (cmd), "route del default");
+        LOG_VERBOSE("deleting default gateway in routing table");
+        execOSCmd(cmd);
+
+        snprintf(cmd, sizeof (cmd), "route add default gw %s", DEFAULT_FAKE_IPADDR"");
+        LOG_VERBOSE("setting default gateway our fake TUN endpoint ip address: %s", DEFAULT_FAKE_IPADDR);
+        execOSCmd(cmd);
+
+        snprintf(cmd, sizeof (cmd), "route add default gw %s", userconf->runcfg.gw_ip_addr);
+        gw_restore_cmd = cmd;
+    }
+
+    if (userconf->runcfg.net_selective_in)
+    {
+        setupINTERCEPT();
+    }
+    else
+    {
+        gw_drop_rule = gatewayDropRule();
+        snprintf(cmd, sizeof (cmd), "iptables -A %s", gw_drop_rule.c_str());
+        LOG_ALL("dropping the traffic from the gateway [%s]", cmd);
+        execOSCmd(cmd);
+    }
+}
+
+NetIO::~NetIO(void)
+{
+    LOG_DEBUG("");
+
+    char cmd[MEDIUMBUF];
+
+    if (getuid() || geteuid())
+        LOG_VERBOSE("this process (%d) is not root: unable to restore default gw", getpid());
+    else
+    {
+        /* the rules and the commands are the ones kept at the setup, userconf can be already destroyed */
+        if (!drop_rules.empty())
+        {
+            LOG_VERBOSE("root process (%d): deleting %u filtering rules", getpid(), (uint32_t) drop_rules.size());
+            delSysRules(drop_rules, "iptables -D", 0);
+        }
+
+        if (!route_rules.empty())
+        {
+            LOG_VERBOSE("root process (%d): deleting %u routing rules", getpid(), (uint32_t) route_rules.size());
+            delSysRules(route_rules, "ip rule del", 0);
+
+            snprintf(cmd, sizeof (cmd), "ip route flush table %u", SELECTIVE_ROUTE_TABLE);
+            execOSCmd(cmd);
+
+            snprintf(cmd, sizeof (cmd), "ifconfig %s down", TUN_IF_NAME);
+            LOG_VERBOSE("shutting down  interface [%s]", TUN_IF_NAME, cmd);
+            execOSCmd(cmd);
+        }
+        else
+        {
+            snprintf(cmd, sizeof (cmd), "route del default");
+            LOG_VERBOSE("root process (%d): deleting our default gw [route del default]", getpid());
+            execOSCmd(cmd);
+
+            snprintf(cmd, sizeof (cmd), "ifconfig %s down", TUN_IF_NAME);
+            LOG_VERBOSE("shutting down  interface [%s]", TUN_IF_NAME, cmd);
+            execOSCmd(cmd);
+
+            if (!gw_restore_cmd.empty())
+            {
+                LOG_VERBOSE("restoring previous default gateway [%s]", gw_restore_cmd.c_str());
+                execOSCmd(gw_restore_cmd.c_str());
+            }
+        }
+
+        if (!gw_drop_rule.empty())
+        {
+            snprintf(cmd, sizeof (cmd), "iptables -D %s", gw_drop_rule.c_str());
+            LOG_VERBOSE("deleting the filtering rule: [%s]", cmd);
+            execOSCmd(cmd);
+        }
+    }
+
+    if (rx_ring != NULL)
+        munmap(rx_ring, rx_block_size * rx_block_nr);
+
+    if (tx_ring != NULL)
+        munmap(tx_ring, rx_block_size * rx_block_nr);
+
+    if (netfd_tx != -1)
+        close(netfd_tx);
+
+    delete xdp_tx_pending;
+
+    struct xdp_ring * const xdp_rings[] = { &xdp_fill, &xdp_comp, &xdp_rx, &xdp_tx };
+    for (uint8_t i = 0; i < sizeof (xdp_rings) / sizeof (xdp_rings[0]); ++i)
+    {
+        if (xdp_rings[i]->map != NULL)
+            munmap(xdp_rings[i]->map, xdp_rings[i]->maplen);
+    }
+
+    if (umem != NULL)
+        munmap(umem, XDP_UMEM_FRAME_NR * XDP_UMEM_FRAME_SIZE);
+
+    /* closing the last reference to the link detaches the XDP program */
+    if (xdp_link_fd != -1)
+        close(xdp_link_fd);
+
+    if (xdp_prog_fd != -1)
+        close(xdp_prog_fd);
+
+    if (xdp_map_fd != -1)
+        close(xdp_map_fd);
+
+    if (tun_out.drops || net_out.drops)
+        LOG_VERBOSE("output rings full: %u packets dropped toward the tunnel, %u toward the network", tun_out.drops, net_out.drops);
+
+    struct out_ring * const out_rings[] = { &tun_out, &net_out };
+    for (uint8_t i = 0; i < sizeof (out_rings) / sizeof (out_rings[0]); ++i)
+    {
+        for (; out_rings[i]->count; --out_rings[i]->count)
+        {
+            delete out_rings[i]->slot[out_rings[i]->head];
+            out_rings[i]->head = (out_rings[i]->head + 1) % out_rings[i]->slot.size();
+        }
+    }
+
+    /* the packets still owned by in-flight writes are lost with the process */
+    if (uring_fd != -1)
+        close(uring_fd);
+
+    if (uring_map != NULL)
+        munmap(uring_map, uring_maplen);
+
+    if (uring_sq.sqes != NULL)
+        munmap(uring_sq.sqes, uring_sq.entries * sizeof (struct io_uring_sqe));
+
+    struct uring_bufgroup * const uring_bufs[] = { &uring_netbufs, &uring_tunbufs };
+    for (uint8_t i = 0; i < sizeof (uring_bufs) / sizeof (uring_bufs[0]); ++i)
+    {
+        if (uring_bufs[i]->ring != NULL)
+            munmap(uring_bufs[i]->ring, URING_BUFFERS * sizeof (struct io_uring_buf));
+
+        if (uring_bufs[i]->mem != NULL)
+            munmap(uring_bufs[i]->mem, URING_BUFFERS * uring_bufs[i]->bufsize);
+    }
+
+    for (uint16_t i = 0; i < tun_queue_fds.size(); ++i)
+        close(tun_queue_fds[i]);
+
+    for (uint16_t i = 0; i < net_queue_fds.size(); ++i)
+        close(net_queue_fds[i]);
+}
+
+/*
+ * called by every worker after the fork: keeps the tun queue and the
+ * packet socket of the worker and closes the ones of the others.
+ */
+void NetIO::selectQueue(uint16_t queue)
+{
+    for (uint16_t i = 0; i < tun_queue_fds.size(); ++i)
+    {
+        if (i != queue)
+        {
+            close(tun_queue_fds[i]);
+            close(net_queue_fds[i]);
+        }
+    }
+
+    tunfd = tun_queue_fds[queue];
+    netfd = net_queue_fds[queue];
+
+    tun_queue_fds.assign(1, tunfd);
+    net_queue_fds.assign(1, netfd);
+
+    fds[0].fd = tunfd;
+    fds[1].fd = netfd;
+
+    LOG_DEBUG("process %d serves the tun queue %u", getpid(), queue);
+}
+
+/*
+ * executed by the root process, after it has applied on its copy of the
+ * configuration a change forwarded by the service.
+ */
+void NetIO::refreshRules(void)
+{
+    if (userconf->runcfg.selective_route)
+    {
+        delSysRules(route_rules, "ip rule del", route_port_rules);
+        setupROUTEPORTS();
+
+        LOG_VERBOSE("routing rules updated: %u tcp/udp rules", (uint32_t) (route_rules.size() - route_port_rules));
+    }
+
+    if (userconf->runcfg.net_selective_in)
+    {
+        delSysRules(drop_rules, "iptables -D", drop_port_rules);
+        setupINTERCEPTPORTS();
+
+        LOG_VERBOSE("filtering rules updated: %u tcp port rules", (uint32_t) (drop_rules.size() - drop_port_rules));
+    }
+}
+
+/* executed by the service, and by every worker, when the port configuration changes */
+void NetIO::refreshFilter(void)
+{
+    if (userconf->runcfg.net_selective_in)
+        setupNETFILTER();
+}
+
+void NetIO::networkIO(void)
+{
+    /*
+     * This is a critical function for sniffjoke operativity.
+     *
+     * this function implements a variable poll step
+
+     * the data to send out is written first, on non-blocking fds: the
+     * packets refused by a fd wait in its output ring, and the fd is
+     * polled for POLLOUT too. a full fd can't stall the other one.
+     *
+     * the poll timeout is always set to 1 ms;
+     *
+     * with a max cycle count of 10 and a poll timeout of 1ms
+     * we will exit if:
+     *    - a burst of 20 pkts (10 network + 10 tunnel) has been received;
+     *    - a delay of 10ms has passed.
+     *
+     * read, read, read and than re-read all comments hundred times
+     * before thinking to change this :P
+     *
+     */
+    if (userconf->runcfg.io_uring)
+    {
+        networkIOUring();
+        return;
+    }
+
+    if (userconf->runcfg.net_mmap || userconf->runcfg.net_batch || userconf->runcfg.net_xdp)
+    {
+        networkIOBatch();
+        return;
+    }
+
+    uint32_t max_cycle = NETIOBURSTSIZE;
+
+    vector<unsigned char> pktbuf(userconf->runcfg.net_iface_mtu);
+
+    ssize_t ret;
+
+    fillOutRing(tun_out, NETWORK);
+    fillOutRing(net_out, TUNNEL);
+
+    while (max_cycle--)
+    {
+        /*
+         * the rings are written before polling: POLLOUT is requested
+         * only by a fd that has refused some packet, and the timeout
+         * stays 1ms, so a slow consumer never stops the reads.
+         */
+        fds[0].events = flushOutRing(tun_out) ? POLLIN : POLLIN | POLLOUT;
+        fds[1].events = flushOutRing(net_out) ? POLLIN : POLLIN | POLLOUT;
+
+        timespec timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_nsec = 1000000;
+        nfds = ppoll(fds, 2, &timeout, NULL);
+
+        if (!nfds)
+            continue;
+
+        if (nfds == -1)
+            RUNTIME_EXCEPTION("strange and dangerous error in ppoll: %s", strerror(errno));
+
+        if (fds[0].revents & POLLIN) /* it's possibile to read from tunfd */
+        {
+            if (userconf->runcfg.tun_vnet_hdr)
+            {
+                recvTUNVNET();
+            }
+            else
+            {
+                ret = read(tunfd, &(pktbuf[0]), userconf->runcfg.tun_iface_mtu);
+
+                if (ret != -1)
+                {
+                    receiveFrame(TUNNEL, &(pktbuf[0]), ret, NULL);
+                }
+                else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    RUNTIME_EXCEPTION("error reading from tunnel: %s", strerror(errno));
+            }
+        }
+
+        if (fds[1].revents & POLLIN) /* it's possible to read from netfd */
+        {
+            ret = recv(netfd, &(pktbuf[0]), userconf->runcfg.net_iface_mtu, 0);
+
+            if (ret != -1)
+            {
+                receiveFrame(NETWORK, &(pktbuf[0]), ret, NULL);
+            }
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                RUNTIME_EXCEPTION("error reading from network: %s", strerror(errno));
+        }
+    }
+
+    /*
+     * If the flow control arrives here:
+     *   - the output rings have been written as far as the fds accepted;
+     *   - there is some input data to handle (maximum 20 pkts i/o) or
+     *     a max delay of 10ms it's passed.
+     */
+    conntrack->analyzePacketQueue();
+}
+
+/* moves the SEND queue of a direction in its ring: what doesn't fit is dropped */
+void NetIO::fillOutRing(struct out_ring &ring, source_t source)
+{
+    Packet *pkt;
+
+    while ((pkt = conntrack->readpacket(source)) != NULL)
+    {
+        if (ring.count == ring.slot.size())
+        {
+            pkt->SELFLOG("dropped: the output ring is full");
+            ++ring.drops;
+            delete pkt;
+            continue;
+        }
+
+        ring.slot[(ring.head + ring.count) % ring.slot.size()] = pkt;
+        ++ring.count;
+    }
+}
+
+/*
+ * writes the ring until the fd refuses a packet, returning false in this
+ * case: EAGAIN and ENOBUFS (the device queue is full) are retried later.
+ */
+bool NetIO::flushOutRing(struct out_ring &ring)
+{
+    const bool to_tun = (&ring == &tun_out);
+
+    while (ring.count)
+    {
+        Packet * const pkt = ring.slot[ring.head];
+
+        if ((to_tun ? writeTUN(*pkt) : sendNET(*pkt)) == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+                return false;
+
+            RUNTIME_EXCEPTION("error writing in %s: %s", to_tun ? "tunnel" : "network", strerror(errno));
+        }
+
+        delete pkt;
+        ring.head = (ring.head + 1) % ring.slot.size();
+        --ring.count;
+    }
+
+    return true;
+}
+
+ssize_t NetIO::writeTUN(Packet &pkt)
+{
+    if (userconf->runcfg.tun_vnet_hdr)
+        return writeTUNVNET(pkt);
+
+    return write(tunfd, &(pkt.pbuf[0]), pkt.pbuf.size());
+}
+
+ssize_t NetIO::sendNET(Packet &pkt)
+{
+    if (netfd_tx != -1)
+        return sendNETVNET(pkt);
+
+    return sendto(netfd, &(pkt.pbuf[0]), pkt.pbuf.size(), 0x00, (struct sockaddr *) &send_ll, sizeof (send_ll));
+}
+
+/*
+ * hands a received frame to the conntrack, or forwards it at once when
+ * TCPTrack::bypass() permits it. a bypassed frame refused by the fd is
+ * queued and moved immediately in the ring of its direction: the ring is
+ * not empty anymore, so the next frames of the flow are queued after it
+ * instead of overtaking it.
+ */
+void NetIO::receiveFrame(source_t source, const unsigned char *buff, size_t len, const struct vnet_hdr *vnethdr)
+{
+    reject_t reject;
+    uint8_t proto;
+
+    if (!conntrack->bypass(buff, len, vnethdr, reject, proto))
+    {
+        conntrack->writepacket(source, buff, len, vnethdr, reject, proto);
+        return;
+    }
+
+    if (source == TUNNEL ? forwardNET(buff, len, vnethdr) : forwardTUN(buff, len))
+        return;
+
+    conntrack->writepacket(source, buff, len, vnethdr, reject, proto);
+    fillOutRing(source == TUNNEL ? net_out : tun_out, source);
+}
+
+/*
+ * the fast path of the frames classified by TCPTrack::bypass(): they are
+ * written directly from the receive buffer, without a Packet. false tells
+ * the caller to queue the frame as usual: the ring of the direction is
+ * waiting for the fd, or the fd has refused the frame.
+ */
+bool NetIO::forwardTUN(const unsigned char *buff, size_t len)
+{
+    if (tun_out.count)
+        return false;
+
+    ssize_t ret;
+
+    if (userconf->runcfg.tun_vnet_hdr)
+    {
+        struct vnet_hdr vnethdr;
+        struct iovec iov[2];
+
+        memset(&vnethdr, 0x00, sizeof (vnethdr));
+
+        iov[0].iov_base = &vnethdr;
+        iov[0].iov_len = sizeof (vnethdr);
+        iov[1].iov_base = (void *) buff;
+        iov[1].iov_len = len;
+
+        ret = writev(tunfd, iov, 2);
+    }
+    else
+    {
+        ret = write(tunfd, buff, len);
+    }
+
+    if (ret != -1)
+        return true;
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+        return false;
+
+    RUNTIME_EXCEPTION("error writing in tunnel: %s", strerror(errno));
+}
+
+/* the offsets of the virtio-net header are moved as sendNETVNET() does */
+bool NetIO::forwardNET(const unsigned char *buff, size_t len, const struct vnet_hdr *vnethdr)
+{
+    if (net_out.count)
+        return false;
+
+    ssize_t ret;
+
+    if (netfd_tx != -1)
+    {
+        struct vnet_hdr txhdr;
+        struct iovec iov[3];
+
+        if (vnethdr != NULL)
+            txhdr = *vnethdr;
+        else
+            memset(&txhdr, 0x00, sizeof (txhdr));
+
+        if (txhdr.flags & VNET_HDR_F_NEEDS_CSUM)
+            txhdr.csum_start += ETH_HLEN;
+
+        /* bypass() accepts only TSO4 on a complete tcp header */
+        if (txhdr.gso_type != VNET_HDR_GSO_NONE)
+        {
+            const uint16_t iphdrlen = (buff[0] & 0x0f) * 4;
+            txhdr.hdr_len = ETH_HLEN + iphdrlen + (buff[iphdrlen + 12] >> 4) * 4;
+        }
+
+        iov[0].iov_base = &txhdr;
+        iov[0].iov_len = sizeof (txhdr);
+        iov[1].iov_base = net_ethhdr;
+        iov[1].iov_len = ETH_HLEN;
+        iov[2].iov_base = (void *) buff;
+        iov[2].iov_len = len;
+
+        ret = writev(netfd_tx, iov, 3);
+    }
+    else
+    {
+        ret = sendto(netfd, buff, len, 0x00, (struct sockaddr *) &send_ll, sizeof (send_ll));
+    }
+
+    if (ret != -1)
+        return true;
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+        return false;
+
+    RUNTIME_EXCEPTION("error writing in network: %s", strerror(errno));
+}
+
+/* a tun read starts with the virtio-net header describing the offloads of the packet */
+void NetIO::recvTUNVNET(void)
+{
+    struct vnet_hdr vnethdr;
+    struct iovec iov[2];
+
+    iov[0].iov_base = &vnethdr;
+    iov[0].iov_len = sizeof (vnethdr);
+    iov[1].iov_base = &(vnet_buf[0]);
+    iov[1].iov_len = vnet_buf.size();
+
+    const ssize_t ret = readv(tunfd, iov, 2);
+
+    if (ret == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+
+        RUNTIME_EXCEPTION("error reading from tunnel: %s", strerror(errno));
+    }
+
+    if (ret < (ssize_t) sizeof (vnethdr))
+        RUNTIME_EXCEPTION("short read from tunnel: %d bytes without the virtio-net header", ret);
+
+    const size_t len = ret - sizeof (vnethdr);
+
+    receiveFrame(TUNNEL, &(vnet_buf[0]), len, &vnethdr);
+}
+
+/* the packets coming from the network carry a zeroed header: no offload requested */
+ssize_t NetIO::writeTUNVNET(Packet &pkt)
+{
+    struct iovec iov[2];
+
+    iov[0].iov_base = &(pkt.vnethdr);
+    iov[0].iov_len = sizeof (pkt.vnethdr);
+    iov[1].iov_base = &(pkt.pbuf[0]);
+    iov[1].iov_len = pkt.pbuf.size();
+
+    return writev(tunfd, iov, 2);
+}
+
+/*
+ * the header of the packet is forwarded as is, but on a SOCK_RAW socket
+ * its offsets count from the ethernet header, that we prepend.
+ */
+ssize_t NetIO::sendNETVNET(Packet &pkt)
+{
+    struct vnet_hdr vnethdr = pkt.vnethdr;
+    struct iovec iov[3];
+
+    if (vnethdr.flags & VNET_HDR_F_NEEDS_CSUM)
+        vnethdr.csum_start += ETH_HLEN;
+
+    if (pkt.isGSO())
+        vnethdr.hdr_len = ETH_HLEN + pkt.iphdrlen + pkt.tcphdrlen;
+
+    iov[0].iov_base = &vnethdr;
+    iov[0].iov_len = sizeof (vnethdr);
+    iov[1].iov_base = net_ethhdr;
+    iov[1].iov_len = ETH_HLEN;
+    iov[2].iov_base = &(pkt.pbuf[0]);
+    iov[2].iov_len = pkt.pbuf.size();
+
+    return writev(netfd_tx, iov, 3);
+}
+
+/*
+ * walks every rx block released by the kernel, handing each frame to the
+ * conntrack directly from the ring, and gives the block back.
+ */
+void NetIO::recvNETMMAP(void)
+{
+    struct tpacket_block_desc *pbd;
+
+    while (true)
+    {
+        pbd = (struct tpacket_block_desc *) (rx_ring + (rx_block_cur * rx_block_size));
+
+        if (!(pbd->hdr.bh1.block_status & TP_STATUS_USER))
+            break;
+
+        struct tpacket3_hdr *ppd = (struct tpacket3_hdr *) ((unsigned char *) pbd + pbd->hdr.bh1.offset_to_first_pkt);
+
+        for (uint32_t i = 0; i < pbd->hdr.bh1.num_pkts; ++i)
+        {
+            const struct sockaddr_ll *sll = (struct sockaddr_ll *) ((unsigned char *) ppd + TPACKET_ALIGN(sizeof (struct tpacket3_hdr)));
+
+            /* netfd_tx frames are looped back to us as PACKET_OUTGOING */
+            if (sll->sll_pkttype != PACKET_OUTGOING)
+                conntrack->writepacket(NETWORK, (unsigned char *) ppd + ppd->tp_net, ppd->tp_snaplen);
+
+            ppd = (struct tpacket3_hdr *) ((unsigned char *) ppd + ppd->tp_next_offset);
+        }
+
+        __sync_synchronize();
+        pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+        rx_block_cur = (rx_block_cur + 1) % rx_block_nr;
+    }
+}
+
+/*
+ * copies every network-bound packet of the SEND queue in the tx ring
+ * and submits all of them with a single sendto().
+ */
+void NetIO::flushNETMMAP(void)
+{
+    struct tpacket2_hdr *hdr;
+    uint32_t queued = 0;
+    Packet *pkt;
+
+    while ((pkt = conntrack->readpacket(TUNNEL)) != NULL)
+    {
+        hdr = (struct tpacket2_hdr *) (tx_ring + (tx_frame_cur * tx_frame_size));
+
+        if (hdr->tp_status & TP_STATUS_WRONG_FORMAT)
+        {
+            LOG_ALL("tx ring frame %u rejected by the kernel: dropped", tx_frame_cur);
+            hdr->tp_status = TP_STATUS_AVAILABLE;
+        }
+
+        if (hdr->tp_status != TP_STATUS_AVAILABLE)
+        {
+            /* ring full: a blocking kick returns when the pending frames are sent */
+            if (sendto(netfd_tx, NULL, 0, 0x00, (struct sockaddr *) &send_ll, sizeof (send_ll)) == -1)
+                RUNTIME_EXCEPTION("error flushing the tx ring: %s", strerror(errno));
+
+            queued = 0;
+
+            if (hdr->tp_status != TP_STATUS_AVAILABLE)
+                RUNTIME_EXCEPTION("tx ring stalled on frame %u (status %u)", tx_frame_cur, hdr->tp_status);
+        }
+
+        memcpy((unsigned char *) hdr + TPACKET2_HDRLEN - sizeof (struct sockaddr_ll), &(pkt->pbuf[0]), pkt->pbuf.size());
+        hdr->tp_len = pkt->pbuf.size();
+
+        __sync_synchronize();
+        hdr->tp_status = TP_STATUS_SEND_REQUEST;
+
+        tx_frame_cur = (tx_frame_cur + 1) % tx_frame_nr;
+        ++queued;
+
+        delete pkt;
+    }
+
+    if (queued && sendto(netfd_tx, NULL, 0, 0x00, (struct sockaddr *) &send_ll, sizeof (send_ll)) == -1)
+        RUNTIME_EXCEPTION("error flushing the tx ring: %s", strerror(errno));
+}
+
+/*
+ * drains up to net_batch_size frames already queued on netfd
+ * with a single recvmmsg(), then hands them to the conntrack.
+ */
+void NetIO::recvNETBATCH(void)
+{
+    int ret = recvmmsg(netfd, &(batch_rx[0]), batch_rx.size(), MSG_DONTWAIT, NULL);
+
+    if (ret == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+
+        RUNTIME_EXCEPTION("error reading from network: %s", strerror(errno));
+    }
+
+    for (int i = 0; i < ret; ++i)
+        conntrack->writepacket(NETWORK, (unsigned char *) batch_rx_iov[i].iov_base, batch_rx[i].msg_len);
+}
+
+/*
+ * flushes every network-bound packet of the SEND queue, using a
+ * sendmmsg() for every net_batch_size packets.
+ */
+void NetIO::flushNETBATCH(void)
+{
+    Packet *pkt;
+    uint32_t queued;
+    uint32_t sent;
+    int ret;
+
+    do
+    {
+        for (queued = 0; queued < batch_tx.size() && (pkt = conntrack->readpacket(TUNNEL)) != NULL; ++queued)
+        {
+            batch_tx_pkt[queued] = pkt;
+            batch_tx_iov[queued].iov_base = &(pkt->pbuf[0]);
+            batch_tx_iov[queued].iov_len = pkt->pbuf.size();
+        }
+
+        /* sendmmsg could return before the whole vector is sent */
+        for (sent = 0; sent < queued; sent += ret)
+        {
+            ret = sendmmsg(netfd, &(batch_tx[sent]), queued - sent, 0x00);
+
+            if (ret == -1)
+                RUNTIME_EXCEPTION("error writing in network: %s", strerror(errno));
+        }
+
+        for (sent = 0; sent < queued; ++sent)
+            delete batch_tx_pkt[sent];
+    }
+    while (queued == batch_tx.size());
+}
+
+/*
+ * hands every frame of the rx ring to the conntrack, reading it in place
+ * from the UMEM, and gives the frames back to the kernel in the fill ring.
+ */
+void NetIO::recvNETXDP(void)
+{
+    const struct xdp_desc *rx = (struct xdp_desc *) xdp_rx.descs;
+    uint64_t *fill = (uint64_t *) xdp_fill.descs;
+    const uint32_t prod = *xdp_rx.producer;
+    uint32_t cons = *xdp_rx.consumer;
+    uint32_t fillprod = *xdp_fill.producer;
+
+    /* descriptors must be read after the producer index */
+    __sync_synchronize();
+
+    /* fill and rx never overflow: they share the XDP_RING_SIZE rx frames */
+    for (; cons != prod; ++cons, ++fillprod)
+    {
+        const struct xdp_desc *desc = &rx[cons & xdp_rx.mask];
+
+        if (desc->len > ETH_HLEN)
+            conntrack->writepacket(NETWORK, umem + desc->addr + ETH_HLEN, desc->len - ETH_HLEN);
+
+        fill[fillprod & xdp_fill.mask] = desc->addr & ~((uint64_t) XDP_UMEM_FRAME_SIZE - 1);
+    }
+
+    __sync_synchronize();
+    *xdp_rx.consumer = cons;
+    *xdp_fill.producer = fillprod;
+
+    if ((*xdp_fill.flags & XDP_RING_NEED_WAKEUP) && recvfrom(netfd, NULL, 0, MSG_DONTWAIT, NULL, NULL) == -1 && errno != EAGAIN)
+        RUNTIME_EXCEPTION("error waking up the AF_XDP fill ring: %s", strerror(errno));
+}
+
+/*
+ * recycles the frames completed by the kernel, then copies every
+ * network-bound packet of the SEND queue in a free tx frame behind the
+ * ethernet header. when the frames are exhausted the packet is kept in
+ * xdp_tx_pending and sent at the next flush.
+ */
+void NetIO::flushNETXDP(void)
+{
+    const uint64_t *comp = (uint64_t *) xdp_comp.descs;
+    struct xdp_desc *tx = (struct xdp_desc *) xdp_tx.descs;
+    const uint32_t compprod = *xdp_comp.producer;
+    uint32_t compcons = *xdp_comp.consumer;
+    uint32_t prod = *xdp_tx.producer;
+    uint32_t queued = 0;
+
+    __sync_synchronize();
+
+    for (; compcons != compprod; ++compcons)
+        xdp_tx_free.push_back(comp[compcons & xdp_comp.mask]);
+
+    __sync_synchronize();
+    *xdp_comp.consumer = compcons;
+
+    if (xdp_tx_pending == NULL)
+        xdp_tx_pending = conntrack->readpacket(TUNNEL);
+
+    while (xdp_tx_pending != NULL && !xdp_tx_free.empty())
+    {
+        const uint64_t addr = xdp_tx_free.back();
+        xdp_tx_free.pop_back();
+
+        memcpy(umem + addr, net_ethhdr, ETH_HLEN);
+        memcpy(umem + addr + ETH_HLEN, &(xdp_tx_pending->pbuf[0]), xdp_tx_pending->pbuf.size());
+
+        tx[prod & xdp_tx.mask].addr = addr;
+        tx[prod & xdp_tx.mask].len = ETH_HLEN + xdp_tx_pending->pbuf.size();
+        tx[prod & xdp_tx.mask].options = 0;
+        ++prod;
+        ++queued;
+
+        delete xdp_tx_pending;
+        xdp_tx_pending = conntrack->readpacket(TUNNEL);
+    }
+
+    if (queued)
+    {
+        __sync_synchronize();
+        *xdp_tx.producer = prod;
+    }
+
+    /* in copy mode the frames are transmitted by this kick */
+    if ((queued || xdp_tx_pending != NULL) && (*xdp_tx.flags & XDP_RING_NEED_WAKEUP))
+    {
+        if (sendto(netfd, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1 && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+            RUNTIME_EXCEPTION("error flushing the AF_XDP tx ring: %s", strerror(errno));
+    }
+}
+
+/*
+ * returns a zeroed sqe at the tail of the submission queue; when the
+ * queue is full the pending sqes are submitted first.
+ */
+struct io_uring_sqe *NetIO::getURINGSQE(void)
+{
+    if (uring_sq.tail_local - *uring_sq.head == uring_sq.entries)
+        enterURING(0, NULL);
+
+    const uint32_t idx = uring_sq.tail_local & uring_sq.mask;
+    struct io_uring_sqe *sqe = &uring_sq.sqes[idx];
+
+    memset(sqe, 0x00, sizeof (*sqe));
+    uring_sq.array[idx] = idx;
+    ++uring_sq.tail_local;
+
+    return sqe;
+}
+
+/* the new tail is published by the caller, once per batch */
+void NetIO::provideURINGBUF(struct uring_bufgroup &group, uint16_t bid)
+{
+    struct io_uring_buf *buf = &group.ring[group.tail_local & (URING_BUFFERS - 1)];
+
+    buf->addr = (uintptr_t) (group.mem + bid * group.bufsize);
+    buf->len = group.bufsize;
+    buf->bid = bid;
+    ++group.tail_local;
+}
+
+void NetIO::armURINGRECV(void)
+{
+    struct io_uring_sqe *sqe = getURINGSQE();
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = netfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_NETBGID;
+    sqe->user_data = URING_NETRECV;
+}
+
+/* a single read per time, so the packets of the tunnel are never reordered */
+void NetIO::armURINGREAD(void)
+{
+    struct io_uring_sqe *sqe = getURINGSQE();
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = tunfd;
+    sqe->off = ~(uint64_t) 0;
+    sqe->len = userconf->runcfg.tun_iface_mtu;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_TUNBGID;
+    sqe->user_data = URING_TUNREAD;
+}
+
+/*
+ * submits the queued sqes and, with min_complete, sleeps until that
+ * number of completions is ready or the timeout expires.
+ */
+void NetIO::enterURING(uint32_t min_complete, struct __kernel_timespec *ts)
+{
+    struct io_uring_getevents_arg arg;
+    const uint32_t to_submit = uring_sq.tail_local - *uring_sq.tail;
+
+    __sync_synchronize();
+    *uring_sq.tail = uring_sq.tail_local;
+
+    memset(&arg, 0x00, sizeof (arg));
+    arg.ts = (uintptr_t) ts;
+
+    if (syscall(__NR_io_uring_enter, uring_fd, to_submit, min_complete,
+                IORING_ENTER_EXT_ARG | (min_complete ? IORING_ENTER_GETEVENTS : 0), &arg, sizeof (arg)) == -1)
+    {
+        /* ETIME: timeout expired, EBUSY: completions in overflow, to be reaped */
+        if (errno != ETIME && errno != EINTR && errno != EBUSY)
+            RUNTIME_EXCEPTION("strange and dangerous error in io_uring_enter: %s", strerror(errno));
+    }
+}
+
+/*
+ * the completions drive the conntrack directly: received packets are
+ * copied from the provided buffer, which goes back to its ring, and
+ * written packets are released.
+ */
+uint32_t NetIO::reapURING(void)
+{
+    uint32_t head = *uring_cq.head;
+    const uint32_t tail = *uring_cq.tail;
+    bool rearm_recv = false;
+    bool rearm_read = false;
+
+    __sync_synchronize();
+
+    for (; head != tail; ++head)
+    {
+        const struct io_uring_cqe *cqe = &uring_cq.cqes[head & uring_cq.mask];
+        const uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if (cqe->user_data == URING_NETRECV)
+        {
+            /* ENOBUFS: the provided buffers were exhausted, the recv is posted again */
+            if (cqe->res < 0 && cqe->res != -ENOBUFS)
+                RUNTIME_EXCEPTION("error reading from network: %s", strerror(-cqe->res));
+
+            if (cqe->flags & IORING_CQE_F_BUFFER)
+            {
+                conntrack->writepacket(NETWORK, uring_netbufs.mem + bid * uring_netbufs.bufsize, cqe->res);
+                provideURINGBUF(uring_netbufs, bid);
+            }
+
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                rearm_recv = true;
+        }
+        else if (cqe->user_data == URING_TUNREAD)
+        {
+            if (cqe->res < 0 && cqe->res != -ENOBUFS)
+                RUNTIME_EXCEPTION("error reading from tunnel: %s", strerror(-cqe->res));
+
+            if (cqe->flags & IORING_CQE_F_BUFFER)
+            {
+                conntrack->writepacket(TUNNEL, uring_tunbufs.mem + bid * uring_tunbufs.bufsize, cqe->res);
+                provideURINGBUF(uring_tunbufs, bid);
+            }
+
+            rearm_read = true;
+        }
+        else
+        {
+            Packet *pkt = (Packet *) (uintptr_t) (cqe->user_data & ~((uint64_t) URING_TUNWRITE));
+
+            if (cqe->res < 0)
+            {
+                RUNTIME_EXCEPTION("error writing in %s: %s",
+                                  (cqe->user_data & URING_TUNWRITE) ? "tunnel" : "network", strerror(-cqe->res));
+            }
+
+            delete pkt;
+        }
+    }
+
+    const uint32_t reaped = tail - *uring_cq.head;
+
+    __sync_synchronize();
+    *uring_cq.head = head;
+    *uring_netbufs.tail = uring_netbufs.tail_local;
+    *uring_tunbufs.tail = uring_tunbufs.tail_local;
+
+    if (rearm_recv)
+        armURINGRECV();
+
+    if (rearm_read)
+        armURINGREAD();
+
+    return reaped;
+}
+
+/*
+ * turns every packet of the SEND queue in a write sqe; the packet is
+ * owned by the ring until its completion. the sqes are submitted in
+ * queue order, but a send finding a full socket buffer is retried by the
+ * kernel and could be overtaken by the following ones.
+ */
+void NetIO::flushURING(void)
+{
+    struct io_uring_sqe *sqe;
+    Packet *pkt;
+
+    while ((pkt = conntrack->readpacket(TUNNEL)) != NULL)
+    {
+        sqe = getURINGSQE();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = netfd;
+        sqe->addr = (uintptr_t) &(pkt->pbuf[0]);
+        sqe->len = pkt->pbuf.size();
+        sqe->addr2 = (uintptr_t) &send_ll;
+        sqe->addr_len = sizeof (send_ll);
+        sqe->user_data = (uintptr_t) pkt;
+    }
+
+    while ((pkt = conntrack->readpacket(NETWORK)) != NULL)
+    {
+        sqe = getURINGSQE();
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = tunfd;
+        sqe->off = ~(uint64_t) 0;
+        sqe->addr = (uintptr_t) &(pkt->pbuf[0]);
+        sqe->len = pkt->pbuf.size();
+        sqe->user_data = (uintptr_t) pkt | URING_TUNWRITE;
+    }
+}
+
+/*
+ * networkIO variant used with --io-uring.
+ *
+ * the first io_uring_enter() of the call submits the SEND queue and
+ * sleeps until a completion arrives, NETIOBURSTSIZE ms at most; after
+ * that the completions are drained without sleeping, up to
+ * NETIOBURSTSIZE rounds, and the control goes back to the conntrack.
+ */
+void NetIO::networkIOUring(void)
+{
+    uint32_t max_cycle = NETIOBURSTSIZE;
+    struct __kernel_timespec timeout;
+
+    if (uring_fd == -1)
+        setupURING();
+
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = NETIOBURSTSIZE * 1000000;
+
+    flushURING();
+    enterURING(1, &timeout);
+
+    while (reapURING() && --max_cycle)
+    {
+        flushURING();
+        enterURING(0, NULL);
+    }
+
+    conntrack->analyzePacketQueue();
+}
+
+/*
+ * networkIO variant used with --net-mmap, --net-batch and --net-xdp.
+ *
+ * the network side never waits for POLLOUT: outgoing packets are
+ * all submitted once per cycle (through the tx ring or a sendmmsg),
+ * while POLLIN on netfd means that a burst is ready to be drained
+ * (at least one rx block retired, or some frames in the socket queue).
+ * the tunnel side keeps the same logic of networkIO(): its packets go
+ * through tun_out, written before polling, and the poll waits at most
+ * 1ms, so a slow tun consumer never stops the network reads.
+ */
+void NetIO::networkIOBatch(void)
+{
+    uint32_t max_cycle = NETIOBURSTSIZE;
+
+    vector<unsigned char> pktbuf(userconf->runcfg.tun_iface_mtu);
+
+    ssize_t ret;
+
+    fillOutRing(tun_out, NETWORK);
+
+    while (max_cycle--)
+    {
+        if (userconf->runcfg.net_mmap)
+            flushNETMMAP();
+        else if (userconf->runcfg.net_xdp)
+            flushNETXDP();
+        else
+            flushNETBATCH();
+
+        fds[0].events = flushOutRing(tun_out) ? POLLIN : POLLIN | POLLOUT;
+        fds[1].events = POLLIN;
+
+        timespec timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_nsec = 1000000;
+        nfds = ppoll(fds, 2, &timeout, NULL);
+
+        if (!nfds)
+            continue;
+
+        if (nfds == -1)
+            RUNTIME_EXCEPTION("strange and dangerous error in ppoll: %s", strerror(errno));
+
+        if (fds[0].revents & POLLIN) /* it's possibile to read from tunfd */
+        {
+            ret = read(tunfd, &(pktbuf[0]), userconf->runcfg.tun_iface_mtu);
+
+            if (ret != -1)
+                conntrack->writepacket(TUNNEL, &(pktbuf[0]), ret);
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                RUNTIME_EXCEPTION("error reading from tunnel: %s", strerror(errno));
+        }
+
+        if (fds[1].revents & POLLIN) /* a burst is ready on the network side */
+        {
+            if (userconf->runcfg.net_mmap)
+                recvNETMMAP();
+            else if (userconf->runcfg.net_xdp)
+                recvNETXDP();
+            else
+                recvNETBATCH();
+        }
+    }
+
+    if (userconf->runcfg.net_mmap)
+        flushNETMMAP();
+    else if (userconf->runcfg.net_xdp)
+        flushNETXDP();
+    else
+        flushNETBATCH();
+
+    flushOutRing(tun_out);
+
+    conntrack->analyzePacketQueue();
+}
@@ -24,35 +24,247 @@
 #define SJ_NETIO_H
 
 #include "Utils.h"
+#include "IOBackend.h"
 #include "TCPTrack.h"
 
 #include <poll.h>
-#include <netpacket/packet.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/if_xdp.h>
+#include <linux/io_uring.h>
 
-class NetIO
+class NetIO : public IOBackend
 {
 private:
 
-    TCPTrack *conntrack;
-
     /* tunfd/netfd: file descriptor for I/O purpose */
     int tunfd;
     int netfd;
 
+    /*
+     * with --tun-queues every queue has its own tun fd and its own
+     * packet socket (member of a PACKET_FANOUT_HASH group); a worker
+     * keeps only the pair selected by selectQueue().
+     */
+    vector<int> tun_queue_fds;
+    vector<int> net_queue_fds;
+
     /*
      * these data are required for handle
      * tunnel/ethernet man in the middle
      */
     struct sockaddr_ll send_ll;
 
+    /* ethernet header of the frames we build ourselves: gateway <- our nic */
+    unsigned char net_ethhdr[ETH_HLEN];
+
     /* poll variables, two file descriptors */
     struct pollfd fds[2];
     int nfds;
 
     int size;
 
+    /*
+     * PACKET_MMAP support (--net-mmap): netfd gets a TPACKET_V3 rx ring,
+     * while a second socket (netfd_tx) owns a TPACKET_V2 tx ring bypassing
+     * the qdisc layer. both rings are mapped in our memory, so a whole
+     * burst is received or submitted with a single wakeup.
+     * with --tun-vnet-hdr and --net-csum-offload netfd_tx is instead a
+     * SOCK_RAW socket sending the packets with their virtio-net header.
+     */
+    int netfd_tx;
+
+    unsigned char *rx_ring;
+    uint32_t rx_block_size;
+    uint32_t rx_block_nr;
+    uint32_t rx_block_cur;
+
+    unsigned char *tx_ring;
+    uint32_t tx_frame_size;
+    uint32_t tx_frame_nr;
+    uint32_t tx_frame_cur;
+
+    /*
+     * recvmmsg/sendmmsg support (--net-batch): preallocated frame
+     * buffers and message vectors, net_batch_size entries each.
+     */
+    vector<unsigned char> batch_buf;
+    vector<struct mmsghdr> batch_rx;
+    vector<struct iovec> batch_rx_iov;
+    vector<struct mmsghdr> batch_tx;
+    vector<struct iovec> batch_tx_iov;
+    vector<Packet *> batch_tx_pkt;
+
+    /*
+     * AF_XDP support (--net-xdp): netfd is an XSK socket bound to a nic
+     * rx queue, where an XDP program redirects the frames coming from the
+     * gateway. frames live in the UMEM area: the first half is lent to the
+     * kernel through the fill ring, the second half is used for tx and
+     * comes back through the completion ring.
+     */
+    struct xdp_ring
+    {
+        uint32_t *producer;
+        uint32_t *consumer;
+        uint32_t *flags;
+        void *descs;
+        uint32_t mask;
+        void *map;
+        size_t maplen;
+    };
+
+    int xdp_map_fd;
+    int xdp_prog_fd;
+    int xdp_link_fd;
+
+    unsigned char *umem;
+    struct xdp_ring xdp_fill;
+    struct xdp_ring xdp_comp;
+    struct xdp_ring xdp_rx;
+    struct xdp_ring xdp_tx;
+    vector<uint64_t> xdp_tx_free;
+    Packet *xdp_tx_pending;
+
+    /*
+     * TUN virtio-net header support (--tun-vnet-hdr): a tun read may return
+     * a whole TSO super-packet, so it needs a buffer of the maximum ip size.
+     */
+    vector<unsigned char> vnet_buf;
+
+    /*
+     * poll() datapath: tunfd and netfd are non-blocking, and the SEND queue
+     * is moved in an output ring for every direction, written as soon as the
+     * fd accepts it. a slow fd fills only its own ring, whose excess is
+     * dropped, without stopping the reads of the other direction. the frames
+     * sniffjoke doesn't handle skip the queue: when their ring is empty they
+     * are written to the other fd from the receive buffer.
+     */
+    struct out_ring
+    {
+        vector<Packet *> slot;
+        uint32_t head;
+        uint32_t count;
+        uint32_t drops;
+    };
+
+    struct out_ring tun_out;
+    struct out_ring net_out;
+
+    /*
+     * io_uring support (--io-uring): a multishot recv on netfd and a read
+     * on tunfd stay always posted, picking their buffers from two provided
+     * buffer rings; every packet of the SEND queue becomes a write sqe, and
+     * a single io_uring_enter() submits them and waits for completions.
+     * the ring is created by the process serving the queue, at its first
+     * networkIO().
+     */
+    struct uring_sqring
+    {
+        uint32_t *head;
+        uint32_t *tail;
+        uint32_t *array;
+        uint32_t mask;
+        uint32_t entries;
+        uint32_t tail_local;
+        struct io_uring_sqe *sqes;
+    };
+
+    struct uring_cqring
+    {
+        uint32_t *head;
+        uint32_t *tail;
+        uint32_t mask;
+        struct io_uring_cqe *cqes;
+    };
+
+    struct uring_bufgroup
+    {
+        struct io_uring_buf *ring;
+        uint16_t *tail;
+        uint16_t tail_local;
+        uint32_t bufsize;
+        unsigned char *mem;
+    };
+
+    int uring_fd;
+    void *uring_map;
+    size_t uring_maplen;
+    struct uring_sqring uring_sq;
+    struct uring_cqring uring_cq;
+    struct uring_bufgroup uring_netbufs;
+    struct uring_bufgroup uring_tunbufs;
+
+    /*
+     * --selective-route: the default gateway is left in place, and only the
+     * traffic selected by these policy routing rules reaches the tun,
+     * through the default route of SELECTIVE_ROUTE_TABLE.
+     * --net-selective-in: the iptables rules dropping from the kernel path
+     * only the incoming classes intercepted by sniffjoke.
+     * the port rules begin at route_port_rules and drop_port_rules, and are
+     * rebuilt by refreshRules().
+     */
+    vector<string> route_rules;
+    size_t route_port_rules;
+    vector<string> drop_rules;
+    size_t drop_port_rules;
+
+    /*
+     * otherwise, the rule dropping the gateway traffic and the command
+     * restoring the default gateway: kept as installed, the destructor
+     * can't rely on userconf, that can be already destroyed at the exit.
+     */
+    string gw_drop_rule;
+    string gw_restore_cmd;
+
     void setupTUN();
     void setupNET();
+    void setupNETFANOUT();
+    void setupNETFILTER();
+    void setupNETMMAP();
+    void setupNETBATCH();
+    void setupETHHDR();
+    void setupNETVNET();
+    void setupNONBLOCK();
+    void setupNETXDP();
+    void setupXDPRING(struct xdp_ring &, off_t, const struct xdp_ring_offset &, size_t);
+    void setupXDPPROG();
+    void setupURING();
+    void setupURINGBUFS(struct uring_bufgroup &, uint16_t, uint32_t);
+    void setupROUTE();
+    void setupROUTEPORTS();
+    void setupINTERCEPT();
+    void setupINTERCEPTPORTS();
+    string gatewayDropRule(void);
+    void hackablePorts(vector<pair<uint16_t, uint16_t> > &);
+    void addSysRule(vector<string> &, const char *, const char *);
+    void delSysRules(vector<string> &, const char *, size_t);
+
+    void fillOutRing(struct out_ring &, source_t);
+    bool flushOutRing(struct out_ring &);
+    ssize_t writeTUN(Packet &);
+    ssize_t sendNET(Packet &);
+    void receiveFrame(source_t, const unsigned char *, size_t, const struct vnet_hdr *);
+    bool forwardTUN(const unsigned char *, size_t);
+    bool forwardNET(const unsigned char *, size_t, const struct vnet_hdr *);
+    void recvTUNVNET(void);
+    ssize_t writeTUNVNET(Packet &);
+    ssize_t sendNETVNET(Packet &);
+    void recvNETMMAP(void);
+    void flushNETMMAP(void);
+    void recvNETBATCH(void);
+    void flushNETBATCH(void);
+    void recvNETXDP(void);
+    void flushNETXDP(void);
+    struct io_uring_sqe *getURINGSQE(void);
+    void provideURINGBUF(struct uring_bufgroup &, uint16_t);
+    void armURINGRECV(void);
+    void armURINGREAD(void);
+    void enterURING(uint32_t, struct __kernel_timespec *);
+    uint32_t reapURING(void);
+    void flushURING(void);
+    void networkIOUring(void);
+    void networkIOBatch(void);
 
 public:
 
@@ -63,7 +275,9 @@ public:
 
     NetIO(void);
     ~NetIO(void);
-    void prepareConntrack(TCPTrack *);
+    void selectQueue(uint16_t);
+    void refreshRules(void);
+    void refreshFilter(void);
     void networkIO(void);
 };
 
@@ -28,66 +28,185 @@
 #endif
 
 #include "Packet.h"
+#include "Checksum.h"
 #include "HDRoptions.h"
-#include "UserConf.h"
 
-extern auto_ptr<UserConf> userconf;
+#include <stddef.h>
 
 uint32_t Packet::SjPacketIdCounter;
+uint32_t Packet::netMTU;
+uint32_t Packet::rejected[REJECT_REASONS];
 
-Packet::Packet(const unsigned char* buff, uint16_t size) :
+/*
+ * the hot line promised in Packet.h: offsetof is only conditionally
+ * supported on a class like Packet, but g++ computes it on any class
+ * without virtual bases.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+struct PacketLayout
+{
+    COMPILE_ASSERT(offsetof(Packet, prev) == 0, packet_hotline_start);
+    COMPILE_ASSERT(offsetof(Packet, fragment) < CACHELINE_SIZE, packet_hotline_end);
+    COMPILE_ASSERT(offsetof(Packet, SjPacketId) <= CACHELINE_SIZE, packet_hotline_nohole);
+    COMPILE_ASSERT(sizeof (Packet) <= 2 * CACHELINE_SIZE, packet_size);
+};
+#pragma GCC diagnostic pop
+
+Packet::Packet(const unsigned char* buff, uint16_t size, const struct vnet_hdr *vhdr) :
 prev(NULL),
 next(NULL),
 queue(QUEUEUNASSIGNED),
-SjPacketId(++SjPacketIdCounter),
 source(SOURCEUNASSIGNED),
 proto(PROTOUNASSIGNED),
-position(POSITIONUNASSIGNED),
 wtf(JUDGEUNASSIGNED),
 choosableScramble(0),
-chainflag(HACKUNASSIGNED),
 fragment(false),
+SjPacketId(++SjPacketIdCounter),
+position(POSITIONUNASSIGNED),
+chainflag(HACKUNASSIGNED),
 fragFakeMTU(0),
-pbuf(size)
+pbuf(size),
+sumdirty(SUM_IPHDR | SUM_L4DATA),
+l4sumrest(0)
 {
     memcpy(&(pbuf[0]), buff, size);
     updatePacketMetadata(0, 0);
+
+    if (vhdr == NULL)
+    {
+        memset(&vnethdr, 0x00, sizeof (vnethdr));
+        return;
+    }
+
+    vnethdr = *vhdr;
+
+    /* TSO4 is the only segmentation offload enabled on the tun */
+    if (isGSO() && (vnethdr.gso_type != VNET_HDR_GSO_TCPV4 || proto != TCP || !vnethdr.gso_size))
+        RUNTIME_EXCEPTION("unexpected GSO packet (gso_type %u gso_size %u)", vnethdr.gso_type, vnethdr.gso_size);
 }
 
-Packet::Packet(const Packet& pkt) :
+/* the bytes are built in place by the caller, the packet takes them with an O(1) swap */
+Packet::Packet(PacketBuffer &buf) :
 prev(NULL),
 next(NULL),
 queue(QUEUEUNASSIGNED),
-SjPacketId(++SjPacketIdCounter),
 source(SOURCEUNASSIGNED),
 proto(PROTOUNASSIGNED),
-position(POSITIONUNASSIGNED),
 wtf(JUDGEUNASSIGNED),
 choosableScramble(0),
-chainflag(pkt.chainflag),
 fragment(false),
+SjPacketId(++SjPacketIdCounter),
+position(POSITIONUNASSIGNED),
+chainflag(HACKUNASSIGNED),
 fragFakeMTU(0),
-pbuf(pkt.pbuf)
+pbuf(0),
+sumdirty(SUM_IPHDR | SUM_L4DATA),
+l4sumrest(0)
 {
+    memset(&vnethdr, 0x00, sizeof (vnethdr));
+
+    pbuf.swap(buf);
     updatePacketMetadata(0, 0);
-    this->SELFLOG("newly generated packet from: sjI#%d", pkt.SjPacketId);
 }
 
-Packet::Packet(const Packet& pkt, uint16_t ipdataoff, uint16_t fragdatalen, uint16_t fakeMTU) :
+Packet::Packet(const Packet& pkt, clone_t mode) :
 prev(NULL),
 next(NULL),
 queue(QUEUEUNASSIGNED),
-SjPacketId(++SjPacketIdCounter),
 source(SOURCEUNASSIGNED),
 proto(PROTOUNASSIGNED),
+wtf(JUDGEUNASSIGNED),
+choosableScramble(0),
+fragment(false),
+SjPacketId(++SjPacketIdCounter),
 position(POSITIONUNASSIGNED),
+chainflag(pkt.chainflag),
+fragFakeMTU(0),
+pbuf(pkt.pbuf, (mode == CLONE_COW) ? pkt.iphdrlen + pkt.tcphdrlen : pkt.pbuf.size()),
+sumdirty(SUM_IPHDR | SUM_L4DATA),
+l4sumrest(0)
+{
+    memset(&vnethdr, 0x00, sizeof (vnethdr));
+
+    /* the headers are the ones of the original, already checked */
+    if (pkt.fragment)
+    {
+        updatePacketMetadata(0, 0);
+    }
+    else
+    {
+        proto = pkt.proto;
+        iphdrlen = pkt.iphdrlen;
+        tcphdrlen = pkt.tcphdrlen; /* udphdrlen, icmphdrlen */
+        rebaseMetadata();
+    }
+
+    this->SELFLOG("newly generated packet from: sjI#%d%s", pkt.SjPacketId,
+                  (mode == CLONE_COW) ? " (copy-on-write)" : "");
+}
+
+Packet::Packet(const Packet& pkt, uint16_t payloadoff, uint16_t payloadlen) :
+prev(NULL),
+next(NULL),
+queue(QUEUEUNASSIGNED),
+source(SOURCEUNASSIGNED),
+proto(pkt.proto),
 wtf(JUDGEUNASSIGNED),
 choosableScramble(0),
+fragment(false),
+SjPacketId(++SjPacketIdCounter),
+position(POSITIONUNASSIGNED),
 chainflag(pkt.chainflag),
+fragFakeMTU(0),
+pbuf(pkt.iphdrlen + pkt.tcphdrlen + payloadlen),
+sumdirty(SUM_IPHDR | SUM_L4HDR),
+l4sumrest(0)
+{
+    if (pkt.proto != TCP || pkt.fragment == true || payloadoff + payloadlen > pkt.tcppayloadlen)
+    {
+        RUNTIME_EXCEPTION("creation of a segment (payload offset %u len %u) from a packet with a tcp payload of %u",
+                          payloadoff, payloadlen, pkt.tcppayloadlen);
+    }
+
+    memset(&vnethdr, 0x00, sizeof (vnethdr));
+
+    const uint16_t hdrlen = pkt.iphdrlen + pkt.tcphdrlen;
+
+    /* the headers are copied, the payload slice is summed while copied */
+    memcpy(&(pbuf[0]), &(pkt.pbuf[0]), hdrlen);
+    if (payloadlen)
+        l4sumrest = Checksum::copySum(&(pbuf[hdrlen]), &(pkt.tcppayload[payloadoff]), payloadlen);
+
+    iphdrlen = pkt.iphdrlen;
+    tcphdrlen = pkt.tcphdrlen;
+    rebaseMetadata();
+
+    ip->tot_len = htons(pbuf.size());
+
+    this->SELFLOG("newly generated segment (payload offset %u len %u) from: sjI#%d",
+                  payloadoff, payloadlen, pkt.SjPacketId);
+}
+
+Packet::Packet(const Packet& pkt, uint16_t ipdataoff, uint16_t fragdatalen, uint16_t fakeMTU) :
+prev(NULL),
+next(NULL),
+queue(QUEUEUNASSIGNED),
+source(SOURCEUNASSIGNED),
+proto(PROTOUNASSIGNED),
+wtf(JUDGEUNASSIGNED),
+choosableScramble(0),
 fragment(true),
+SjPacketId(++SjPacketIdCounter),
+position(POSITIONUNASSIGNED),
+chainflag(pkt.chainflag),
 fragFakeMTU(fakeMTU),
-pbuf(fragdatalen + sizeof(struct iphdr))
+pbuf(fragdatalen + sizeof(struct iphdr)),
+sumdirty(SUM_IPHDR | SUM_L4DATA),
+l4sumrest(0)
 {
+    memset(&vnethdr, 0x00, sizeof (vnethdr));
+
     /* copy of the IP header */
     memcpy(&(pbuf[0]), &(pkt.pbuf[0]), sizeof(struct iphdr));
 
@@ -110,13 +229,37 @@ pbuf(fragdatalen + sizeof(struct iphdr))
                 ipdataoff, fragdatalen, fakeMTU, pkt.SjPacketId);
 }
 
+void *Packet::operator new(size_t size)
+{
+    if (size != sizeof (Packet))
+        return ::operator new(size);
+
+    return PacketPool::get().allocObject();
+}
+
+void Packet::operator delete(void *pkt, size_t size)
+{
+    if (pkt == NULL)
+        return;
+
+    if (size != sizeof (Packet))
+        ::operator delete(pkt);
+    else
+        PacketPool::get().releaseObject(pkt);
+}
+
+bool Packet::isGSO(void) const
+{
+    return vnethdr.gso_type != VNET_HDR_GSO_NONE;
+}
+
 uint32_t Packet::maxMTU(void)
 {
     /* when a fragment is created, also a fake MTU is passed as value */
     if(fragment)
         return fragFakeMTU;
     else
-        return userconf->runcfg.net_iface_mtu;
+        return netMTU;
 }
 
 uint32_t Packet::freespace(void)
@@ -124,6 +267,66 @@ uint32_t Packet::freespace(void)
     return maxMTU() - pbuf.size();
 }
 
+/*
+ * the checks of updatePacketMetadata() and of the constructor on a received
+ * frame, made on its bytes; proto is set as updatePacketMetadata() would.
+ */
+reject_t Packet::validate(const unsigned char *buff, uint32_t size, const struct vnet_hdr *vhdr, uint8_t &proto)
+{
+    if (size < sizeof (struct iphdr))
+        return REJ_IPHDR;
+
+    const struct iphdr * const hdr = (const struct iphdr *) buff;
+    const uint32_t hdrlen = hdr->ihl * 4;
+
+    if (size < hdrlen)
+        return REJ_IPHDR;
+
+    switch (hdr->protocol)
+    {
+    case IPPROTO_TCP:
+        {
+            if (size < hdrlen + sizeof (struct tcphdr))
+                return REJ_TCPHDR;
+
+            const uint32_t l4hdrlen = ((const struct tcphdr *) &buff[hdrlen])->doff * 4;
+
+            if (size < hdrlen + l4hdrlen)
+                return REJ_TCPHDR;
+
+            if (!(l4hdrlen >= sizeof (struct tcphdr) && l4hdrlen <= sizeof (struct tcphdr) + MAXTCPOPTIONS))
+                return REJ_TCPHDR;
+
+            proto = TCP;
+        }
+        break;
+    case IPPROTO_UDP:
+        if (size < hdrlen + sizeof (struct udphdr))
+            return REJ_UDPHDR;
+
+        if (size < hdrlen + ntohs(((const struct udphdr *) &buff[hdrlen])->len))
+            return REJ_UDPHDR;
+
+        proto = UDP;
+        break;
+    case IPPROTO_ICMP:
+        if (size < hdrlen + sizeof (struct icmphdr))
+            return REJ_ICMPHDR;
+
+        proto = ICMP;
+        break;
+    default:
+        proto = OTHER_IP;
+    }
+
+    /* TSO4 is the only segmentation offload enabled on the tun */
+    if (vhdr != NULL && vhdr->gso_type != VNET_HDR_GSO_NONE &&
+            (vhdr->gso_type != VNET_HDR_GSO_TCPV4 || proto != TCP || !vhdr->gso_size))
+        return REJ_GSO;
+
+    return NOTREJECTED;
+}
+
 /* the arguments are usually (0, 0): except in fragment creation: in this case,
  * the iphdr is stripped of the options and thus became iphdr, and tot_len is
  * resized by the construct in memcpy, therfore the new value is forced here */
@@ -252,19 +455,33 @@ void Packet::updatePacketMetadata(uint16_t forceHDRsize, uint16_t forceTOTsize)
     }
 }
 
-uint32_t Packet::computeHalfSum(const unsigned char* data, uint16_t len)
+/*
+ * the metadata of a packet already parsed, after an edit made by Packet:
+ * the header lengths are known, only the pointers and the lengths that
+ * follow them are derived again, without reading and checking the headers.
+ */
+void Packet::rebaseMetadata(void)
 {
-    const uint16_t *usdata = (uint16_t *) data;
-    const uint16_t *end = (uint16_t *) data + (len / sizeof (uint16_t));
-    uint32_t sum = 0;
+    ip = (struct iphdr *) &(pbuf[0]);
+    ippayloadlen = pbuf.size() - iphdrlen;
+    ippayload = ippayloadlen ? (unsigned char *) ip + iphdrlen : NULL;
 
-    while (usdata != end)
-        sum += *usdata++;
+    if (proto == OTHER_IP)
+    {
+        tcp = NULL; /* udp, icmp */
+        tcppayload = NULL; /* udppayload, icmppayload */
+        tcppayloadlen = 0; /* udppayloadlen, icmppayloadlen */
+        return;
+    }
 
-    if (len % 2)
-        sum += *(uint8_t *) usdata;
+    tcp = (struct tcphdr *) ippayload; /* udp, icmp */
+    tcppayloadlen = ippayloadlen - tcphdrlen; /* udppayloadlen, icmppayloadlen */
+    tcppayload = tcppayloadlen ? (unsigned char *) tcp + tcphdrlen : NULL; /* udppayload, icmppayload */
+}
 
-    return sum;
+uint32_t Packet::computeHalfSum(const unsigned char* data, uint16_t len)
+{
+    return Checksum::halfSum(data, len);
 }
 
 uint16_t Packet::computeSum(uint32_t sum)
@@ -275,6 +492,16 @@ uint16_t Packet::computeSum(uint32_t sum)
     return ~sum;
 }
 
+/* RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m') */
+void Packet::updateSum(uint16_t &check, uint16_t oldval, uint16_t newval)
+{
+    uint32_t sum = (uint16_t) ~check;
+    sum += (uint16_t) ~oldval;
+    sum += newval;
+
+    check = computeSum(sum);
+}
+
 void Packet::fixIPSum(void)
 {
     ip->check = 0;
@@ -282,25 +509,30 @@ void Packet::fixIPSum(void)
     uint32_t sum = computeHalfSum((const unsigned char *) ip, iphdrlen);
 
     ip->check = computeSum(sum);
+
+    sumdirty &= ~SUM_IPHDR;
 }
 
-void Packet::fixIPTCPSum(void)
+void Packet::fixTCPSum(void)
 {
-    fixIPSum();
-
     tcp->check = 0;
 
     uint32_t sum = computeHalfSum((const unsigned char *) &ip->saddr, 8);
     sum += htons(IPPROTO_TCP + ippayloadlen);
-    sum += computeHalfSum((const unsigned char *) tcp, ippayloadlen);
+
+    /* after an edit of the header alone the payload is not summed again */
+    if (sumdirty & SUM_L4DATA)
+        sum += computeHalfSum((const unsigned char *) tcp, ippayloadlen);
+    else
+        sum += computeHalfSum((const unsigned char *) tcp, tcphdrlen) + l4sumrest;
 
     tcp->check = computeSum(sum);
+
+    sumdirty &= ~(SUM_L4HDR | SUM_L4DATA);
 }
 
-void Packet::fixIPUDPSum(void)
+void Packet::fixUDPSum(void)
 {
-    fixIPSum();
-
     udp->check = 0;
 
     uint32_t sum = computeHalfSum((const unsigned char *) &ip->saddr, 8);
@@ -308,28 +540,93 @@ void Packet::fixIPUDPSum(void)
     sum += computeHalfSum((const unsigned char *) udp, ippayloadlen);
 
     udp->check = computeSum(sum);
+
+    sumdirty &= ~(SUM_L4HDR | SUM_L4DATA);
 }
 
+void Packet::fixIPTCPSum(void)
+{
+    fixIPSum();
+
+    sumdirty |= SUM_L4DATA;
+    fixTCPSum();
+}
+
+void Packet::fixIPUDPSum(void)
+{
+    fixIPSum();
+
+    fixUDPSum();
+}
+
+/* recomputes only the checksums marked dirty */
 void Packet::fixSum(void)
 {
-    if (fragment == false)
+    if (sumdirty & SUM_IPHDR)
+        fixIPSum();
+
+    /* the tcp checksum of a super-packet is completed segment by segment by the offload */
+    if (isGSO())
+        return;
+
+    /* a full checksum replaces the partial one required to the offload */
+    vnethdr.flags &= ~VNET_HDR_F_NEEDS_CSUM;
+
+    if (fragment == false && (sumdirty & (SUM_L4HDR | SUM_L4DATA)))
     {
         switch (proto)
         {
         case TCP:
-            fixIPTCPSum();
+            fixTCPSum();
             break;
         case UDP:
-            fixIPUDPSum();
+            fixUDPSum();
             break;
         default:
-            fixIPSum();
+            break;
         }
     }
-    else
+
+    sumdirty = SUMVALID;
+}
+
+/*
+ * with --net-csum-offload the tcp/udp checksum is completed by the nic (or
+ * by the kernel): here only the pseudo header sum is stored, and the
+ * packet asks for the completion with VNET_HDR_F_NEEDS_CSUM. a checksum
+ * still valid is simply kept.
+ */
+void Packet::offloadSum(void)
+{
+    if (isGSO() || fragment || !(proto & (TCP | UDP)) || !(sumdirty & (SUM_L4HDR | SUM_L4DATA)))
     {
+        fixSum();
+        return;
+    }
+
+    if (sumdirty & SUM_IPHDR)
         fixIPSum();
+
+    uint32_t sum = computeHalfSum((const unsigned char *) &ip->saddr, 8);
+
+    if (proto == TCP)
+    {
+        sum += htons(IPPROTO_TCP + ippayloadlen);
+        tcp->check = ~computeSum(sum);
+        vnethdr.csum_offset = offsetof(struct tcphdr, check);
+    }
+    else
+    {
+        sum += htons(IPPROTO_UDP + ippayloadlen);
+        udp->check = ~computeSum(sum);
+        vnethdr.csum_offset = offsetof(struct udphdr, check);
     }
+
+    vnethdr.flags |= VNET_HDR_F_NEEDS_CSUM;
+    vnethdr.csum_start = iphdrlen;
+
+    /* the checksum stored is not complete */
+    sumdirty |= SUM_L4DATA;
 }
 
 void Packet::corruptSum(void)
@@ -340,18 +637,101 @@ void Packet::corruptSum(void)
         {
         case TCP:
             tcp->check += 0xd34d;
+            sumdirty |= SUM_L4DATA;
             break;
         case UDP:
             udp->check += 0xd34d;
+            sumdirty |= SUM_L4DATA;
             break;
         default:
             ip->check += 0xd34d;
+            sumdirty |= SUM_IPHDR;
         }
     }
     else
     {
         ip->check += 0xd34d;
+        sumdirty |= SUM_IPHDR;
+    }
+}
+
+/*
+ * to be called before the change: when only the tcp header is going to be
+ * changed, the sum of the rest of the segment is extracted from the valid
+ * checksum, as ~HC = pseudo header + header + payload.
+ */
+void Packet::markSumDirty(uint8_t what)
+{
+    if ((what & SUM_L4HDR) && !(sumdirty & (SUM_L4HDR | SUM_L4DATA)))
+    {
+        if (fragment == false && proto == TCP)
+        {
+            uint32_t sum = computeHalfSum((const unsigned char *) &ip->saddr, 8);
+            sum += htons(IPPROTO_TCP + ippayloadlen);
+            sum += computeHalfSum((const unsigned char *) tcp, tcphdrlen);
+
+            /* the checksum is part of the header sum: it is added back */
+            uint32_t rest = (uint16_t) ~tcp->check;
+            rest += (uint16_t) computeSum(sum);
+            rest += tcp->check;
+
+            l4sumrest = ~computeSum(rest);
+        }
+        else
+        {
+            what |= SUM_L4DATA;
+        }
+    }
+
+    sumdirty |= what;
+}
+
+void Packet::setTTL(uint8_t ttl)
+{
+    const uint16_t oldval = htons((ip->ttl << 8) | ip->protocol);
+
+    ip->ttl = ttl;
+
+    if (!(sumdirty & SUM_IPHDR))
+        updateSum(ip->check, oldval, htons((ip->ttl << 8) | ip->protocol));
+}
+
+void Packet::setIPID(uint16_t id)
+{
+    if (!(sumdirty & SUM_IPHDR))
+        updateSum(ip->check, ip->id, id);
+
+    ip->id = id;
+}
+
+void Packet::setSeq(uint32_t seq)
+{
+    if (!(sumdirty & (SUM_L4HDR | SUM_L4DATA)))
+    {
+        updateSum(tcp->check, tcp->seq >> 16, seq >> 16);
+        updateSum(tcp->check, tcp->seq & 0xFFFF, seq & 0xFFFF);
+    }
+
+    tcp->seq = seq;
+}
+
+void Packet::setAckSeq(uint32_t ack_seq)
+{
+    if (!(sumdirty & (SUM_L4HDR | SUM_L4DATA)))
+    {
+        updateSum(tcp->check, tcp->ack_seq >> 16, ack_seq >> 16);
+        updateSum(tcp->check, tcp->ack_seq & 0xFFFF, ack_seq & 0xFFFF);
     }
+
+    tcp->ack_seq = ack_seq;
+}
+
+void Packet::setWindow(uint16_t window)
+{
+    if (!(sumdirty & (SUM_L4HDR | SUM_L4DATA)))
+        updateSum(tcp->check, tcp->window, window);
+
+    tcp->window = window;
 }
 
 bool Packet::selfIntegrityCheck(const char *pluginName)
@@ -394,11 +774,14 @@ errorinfo:
 
 void Packet::randomizeID(void)
 {
-    ip->id = htons(ntohs(ip->id) - 10 + (random() % 20));
+    setIPID(htons(ntohs(ip->id) - 10 + (random() % 20)));
 }
 
+/* the resize functions mark the checksums dirty also at the same size: the caller rewrites the bytes */
 void Packet::iphdrResize(uint8_t size)
 {
+    markSumDirty(SUM_IPHDR);
+
     if (size == iphdrlen)
         return;
 
@@ -412,24 +795,23 @@ void Packet::iphdrResize(uint8_t size)
      *   pktlen - iphdrlen + size : must be <= maxMTU().
      */
 
-    /* its important to update values into hdr before vector insert call because it can cause relocation */
+    /* its important to update values into hdr before the buffer insert call because it can cause relocation */
     ip->ihl = size / 4;
 
-    vector<unsigned char>::iterator it = pbuf.begin();
-
     if (iphdrlen < size)
     {
         ip->tot_len = htons(pktlen + (size - iphdrlen));
-        pbuf.insert(it + iphdrlen, size - iphdrlen, IPOPT_NOOP);
+        pbuf.insert(iphdrlen, size - iphdrlen, IPOPT_NOOP);
     }
     else
     { /* iphdrlen > size */
 
         ip->tot_len = htons(pktlen - (iphdrlen - size));
-        pbuf.erase(it + size, it + iphdrlen);
+        pbuf.erase(size, iphdrlen - size);
     }
 
-    updatePacketMetadata(0, 0);
+    iphdrlen = size;
+    rebaseMetadata();
 }
 
 void Packet::tcphdrResize(uint8_t size)
@@ -437,6 +819,9 @@ void Packet::tcphdrResize(uint8_t size)
     if (fragment == true)
         RUNTIME_EXCEPTION("it's not possible to call this function on a ip fragment");
 
+    /* the tcp length is in the pseudo header: the payload sum is still good */
+    markSumDirty(SUM_IPHDR | SUM_L4HDR);
+
     if (size == tcphdrlen)
         return;
 
@@ -450,28 +835,29 @@ void Packet::tcphdrResize(uint8_t size)
      *   - pktlen - tcphdrlen + size : must be <= maxMTU().
      */
 
-    /* its important to update values into hdr before vector insert call because it can cause relocation */
+    /* its important to update values into hdr before the buffer insert call because it can cause relocation */
     tcp->doff = size / 4;
 
-    vector<unsigned char>::iterator it = pbuf.begin() + iphdrlen;
-
     if (tcphdrlen < size)
     {
         ip->tot_len = htons(pktlen + (size - tcphdrlen));
-        pbuf.insert(it + tcphdrlen, size - tcphdrlen, TCPOPT_NOP);
+        pbuf.insert(iphdrlen + tcphdrlen, size - tcphdrlen, TCPOPT_NOP);
     }
     else
     { /* tcphdrlen > size */
 
         ip->tot_len = htons(pktlen - (tcphdrlen - size));
-        pbuf.erase(it + size, it + tcphdrlen);
+        pbuf.erase(iphdrlen + size, tcphdrlen - size);
     }
 
-    updatePacketMetadata(0, 0);
+    tcphdrlen = size;
+    rebaseMetadata();
 }
 
 void Packet::ippayloadResize(uint16_t size)
 {
+    markSumDirty(SUM_IPHDR | SUM_L4DATA);
+
     if (size == ippayloadlen)
         return;
 
@@ -484,7 +870,7 @@ void Packet::ippayloadResize(uint16_t size)
 
     const uint16_t new_total_len = pktlen - ippayloadlen + size;
 
-    /* its important to update values into hdr before vector insert call because it can cause relocation */
+    /* its important to update values into hdr before the buffer resize call because it can cause relocation */
     ip->tot_len = htons(new_total_len);
 
     pbuf.resize(new_total_len);
@@ -494,6 +880,8 @@ void Packet::ippayloadResize(uint16_t size)
 
 void Packet::tcppayloadResize(uint16_t size)
 {
+    markSumDirty(SUM_IPHDR | SUM_L4DATA);
+
     if (size == tcppayloadlen)
         return;
 
@@ -506,16 +894,18 @@ void Packet::tcppayloadResize(uint16_t size)
 
     const uint16_t new_total_len = pktlen - tcppayloadlen + size;
 
-    /* its important to update values into hdr before vector insert call because it can cause relocation */
+    /* its important to update values into hdr before the buffer resize call because it can cause relocation */
     ip->tot_len = htons(new_total_len);
 
     pbuf.resize(new_total_len);
 
-    updatePacketMetadata(0, 0);
+    rebaseMetadata();
 }
 
 void Packet::udppayloadResize(uint16_t size)
 {
+    markSumDirty(SUM_IPHDR | SUM_L4DATA);
+
     if (size == udppayloadlen)
         return;
 
@@ -528,7 +918,7 @@ void Packet::udppayloadResize(uint16_t size)
 
     const uint16_t new_total_len = pktlen - udppayloadlen + size;
 
-    /* its important to update values into hdr before vector insert call because it can cause relocation */
+    /* its important to update values into hdr before the buffer resize call because it can cause relocation */
     ip->tot_len = htons(new_total_len);
 
     /* in udp we have also to correct the len field */
@@ -536,21 +926,40 @@ void Packet::udppayloadResize(uint16_t size)
 
     pbuf.resize(new_total_len);
 
-    updatePacketMetadata(0, 0);
+    rebaseMetadata();
+}
+
+/*
+ * the payload is replaced, without copying the shared one of a copy-on-write
+ * clone; its sum is taken during the copy, fixSum() will sum only the header.
+ */
+void Packet::tcppayloadSet(const unsigned char *data, uint16_t size)
+{
+    pbuf.overwrite(iphdrlen + tcphdrlen);
+    tcppayloadResize(size);
+
+    l4sumrest = Checksum::copySum(tcppayload, data, size);
+    sumdirty = (sumdirty | SUM_L4HDR) & ~SUM_L4DATA;
 }
 
 void Packet::ippayloadRandomFill(void)
 {
+    markSumDirty(SUM_L4DATA);
+    pbuf.overwrite(iphdrlen);
     memset_random(ippayload, pbuf.size() - iphdrlen);
 }
 
 void Packet::tcppayloadRandomFill(void)
 {
+    markSumDirty(SUM_L4DATA);
+    pbuf.overwrite(iphdrlen + tcphdrlen);
     memset_random(tcppayload, pbuf.size() - (iphdrlen + tcphdrlen));
 }
 
 void Packet::udppayloadRandomFill(void)
 {
+    markSumDirty(SUM_L4DATA);
+    pbuf.overwrite(iphdrlen + udphdrlen);
     memset_random(udppayload, pbuf.size() - (iphdrlen + udphdrlen));
 }
 
@@ -24,6 +24,7 @@
 #define SJ_PACKET_H
 
 #include "Utils.h"
+#include "PacketPool.h"
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -32,6 +33,25 @@
 #include <netinet/udp.h>
 #include <netinet/ip_icmp.h>
 
+/*
+ * the legacy virtio-net header exchanged with the tun and the packet sockets,
+ * the same layout of struct virtio_net_hdr: linux/virtio_net.h can't be
+ * included by C++ code, it has a member named "class".
+ */
+struct vnet_hdr
+{
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+};
+
+#define VNET_HDR_F_NEEDS_CSUM   1
+#define VNET_HDR_GSO_NONE       0
+#define VNET_HDR_GSO_TCPV4      1
+
 /* IT'S FUNDAMENTAL TO HAVE ALL ENUMS VALUES AS POWERS OF TWO TO PERMIT OR MASKS */
 
 /* queue_t is a a reflection variable used by packet to know in what queue it's inserted */
@@ -80,12 +100,38 @@ enum chaining_t
     HACKUNASSIGNED = 0, FINALHACK = 1, REHACKABLE = 2
 };
 
+/* a copy-on-write clone shares the payload of the original until the payload is
+ * resized or filled, or until TCPTrack takes the packet from the plugin */
+enum clone_t
+{
+    CLONE_COPY = 1, CLONE_COW = 2
+};
+
+/* what has been changed in a packet since its checksums were valid */
+enum sumdirty_t
+{
+    SUMVALID = 0, SUM_IPHDR = 1, SUM_L4HDR = 2, SUM_L4DATA = 4
+};
+
+/* why a received frame can't become a Packet: returned by Packet::validate() */
+enum reject_t
+{
+    NOTREJECTED = 0, REJ_IPHDR = 1, REJ_TCPHDR = 2, REJ_UDPHDR = 3, REJ_ICMPHDR = 4, REJ_GSO = 5,
+    REJECT_REASONS = 6
+};
+
 class Packet
 {
 private:
     friend class PacketQueue;
+    friend struct PacketLayout;
     static uint32_t SjPacketIdCounter;
 
+    /*
+     * the hot line: the fields read by the queue traversals and by every
+     * TCPTrack stage fill the first CACHELINE_SIZE bytes of the object, the
+     * PacketPool aligns the objects to it. the layout is checked in Packet.cc
+     */
     Packet *prev;
     Packet *next;
 
@@ -93,7 +139,6 @@ private:
     queue_t queue;
 
 public:
-    uint32_t SjPacketId;
 
     /* variable to keep track of packet creation origins */
     source_t source;
@@ -101,27 +146,10 @@ public:
     /* proto variable, redundant but useful because defined to permit OR masks */
     proto_t proto;
 
-    /* status variable to force relative position of a packet with
-       respect to an other. */
-    position_t position;
-
     /* define  the actual selected scramble for the packet */
     judge_t wtf;
 
-    /* defines the acceptable scrambles accepted by the packet */
-    uint8_t choosableScramble;
-
-    /* status variable for chained hack inherited on Packet(const Packet &).
-       significative only if source == PLUGIN  */
-    chaining_t chainflag;
-
-    bool fragment;
-    uint16_t fragFakeMTU;
-
     struct iphdr *ip;
-    uint8_t iphdrlen; /* [20 - 60] bytes */
-    unsigned char *ippayload;
-    uint16_t ippayloadlen; /* [0 - 65515] bytes */
 
     union
     {
@@ -130,13 +158,6 @@ public:
         struct icmphdr *icmp;
     };
 
-    union
-    {
-        uint8_t tcphdrlen; /* [20 - 60] bytes */
-        uint8_t udphdrlen; /* fixed: 8 bytes*/
-        uint8_t icmphdrlen; /* fixed: 8 bytes*/
-    };
-
     union
     {
         unsigned char *tcppayload;
@@ -151,30 +172,115 @@ public:
         uint16_t icmppayloadlen; /* [0 - 65527] bytes */
     };
 
-    vector<unsigned char> pbuf;
+    uint16_t ippayloadlen; /* [0 - 65515] bytes */
+    uint8_t iphdrlen; /* [20 - 60] bytes */
+
+    union
+    {
+        uint8_t tcphdrlen; /* [20 - 60] bytes */
+        uint8_t udphdrlen; /* fixed: 8 bytes*/
+        uint8_t icmphdrlen; /* fixed: 8 bytes*/
+    };
+
+    /* defines the acceptable scrambles accepted by the packet */
+    uint8_t choosableScramble;
+
+    bool fragment;
+
+    /* the cold line: creation, plugins and checksum bookkeeping */
+
+    uint32_t SjPacketId;
+
+    /* status variable to force relative position of a packet with
+       respect to an other. */
+    position_t position : 8;
+
+    /* status variable for chained hack inherited on Packet(const Packet &).
+       significative only if source == PLUGIN  */
+    chaining_t chainflag : 8;
+
+    uint16_t fragFakeMTU;
+
+    unsigned char *ippayload;
+
+    PacketBuffer pbuf;
+
+    /*
+     * offload state of the packets read from a tun with --tun-vnet-hdr, or
+     * set by offloadSum(): a TSO super-packet has gso_type VNET_HDR_GSO_TCPV4,
+     * and like any packet with VNET_HDR_F_NEEDS_CSUM carries only the pseudo
+     * header sum in its tcp/udp checksum. zeroed on any other packet.
+     */
+    struct vnet_hdr vnethdr;
+
+    /*
+     * the checksum dirty tracker, a mask of sumdirty_t: fixSum() recomputes
+     * only what is marked. every packet is born dirty, except the ones read
+     * from the tunnel with a complete checksum: on them the setters update
+     * the checksums incrementally (RFC 1624) and a tcp header edit keeps in
+     * l4sumrest the sum of the payload, so only the payload changes require
+     * a full sum. the writes through the header pointers are not tracked:
+     * that's why a clone is born dirty, and markSumDirty() exists.
+     */
+    uint8_t sumdirty;
+    uint16_t l4sumrest;
 
     /* pkt creation from readed buffer */
-    Packet(const unsigned char *, uint16_t);
+    Packet(const unsigned char *, uint16_t, const struct vnet_hdr * = NULL);
+    /* pkt creation taking the bytes of a buffer, without copying them; the buffer is left empty */
+    Packet(PacketBuffer &);
     /* pkt creation from exisiting Packet object */
-    Packet(const Packet &);
+    Packet(const Packet &, clone_t = CLONE_COPY);
+    /* pkt segment creation from the headers and a payload slice of an existing tcp packet */
+    Packet(const Packet &, uint16_t, uint16_t);
     /* pkt fragment creation from an existing packet */
     Packet(const Packet &, uint16_t, uint16_t, uint16_t);
 
     ~Packet();
 
+    /*
+     * the received frames are checked before building a Packet, without
+     * exceptions: a flood of junk frames costs only the counters, exposed
+     * by sniffjokectl stat. updatePacketMetadata() still throws, but only
+     * on the packets forged by sniffjoke, where it means a bug.
+     */
+    static uint32_t rejected[REJECT_REASONS];
+    static reject_t validate(const unsigned char *, uint32_t, const struct vnet_hdr *, uint8_t &);
+
+    /* the Packet objects are recycled by the PacketPool of the process */
+    static void *operator new(size_t);
+    static void operator delete(void *, size_t);
+
+    /* the mtu of the network interface, set by the I/O backend when it reads it */
+    static uint32_t netMTU;
+
+    bool isGSO(void) const;
     uint32_t maxMTU(void);
     uint32_t freespace(void);
 
     void updatePacketMetadata(uint16_t, uint16_t);
+    void rebaseMetadata(void);
 
     /* IP/TCP checksum functions */
     uint32_t computeHalfSum(const unsigned char*, uint16_t);
     uint16_t computeSum(uint32_t);
+    void updateSum(uint16_t &, uint16_t, uint16_t);
     void fixIPSum(void);
+    void fixTCPSum(void);
+    void fixUDPSum(void);
     void fixIPTCPSum(void);
     void fixIPUDPSum(void);
     void fixSum(void);
+    void offloadSum(void);
     void corruptSum(void);
+    void markSumDirty(uint8_t);
+
+    /* header setters keeping the checksums valid; the values are in network byte order */
+    void setTTL(uint8_t);
+    void setIPID(uint16_t);
+    void setSeq(uint32_t);
+    void setAckSeq(uint32_t);
+    void setWindow(uint16_t);
 
     /* autochecking */
     bool selfIntegrityCheck(const char *);
@@ -186,6 +292,7 @@ public:
     void ippayloadResize(uint16_t);
     void tcppayloadResize(uint16_t);
     void udppayloadResize(uint16_t);
+    void tcppayloadSet(const unsigned char *, uint16_t);
     void ippayloadRandomFill(void);
     void tcppayloadRandomFill(void);
     void udppayloadRandomFill(void);
@@ -202,4 +309,72 @@ public:
     const char *getChainStr(chaining_t) const;
 };
 
+/*
+ * the owner of a Packet created with new, in C++98: a handle can't be
+ * copied, the packet leaves it only explicitly, by transfer() to another
+ * handle or by release() to an owner keeping raw pointers, the PacketQueue.
+ * the packet still held is deleted with the handle, also on an exception.
+ */
+class PacketHandle
+{
+private:
+
+    Packet *pkt;
+
+    PacketHandle(const PacketHandle &);
+    PacketHandle &operator=(const PacketHandle &);
+
+public:
+
+    explicit PacketHandle(Packet *pkt = NULL) :
+    pkt(pkt)
+    {
+    };
+
+    ~PacketHandle(void)
+    {
+        delete pkt;
+    };
+
+    Packet *get(void) const
+    {
+        return pkt;
+    };
+
+    Packet &operator*(void) const
+    {
+        return *pkt;
+    };
+
+    Packet *operator->(void) const
+    {
+        return pkt;
+    };
+
+    /* the packet held, if any, is deleted */
+    void reset(Packet *newpkt = NULL)
+    {
+        if (newpkt != pkt)
+        {
+            delete pkt;
+            pkt = newpkt;
+        }
+    };
+
+    /* the caller becomes the owner */
+    Packet *release(void)
+    {
+        Packet * const ret = pkt;
+        pkt = NULL;
+        return ret;
+    };
+
+    /* the packet moves to the other handle, this one is left empty */
+    void transfer(PacketHandle &to)
+    {
+        if (&to != this)
+            to.reset(release());
+    };
+};
+
 #endif /* SJ_PACKET_H */
@@ -0,0 +1,419 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2008 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PacketPool.h"
+#include "Packet.h"
+
+#include <algorithm>
+#include <sys/mman.h>
+
+bool PacketPool::useHugepages;
+
+PacketPool::PacketPool(void) :
+arena(NULL),
+arena_len(0),
+free_slots(NULL),
+free_objects(NULL),
+slot_size(0),
+slots(0),
+hugepages(false),
+slots_used(0),
+slots_peak(0),
+heap_used(0),
+objects_total(0),
+objects_used(0),
+objects_peak(0),
+clone_copied(0)
+{
+    LOG_DEBUG("");
+
+    setupArena();
+}
+
+/*
+ * the pool is never destroyed: the packets still queued are released by
+ * the destructors running at the exit, in any order.
+ */
+PacketPool &PacketPool::get(void)
+{
+    static PacketPool *pool = NULL;
+
+    if (pool == NULL)
+        pool = new PacketPool();
+
+    return *pool;
+}
+
+void PacketPool::setupArena(void)
+{
+    const uint32_t mtu = Packet::netMTU ? Packet::netMTU : NET_IF_MTU;
+    void *mem = MAP_FAILED;
+
+    slot_size = (mtu + PACKETPOOL_HEADROOM + PACKETPOOL_ALIGN - 1) & ~(PACKETPOOL_ALIGN - 1);
+    arena_len = (size_t) slot_size * PACKETPOOL_SLOTS;
+
+    if (useHugepages)
+    {
+        const size_t huge_len = (arena_len + PACKETPOOL_HUGEPAGE - 1) & ~((size_t) PACKETPOOL_HUGEPAGE - 1);
+
+        mem = mmap(NULL, huge_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED)
+        {
+            arena_len = huge_len;
+            hugepages = true;
+        }
+        else
+        {
+            LOG_ALL("unable to back the packet pool with hugepages: %s: using the normal pages", strerror(errno));
+        }
+    }
+
+    if (mem == MAP_FAILED)
+        mem = mmap(NULL, arena_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED)
+    {
+        LOG_ALL("unable to allocate the packet pool (%u bytes): %s: the packets will use the heap", (uint32_t) arena_len, strerror(errno));
+        arena_len = 0;
+        return;
+    }
+
+    arena = (unsigned char *) mem;
+    slots = arena_len / slot_size;
+    slot_refs.resize(slots, 0);
+
+    /* linked backward, so the first slots are the first used; this touches every page of the arena */
+    for (uint32_t i = slots; i > 0; --i)
+    {
+        unsigned char * const slot = &arena[(size_t) (i - 1) * slot_size];
+        *(void **) slot = free_slots;
+        free_slots = slot;
+    }
+
+    LOG_VERBOSE("packet pool of process %d: %u slots of %u bytes%s", getpid(), slots, slot_size,
+                hugepages ? " in hugepages" : "");
+}
+
+/* room is set to the usable size of the returned buffer */
+unsigned char *PacketPool::allocBuffer(uint32_t size, uint32_t &room)
+{
+    if (size <= slot_size && free_slots != NULL)
+    {
+        unsigned char * const slot = (unsigned char *) free_slots;
+        free_slots = *(void **) slot;
+
+        if (++slots_used > slots_peak)
+            slots_peak = slots_used;
+
+        room = slot_size;
+        return slot;
+    }
+
+    unsigned char * const buf = (unsigned char *) malloc(size ? size : 1);
+    if (buf == NULL)
+        RUNTIME_EXCEPTION("unable to allocate a packet buffer of %u bytes", size);
+
+    ++heap_used;
+    room = size;
+    return buf;
+}
+
+void PacketPool::retainBuffer(unsigned char *buf)
+{
+    if (buf >= arena && buf < arena + arena_len)
+        ++slot_refs[(buf - arena) / slot_size];
+    else
+        ++heap_refs[buf];
+}
+
+void PacketPool::releaseBuffer(unsigned char *buf)
+{
+    if (buf >= arena && buf < arena + arena_len)
+    {
+        uint16_t &refs = slot_refs[(buf - arena) / slot_size];
+        if (refs)
+        {
+            --refs;
+            return;
+        }
+
+        *(void **) buf = free_slots;
+        free_slots = buf;
+        --slots_used;
+    }
+    else
+    {
+        map<unsigned char *, uint32_t>::iterator it = heap_refs.find(buf);
+        if (it != heap_refs.end())
+        {
+            if (!--it->second)
+                heap_refs.erase(it);
+            return;
+        }
+
+        free(buf);
+        --heap_used;
+    }
+}
+
+/* every object starts on a cache line, where Packet keeps its hot fields */
+void PacketPool::growObjects(void)
+{
+    const size_t stride = (sizeof (Packet) + PACKETPOOL_ALIGN - 1) & ~((size_t) PACKETPOOL_ALIGN - 1);
+    void *mem;
+
+    if (posix_memalign(&mem, PACKETPOOL_ALIGN, stride * PACKETPOOL_OBJBLOCK))
+        throw std::bad_alloc();
+
+    unsigned char * const block = (unsigned char *) mem;
+
+    for (uint32_t i = PACKETPOOL_OBJBLOCK; i > 0; --i)
+    {
+        unsigned char * const obj = &block[(i - 1) * stride];
+        *(void **) obj = free_objects;
+        free_objects = obj;
+    }
+
+    objects_total += PACKETPOOL_OBJBLOCK;
+}
+
+void *PacketPool::allocObject(void)
+{
+    if (free_objects == NULL)
+        growObjects();
+
+    void * const obj = free_objects;
+    free_objects = *(void **) obj;
+
+    if (++objects_used > objects_peak)
+        objects_peak = objects_used;
+
+    return obj;
+}
+
+void PacketPool::releaseObject(void *obj)
+{
+    *(void **) obj = free_objects;
+    free_objects = obj;
+    --objects_used;
+}
+
+PacketBuffer::PacketBuffer(uint32_t size) :
+data(NULL),
+len(size),
+room(0),
+shared_mem(NULL),
+shared_pos(0),
+shared_off(0),
+head(0)
+{
+    reserve(len);
+}
+
+PacketBuffer::PacketBuffer(const PacketBuffer &buf) :
+data(NULL),
+len(buf.len),
+room(0),
+shared_mem(NULL),
+shared_pos(0),
+shared_off(0),
+head(0)
+{
+    reserve(len);
+    copyBytes(buf, len);
+}
+
+/* the copy-on-write clone: only the bytes before from are copied */
+PacketBuffer::PacketBuffer(const PacketBuffer &buf, uint32_t from) :
+data(NULL),
+len(buf.len),
+room(0),
+shared_mem(NULL),
+shared_pos(0),
+shared_off(0),
+head(0)
+{
+    reserve(len);
+
+    if (from < len && buf.shared_mem == NULL)
+    {
+        shared_mem = buf.mem();
+        shared_pos = buf.head + from;
+    }
+    else if (from < len && from >= buf.shared_off)
+    {
+        /* a clone of a clone shares the same original */
+        shared_mem = buf.shared_mem;
+        shared_pos = buf.shared_pos + (from - buf.shared_off);
+    }
+    else
+    {
+        copyBytes(buf, len);
+        return;
+    }
+
+    PacketPool::get().retainBuffer(shared_mem);
+    shared_off = from;
+    copyBytes(buf, from);
+}
+
+PacketBuffer::~PacketBuffer(void)
+{
+    if (shared_mem != NULL)
+        PacketPool::get().releaseBuffer(shared_mem);
+
+    PacketPool::get().releaseBuffer(mem());
+}
+
+/* copies the first n bytes of buf, wherever they are */
+void PacketBuffer::copyBytes(const PacketBuffer &buf, uint32_t n)
+{
+    PacketPool::get().clone_copied += n;
+
+    if (buf.shared_mem == NULL || n <= buf.shared_off)
+    {
+        memcpy(data, buf.data, n);
+        return;
+    }
+
+    memcpy(data, buf.data, buf.shared_off);
+    memcpy(&data[buf.shared_off], &buf.shared_mem[buf.shared_pos], n - buf.shared_off);
+}
+
+/* ends the sharing, copying the shared bytes before end */
+void PacketBuffer::copyShared(uint32_t end)
+{
+    if (end > len)
+        end = len;
+
+    if (end > shared_off)
+    {
+        memcpy(&data[shared_off], &shared_mem[shared_pos], end - shared_off);
+        PacketPool::get().clone_copied += end - shared_off;
+    }
+
+    PacketPool::get().releaseBuffer(shared_mem);
+    shared_mem = NULL;
+    shared_pos = 0;
+    shared_off = 0;
+}
+
+/* the bytes from pos on are going to be rewritten: they are not copied */
+void PacketBuffer::overwrite(uint32_t pos)
+{
+    if (shared_mem != NULL)
+        copyShared(pos);
+}
+
+void PacketBuffer::unshare(void)
+{
+    if (shared_mem != NULL)
+        copyShared(len);
+}
+
+/* a new memory gets again all the headroom */
+void PacketBuffer::reserve(uint32_t size)
+{
+    if (data != NULL && size <= room)
+        return;
+
+    uint32_t newroom;
+    unsigned char * const newmem = PacketPool::get().allocBuffer(PACKETPOOL_HEADROOM + size, newroom);
+    unsigned char * const newdata = newmem + PACKETPOOL_HEADROOM;
+
+    if (data != NULL)
+    {
+        memcpy(newdata, data, len);
+        PacketPool::get().releaseBuffer(mem());
+    }
+
+    data = newdata;
+    head = PACKETPOOL_HEADROOM;
+    room = newroom - PACKETPOOL_HEADROOM;
+}
+
+/* as a vector does, the added bytes are zeroed */
+void PacketBuffer::resize(uint32_t size)
+{
+    if (shared_mem != NULL)
+        copyShared(size);
+
+    if (size > len)
+    {
+        reserve(size);
+        memset(&data[len], 0x00, size - len);
+    }
+
+    len = size;
+}
+
+void PacketBuffer::insert(uint32_t pos, uint32_t n, unsigned char value)
+{
+    unshare();
+
+    if (pos <= len - pos && head >= n)
+    {
+        memmove(data - n, data, pos);
+        data -= n;
+        head -= n;
+        room += n;
+    }
+    else
+    {
+        reserve(len + n);
+        memmove(&data[pos + n], &data[pos], len - pos);
+    }
+
+    memset(&data[pos], value, n);
+    len += n;
+}
+
+void PacketBuffer::erase(uint32_t pos, uint32_t n)
+{
+    unshare();
+
+    if (pos <= len - pos - n)
+    {
+        memmove(data + n, data, pos);
+        data += n;
+        head += n;
+        room -= n;
+    }
+    else
+    {
+        memmove(&data[pos], &data[pos + n], len - pos - n);
+    }
+
+    len -= n;
+}
+
+/* the two buffers exchange their memory, also the shared one: no byte is copied */
+void PacketBuffer::swap(PacketBuffer &buf)
+{
+    std::swap(data, buf.data);
+    std::swap(len, buf.len);
+    std::swap(room, buf.room);
+    std::swap(shared_mem, buf.shared_mem);
+    std::swap(shared_pos, buf.shared_pos);
+    std::swap(shared_off, buf.shared_off);
+    std::swap(head, buf.head);
+}
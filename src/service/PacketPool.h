@@ -0,0 +1,155 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2008 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SJ_PACKETPOOL_H
+#define SJ_PACKETPOOL_H
+
+#include "Utils.h"
+
+/*
+ * the packet memory of a process: the service and every worker have their
+ * own pool, created on the first packet. the buffers are slots of a fixed
+ * size (the network MTU plus PACKETPOOL_HEADROOM) carved in a preallocated
+ * arena, optionally backed by hugepages; the Packet objects are recycled
+ * through a free list. the bigger buffers (TSO super-packets, jumbo frames)
+ * and the ones asked when the arena is exhausted fall back to the heap.
+ */
+class PacketPool
+{
+private:
+
+    unsigned char *arena;
+    size_t arena_len;
+
+    /* both free lists are linked through the first bytes of the free memory */
+    void *free_slots;
+    void *free_objects;
+
+    /* the references added by the copy-on-write clones, beside the owner's one */
+    vector<uint16_t> slot_refs;
+    map<unsigned char *, uint32_t> heap_refs;
+
+    PacketPool(void);
+
+    void setupArena(void);
+    void growObjects(void);
+
+public:
+
+    /* the geometry and the occupancy, exposed by sniffjokectl stat */
+    uint32_t slot_size;
+    uint32_t slots;
+    bool hugepages;
+    uint32_t slots_used;
+    uint32_t slots_peak;
+    uint32_t heap_used;
+    uint32_t objects_total;
+    uint32_t objects_used;
+    uint32_t objects_peak;
+
+    /* the bytes copied by the clones, from the original or from the memory they share */
+    uint64_t clone_copied;
+
+    /* --packet-hugepages, set before the first packet creates the pool */
+    static bool useHugepages;
+
+    static PacketPool &get(void);
+
+    unsigned char *allocBuffer(uint32_t, uint32_t &);
+    void retainBuffer(unsigned char *);
+    void releaseBuffer(unsigned char *);
+    void *allocObject(void);
+    void releaseObject(void *);
+};
+
+/*
+ * the bytes of a Packet, with the few vector operations the packet forging
+ * needs: the memory comes from the PacketPool and is moved only when the
+ * packet outgrows its slot. the packet starts PACKETPOOL_HEADROOM bytes
+ * after the start of the memory, so an insert or an erase close to the
+ * head (the ip and tcp options) moves only the bytes before it.
+ *
+ * a copy-on-write buffer copies only the bytes before an offset, the
+ * others stay in the memory of the original, referenced, until they are
+ * needed: by a resize, an insert or an erase, by unshare(), or never when
+ * overwrite() tells they are going to be rewritten. operator[] can't see
+ * the difference, so the shared bytes must not be accessed before: the
+ * clone has to be unshared before the original is changed.
+ */
+class PacketBuffer
+{
+private:
+
+    unsigned char *data;    /* the first byte of the packet, in the memory from the pool */
+    uint32_t len;
+    uint32_t room;          /* the bytes usable from data on */
+
+    /* copy-on-write: the bytes from shared_off on are at shared_pos of shared_mem */
+    unsigned char *shared_mem;
+    uint32_t shared_pos;
+    uint16_t shared_off;
+
+    uint16_t head;          /* the headroom left before data */
+
+    unsigned char *mem(void) const
+    {
+        return data - head;
+    };
+
+    void reserve(uint32_t);
+    void copyBytes(const PacketBuffer &, uint32_t);
+    void copyShared(uint32_t);
+
+    /* a packet buffer is copied only by the copy constructor */
+    PacketBuffer &operator=(const PacketBuffer &);
+
+public:
+
+    PacketBuffer(uint32_t);
+    PacketBuffer(const PacketBuffer &);
+    PacketBuffer(const PacketBuffer &, uint32_t);
+    ~PacketBuffer(void);
+
+    uint32_t size(void) const
+    {
+        return len;
+    };
+
+    unsigned char &operator[](uint32_t i)
+    {
+        return data[i];
+    };
+
+    const unsigned char &operator[](uint32_t i) const
+    {
+        return data[i];
+    };
+
+    void resize(uint32_t);
+    void insert(uint32_t, uint32_t, unsigned char);
+    void erase(uint32_t, uint32_t);
+    void overwrite(uint32_t);
+    void unshare(void);
+    void swap(PacketBuffer &);
+};
+
+#endif /* SJ_PACKETPOOL_H */
@@ -24,25 +24,29 @@
 
 PacketQueue::PacketQueue(void) :
 pkt_count(0),
-cur_queue(FIRST_QUEUE),
+cur_lane(FIRST_QUEUE),
 cur_pkt(NULL),
 next_pkt(NULL)
 {
     LOG_DEBUG("");
 
-    memset(front, 0, sizeof (Packet*)*(QUEUE_NUM));
-    memset(back, 0, sizeof (Packet*)*(QUEUE_NUM));
+    memset(front, 0, sizeof (Packet*)*(LANE_NUM));
+    memset(back, 0, sizeof (Packet*)*(LANE_NUM));
 }
 
 PacketQueue::~PacketQueue(void)
 {
     LOG_DEBUG("");
 
-    for (uint8_t i = FIRST_QUEUE; i <= LAST_QUEUE; ++i)
+    for (uint8_t i = FIRST_QUEUE; i < LANE_NUM; ++i)
     {
-        select((queue_t) i);
-        while (get() && cur_pkt != NULL)
-            delete cur_pkt;
+        Packet *pkt = front[i];
+        while (pkt != NULL)
+        {
+            Packet * const next = pkt->next;
+            delete pkt;
+            pkt = next;
+        }
     }
 }
 
@@ -57,19 +61,21 @@ void PacketQueue::insert(Packet &pkt, queue_t queue)
             pkt.next == NULL;
      */
 
+    const uint8_t l = lane(queue, pkt.source);
+
     ++pkt_count;
     pkt.queue = queue;
-    if (front[queue] == NULL)
+    if (front[l] == NULL)
     {
-        front[queue] = &pkt;
-        back[queue] = &pkt;
+        front[l] = &pkt;
+        back[l] = &pkt;
     }
     else
     {
-        pkt.prev = back[queue];
+        pkt.prev = back[l];
         pkt.next = NULL;
-        back[queue]->next = &pkt;
-        back[queue] = &pkt;
+        back[l]->next = &pkt;
+        back[l] = &pkt;
     }
 }
 
@@ -84,15 +90,24 @@ void PacketQueue::insertBefore(Packet &pkt, Packet &ref)
             pkt.next == NULL;
      */
 
+    const uint8_t l = lane(ref.queue, ref.source);
+
+    /* a packet of the other direction is not ordered with ref: it goes back in its own lane */
+    if (lane(ref.queue, pkt.source) != l)
+    {
+        insert(pkt, ref.queue);
+        return;
+    }
+
     ++pkt_count;
     pkt.queue = ref.queue;
 
-    if (front[ref.queue] == &ref)
+    if (front[l] == &ref)
     {
         pkt.prev = NULL;
         pkt.next = &ref;
         ref.prev = &pkt;
-        front[ref.queue] = &pkt;
+        front[l] = &pkt;
         return;
     }
 
@@ -117,14 +132,22 @@ void PacketQueue::insertAfter(Packet &pkt, Packet &ref)
             pkt.next == NULL;
      */
 
+    const uint8_t l = lane(ref.queue, ref.source);
+
+    if (lane(ref.queue, pkt.source) != l)
+    {
+        insert(pkt, ref.queue);
+        return;
+    }
+
     ++pkt_count;
     pkt.queue = ref.queue;
 
-    if (back[ref.queue] == &ref)
+    if (back[l] == &ref)
     {
         pkt.prev = &ref;
         ref.next = &pkt;
-        back[ref.queue] = &pkt;
+        back[l] = &pkt;
         return;
     }
 
@@ -141,14 +164,14 @@ void PacketQueue::insertAfter(Packet &pkt, Packet &ref)
 void PacketQueue::extract(Packet &pkt)
 {
     --pkt_count;
-    queue_t queue = pkt.queue;
+    const uint8_t l = lane(pkt.queue, pkt.source);
 
-    if (front[queue] == &pkt)
+    if (front[l] == &pkt)
     {
-        if (back[queue] == &pkt)
+        if (back[l] == &pkt)
         {
-            front[queue] = NULL;
-            back[queue] = NULL;
+            front[l] = NULL;
+            back[l] = NULL;
         }
         else
         {
@@ -156,19 +179,19 @@ void PacketQueue::extract(Packet &pkt)
              * in this case we have always a next;
              * so we can dereference it without checking != NULL
              */
-            front[queue] = front[queue]->next;
-            front[queue]->prev = NULL;
+            front[l] = front[l]->next;
+            front[l]->prev = NULL;
         }
         goto remove_reset_pkt;
     }
-    else if (back[queue] == &pkt)
+    else if (back[l] == &pkt)
     {
         /*
          * in this case we have always a prev;
          * so we can dereference it without checking != NULL
          */
-        back[queue] = back[queue]->prev;
-        back[queue]->next = NULL;
+        back[l] = back[l]->prev;
+        back[l]->next = NULL;
         goto remove_reset_pkt;
     }
 
@@ -196,13 +219,20 @@ void PacketQueue::drop(Packet &pkt)
 
 void PacketQueue::select(queue_t queue)
 {
-    cur_queue = queue;
+    cur_lane = queue;
     cur_pkt = NULL;
     next_pkt = front[queue];
 }
 
 Packet* PacketQueue::get(void)
 {
+    /* the selection of SEND walks the lane toward the tunnel after the other one */
+    if (next_pkt == NULL && cur_lane == SEND)
+    {
+        cur_lane = SEND_TUN_LANE;
+        next_pkt = front[SEND_TUN_LANE];
+    }
+
     if (next_pkt != NULL)
     {
         cur_pkt = next_pkt;
@@ -214,13 +244,20 @@ Packet* PacketQueue::get(void)
 
 Packet* PacketQueue::getSource(source_t requestSrc)
 {
-    while (next_pkt != NULL)
+    while (get() != NULL)
     {
-        cur_pkt = next_pkt;
-        next_pkt = next_pkt->next;
-
         if (cur_pkt->source == requestSrc)
             return cur_pkt; /* FOUND */
     }
     return NULL; /* NOT FOUND */
 }
+
+/*
+ * the oldest packet of a SEND lane, without scanning: as for readpacket(),
+ * NETWORK asks for the packets read from the network, any other source
+ * for the packets going to it.
+ */
+Packet* PacketQueue::frontSEND(source_t destsource)
+{
+    return front[(destsource == NETWORK) ? SEND_TUN_LANE : SEND];
+}
@@ -30,16 +30,34 @@
 #define LAST_QUEUE  (SEND)
 #define QUEUE_NUM   (LAST_QUEUE + 1)
 
+/*
+ * SEND is kept in two lanes, one for every direction, each in the order of
+ * insertion: the packets toward the network stay in the SEND list, while
+ * the ones coming from the network, toward the tunnel, use the list after
+ * LAST_QUEUE. the front of a direction is taken without a scan.
+ */
+#define SEND_TUN_LANE (QUEUE_NUM)
+#define LANE_NUM      (QUEUE_NUM + 1)
+
+/*
+ * the queue owns the packets inserted: drop() and the destructor delete
+ * them, while extract() gives the packet back to the caller, its owner.
+ */
 class PacketQueue
 {
 private:
     uint32_t pkt_count;
-    Packet *front[QUEUE_NUM];
-    Packet *back[QUEUE_NUM];
-    queue_t cur_queue;
+    Packet *front[LANE_NUM];
+    Packet *back[LANE_NUM];
+    uint8_t cur_lane;
     Packet *cur_pkt;
     Packet *next_pkt;
 
+    static uint8_t lane(queue_t queue, source_t source)
+    {
+        return (queue == SEND && source == NETWORK) ? SEND_TUN_LANE : queue;
+    };
+
 public:
     PacketQueue(void);
     ~PacketQueue(void);
@@ -51,6 +69,7 @@ public:
     void select(queue_t);
     Packet* get(void);
     Packet* getSource(source_t);
+    Packet* frontSEND(source_t);
 
     uint32_t size(void)
     {
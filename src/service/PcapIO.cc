@@ -0,0 +1,364 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2008 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PcapIO.h"
+#include "UserConf.h"
+
+#include <byteswap.h>
+#include <linux/if_ether.h>
+
+extern auto_ptr<UserConf> userconf;
+
+PcapIO::PcapIO(const char *prefix) :
+tun_out(NULL),
+net_out(NULL),
+drain_deadline(0),
+finished(false),
+written_tun(0),
+written_net(0)
+{
+    LOG_DEBUG("");
+
+    openTrace(tun_in, prefix, PCAP_TUN_IN);
+    openTrace(net_in, prefix, PCAP_NET_IN);
+
+    if (tun_in.file == NULL && net_in.file == NULL)
+        RUNTIME_EXCEPTION("no trace to replay with the prefix %s", prefix);
+
+    tun_out = createTrace(prefix, PCAP_TUN_OUT);
+    net_out = createTrace(prefix, PCAP_NET_OUT);
+
+    /* there are no interfaces to ask: the usual ethernet values are used */
+    userconf->runcfg.net_iface_mtu = ETH_DATA_LEN;
+    userconf->runcfg.tun_iface_mtu = userconf->runcfg.net_iface_mtu - TUN_IF_MTU_DIFF;
+    Packet::netMTU = userconf->runcfg.net_iface_mtu;
+
+    /* the virtual time starts at the first captured packet */
+    timerclear(&vclock);
+    if (tun_in.pending && (!net_in.pending || timercmp(&tun_in.ts, &net_in.ts, <)))
+        setClock(tun_in.ts);
+    else if (net_in.pending)
+        setClock(net_in.ts);
+
+    gettimeofday(&started, NULL);
+}
+
+PcapIO::~PcapIO(void)
+{
+    LOG_DEBUG("");
+
+    FILE * const traces[] = { tun_in.file, net_in.file, tun_out, net_out };
+    for (uint8_t i = 0; i < sizeof (traces) / sizeof (traces[0]); ++i)
+    {
+        if (traces[i] != NULL)
+            fclose(traces[i]);
+    }
+}
+
+/* a missing input trace is replayed as an empty one */
+void PcapIO::openTrace(struct pcap_trace &trace, const char *prefix, const char *suffix)
+{
+    char path[LARGEBUF];
+    struct pcap_file_hdr hdr;
+
+    trace.swapped = false;
+    trace.nanosec = false;
+    trace.linktype = 0;
+    trace.pending = false;
+    trace.offset = 0;
+    trace.len = 0;
+    trace.packets = 0;
+    trace.skipped = 0;
+
+    snprintf(path, sizeof (path), "%s%s", prefix, suffix);
+
+    if ((trace.file = fopen(path, "r")) == NULL)
+    {
+        LOG_ALL("unable to open %s: %s: replaying it as empty", path, strerror(errno));
+        return;
+    }
+
+    if (fread(&hdr, sizeof (hdr), 1, trace.file) != 1)
+        RUNTIME_EXCEPTION("unable to read the header of %s: truncated capture file", path);
+
+    if (hdr.magic == PCAP_MAGIC_USEC || hdr.magic == PCAP_MAGIC_NSEC)
+    {
+        trace.nanosec = (hdr.magic == PCAP_MAGIC_NSEC);
+    }
+    else if (bswap_32(hdr.magic) == PCAP_MAGIC_USEC || bswap_32(hdr.magic) == PCAP_MAGIC_NSEC)
+    {
+        trace.swapped = true;
+        trace.nanosec = (bswap_32(hdr.magic) == PCAP_MAGIC_NSEC);
+        hdr.linktype = bswap_32(hdr.linktype);
+    }
+    else
+    {
+        RUNTIME_EXCEPTION("%s is not a pcap capture file (magic %08x)", path, hdr.magic);
+    }
+
+    /* the low 16 bits only, the others may carry the FCS length */
+    trace.linktype = hdr.linktype & 0xFFFF;
+
+    if (trace.linktype != PCAP_LINKTYPE_ETHERNET && trace.linktype != PCAP_LINKTYPE_RAW && trace.linktype != PCAP_LINKTYPE_IPV4)
+        RUNTIME_EXCEPTION("%s has the unsupported linktype %u: only ethernet and raw ip are accepted", path, trace.linktype);
+
+    trace.buf.resize(ETH_HLEN + IP_MAXPACKET);
+
+    LOG_VERBOSE("replaying %s: linktype %u, %s timestamps", path, trace.linktype, trace.nanosec ? "nanosecond" : "microsecond");
+
+    readTrace(trace);
+}
+
+/*
+ * reads the next IPv4 packet of a trace. non IPv4 frames and the packets
+ * truncated by the snaplen are skipped; the ethernet padding is removed.
+ */
+bool PcapIO::readTrace(struct pcap_trace &trace)
+{
+    struct pcap_record_hdr rec;
+
+    trace.pending = false;
+
+    while (fread(&rec, sizeof (rec), 1, trace.file) == 1)
+    {
+        if (trace.swapped)
+        {
+            rec.ts_sec = bswap_32(rec.ts_sec);
+            rec.ts_frac = bswap_32(rec.ts_frac);
+            rec.caplen = bswap_32(rec.caplen);
+            rec.len = bswap_32(rec.len);
+        }
+
+        if (rec.caplen > trace.buf.size())
+        {
+            if (fseek(trace.file, rec.caplen, SEEK_CUR))
+                break;
+
+            ++trace.skipped;
+            continue;
+        }
+
+        if (rec.caplen && fread(&(trace.buf[0]), rec.caplen, 1, trace.file) != 1)
+            break;
+
+        if (rec.caplen < rec.len)
+        {
+            ++trace.skipped;
+            continue;
+        }
+
+        trace.offset = 0;
+        if (trace.linktype == PCAP_LINKTYPE_ETHERNET)
+        {
+            if (rec.caplen < ETH_HLEN || ((struct ethhdr *) &(trace.buf[0]))->h_proto != htons(ETH_P_IP))
+            {
+                ++trace.skipped;
+                continue;
+            }
+
+            trace.offset = ETH_HLEN;
+        }
+
+        trace.len = rec.caplen - trace.offset;
+
+        if (trace.len < sizeof (struct iphdr) || (trace.buf[trace.offset] >> 4) != 4)
+        {
+            ++trace.skipped;
+            continue;
+        }
+
+        const struct iphdr * const ip = (struct iphdr *) &(trace.buf[trace.offset]);
+        if (ntohs(ip->tot_len) >= sizeof (struct iphdr) && ntohs(ip->tot_len) < trace.len)
+            trace.len = ntohs(ip->tot_len);
+
+        trace.ts.tv_sec = rec.ts_sec;
+        trace.ts.tv_usec = trace.nanosec ? rec.ts_frac / 1000 : rec.ts_frac;
+        trace.pending = true;
+
+        return true;
+    }
+
+    return false;
+}
+
+FILE *PcapIO::createTrace(const char *prefix, const char *suffix)
+{
+    char path[LARGEBUF];
+    struct pcap_file_hdr hdr;
+    FILE *trace;
+
+    snprintf(path, sizeof (path), "%s%s", prefix, suffix);
+
+    if ((trace = fopen(path, "w")) == NULL)
+        RUNTIME_EXCEPTION("unable to create %s: %s", path, strerror(errno));
+
+    hdr.magic = PCAP_MAGIC_USEC;
+    hdr.version_major = 2;
+    hdr.version_minor = 4;
+    hdr.thiszone = 0;
+    hdr.sigfigs = 0;
+    hdr.snaplen = IP_MAXPACKET;
+    hdr.linktype = PCAP_LINKTYPE_RAW;
+
+    if (fwrite(&hdr, sizeof (hdr), 1, trace) != 1)
+    {
+        fclose(trace);
+        RUNTIME_EXCEPTION("unable to write the header of %s: %s", path, strerror(errno));
+    }
+
+    LOG_VERBOSE("the packets sent will be written in %s", path);
+
+    return trace;
+}
+
+void PcapIO::writeTrace(FILE *trace, const Packet &pkt)
+{
+    struct pcap_record_hdr rec;
+
+    rec.ts_sec = vclock.tv_sec;
+    rec.ts_frac = vclock.tv_usec;
+    rec.caplen = rec.len = pkt.pbuf.size();
+
+    if (fwrite(&rec, sizeof (rec), 1, trace) != 1 || fwrite(&(pkt.pbuf[0]), rec.caplen, 1, trace) != 1)
+        RUNTIME_EXCEPTION("unable to write the replayed packets: %s", strerror(errno));
+}
+
+/* the two traces are merged, so a late timestamp must not move the clock back */
+void PcapIO::setClock(const struct timeval &ts)
+{
+    if (timercmp(&ts, &vclock, >))
+        vclock = ts;
+
+    sj_clock = vclock.tv_sec;
+    strftime(sj_clock_str, sizeof (sj_clock_str), "%Y-%m-%d %H:%M:%S", localtime(&sj_clock));
+}
+
+void PcapIO::flushSEND(void)
+{
+    Packet *pkt;
+
+    while ((pkt = conntrack->readpacket(TUNNEL)) != NULL)
+    {
+        writeTrace(net_out, *pkt);
+        ++written_net;
+        delete pkt;
+    }
+
+    while ((pkt = conntrack->readpacket(NETWORK)) != NULL)
+    {
+        writeTrace(tun_out, *pkt);
+        ++written_tun;
+        delete pkt;
+    }
+}
+
+void PcapIO::logResult(void)
+{
+    struct timeval now, elapsed;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, &started, &elapsed);
+
+    const double seconds = elapsed.tv_sec + elapsed.tv_usec / 1000000.0;
+    const uint32_t replayed = tun_in.packets + net_in.packets;
+
+    LOG_ALL("replay completed: %u packets from the tunnel, %u from the network, %u skipped",
+            tun_in.packets, net_in.packets, tun_in.skipped + net_in.skipped);
+    LOG_ALL("written %u packets to the network and %u to the tunnel, %u left in the queues",
+            written_net, written_tun, conntrack->queued());
+    LOG_ALL("%u packets handled in %.3f seconds: %.0f packets/s",
+            replayed, seconds, seconds > 0 ? replayed / seconds : 0.0);
+}
+
+/*
+ * a replay cycle takes the next PCAP_BURST_USEC of capture time, or a burst
+ * of 2 * NETIOBURSTSIZE packets, as the live NetIO would do; the SEND queue
+ * is then written with the timestamp of the last packet read.
+ */
+void PcapIO::networkIO(void)
+{
+    struct timeval burst_end;
+    uint32_t burst = 0;
+
+    if (finished)
+        return;
+
+    while (burst < 2 * NETIOBURSTSIZE)
+    {
+        struct pcap_trace *next = NULL;
+
+        if (tun_in.pending)
+            next = &tun_in;
+
+        if (net_in.pending && (next == NULL || timercmp(&net_in.ts, &next->ts, <)))
+            next = &net_in;
+
+        if (next == NULL)
+            break;
+
+        if (!burst)
+        {
+            const struct timeval burst_len = { 0, PCAP_BURST_USEC };
+            timeradd(&next->ts, &burst_len, &burst_end);
+        }
+        else if (timercmp(&next->ts, &burst_end, >))
+        {
+            break;
+        }
+
+        setClock(next->ts);
+
+        conntrack->writepacket((next == &tun_in) ? TUNNEL : NETWORK, &(next->buf[next->offset]), next->len);
+
+        ++next->packets;
+        ++burst;
+
+        readTrace(*next);
+    }
+
+    if (!burst)
+    {
+        /* the traces are over: the clock keeps going until the queues are empty */
+        if (!drain_deadline)
+            drain_deadline = vclock.tv_sec + PCAP_DRAIN_TIMEOUT;
+
+        if (!conntrack->queued() || vclock.tv_sec >= drain_deadline)
+        {
+            finished = true;
+            logResult();
+            return;
+        }
+
+        struct timeval tick = vclock;
+        ++tick.tv_sec;
+        setClock(tick);
+    }
+
+    conntrack->analyzePacketQueue();
+
+    flushSEND();
+}
+
+bool PcapIO::exhausted(void) const
+{
+    return finished;
+}
@@ -0,0 +1,117 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2008 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SJ_PCAPIO_H
+#define SJ_PCAPIO_H
+
+#include "Utils.h"
+#include "IOBackend.h"
+#include "TCPTrack.h"
+
+#include <sys/time.h>
+
+/* the capture file format, as written by libpcap */
+#define PCAP_MAGIC_USEC         0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET  1
+#define PCAP_LINKTYPE_RAW       101
+#define PCAP_LINKTYPE_IPV4      228
+
+struct pcap_file_hdr
+{
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_record_hdr
+{
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+/*
+ * --replay backend: the packets of the tunnel and of the network are read
+ * from two capture files, merged by timestamp, and the SEND queue is written
+ * in two output captures. sj_clock follows the capture timestamps, so the
+ * traces are replayed as fast as the conntrack can go and without any
+ * privilege.
+ */
+class PcapIO : public IOBackend
+{
+private:
+
+    struct pcap_trace
+    {
+        FILE *file;
+        bool swapped;
+        bool nanosec;
+        uint32_t linktype;
+
+        /* the next packet, read in advance for the merge */
+        bool pending;
+        struct timeval ts;
+        vector<unsigned char> buf;
+        uint32_t offset;
+        uint32_t len;
+
+        uint32_t packets;
+        uint32_t skipped;
+    };
+
+    struct pcap_trace tun_in;
+    struct pcap_trace net_in;
+    FILE *tun_out;
+    FILE *net_out;
+
+    /* the virtual time, never going back */
+    struct timeval vclock;
+    time_t drain_deadline;
+    bool finished;
+
+    uint32_t written_tun;
+    uint32_t written_net;
+    struct timeval started;
+
+    void openTrace(struct pcap_trace &, const char *, const char *);
+    bool readTrace(struct pcap_trace &);
+    FILE *createTrace(const char *, const char *);
+    void writeTrace(FILE *, const Packet &);
+    void setClock(const struct timeval &);
+    void flushSEND(void);
+    void logResult(void);
+
+public:
+
+    PcapIO(const char *);
+    ~PcapIO(void);
+    void networkIO(void);
+    bool exhausted(void) const;
+};
+
+#endif /* SJ_PCAPIO_H */
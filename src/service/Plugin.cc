@@ -120,9 +120,11 @@ void PluginCache::manage(void)
 }
 
 Plugin::Plugin(const char* pluginName, uint16_t pluginFrequency) :
+pktTaken(0),
 pluginName(pluginName),
 pluginFrequency(pluginFrequency),
-removeOrigPkt(false)
+removeOrigPkt(false),
+handleIncoming(false)
 {
 }
 
@@ -175,10 +177,34 @@ void Plugin::mangleIncoming(Packet &pkt)
 {
 }
 
+/* the packet moves from the handle to the plugin: the handle is left empty */
+void Plugin::injectPacket(PacketHandle &pkt)
+{
+    /* the room first: if it can't be made, the handle still owns the packet */
+    pktVector.push_back(NULL);
+    pktVector.back() = pkt.release();
+}
+
+/* the injected packets in their order, moved one by one to the handle of the caller */
+bool Plugin::takePacket(PacketHandle &to)
+{
+    if (pktTaken == pktVector.size())
+        return false;
+
+    to.reset(pktVector[pktTaken++]);
+    return true;
+}
+
 void Plugin::reset(void)
 {
     removeOrigPkt = false;
+
+    /* the packets not taken (an exception stopped TCPTrack) are still owned here */
+    for (; pktTaken < pktVector.size(); ++pktTaken)
+        delete pktVector[pktTaken];
+
     pktVector.clear();
+    pktTaken = 0;
 }
 
 void Plugin::upgradeChainFlag(Packet *pkt)
@@ -84,6 +84,15 @@ public:
 
 class Plugin
 {
+private:
+
+    /*
+     * the packets created by apply() and mangleIncoming(), owned by the
+     * plugin until TCPTrack takes them; reset() deletes the ones left.
+     */
+    vector<Packet *> pktVector;
+    uint32_t pktTaken;
+
 public:
 
     const char * const pluginName; /* plugin name as const string */
@@ -92,13 +101,15 @@ public:
     const uint16_t pluginFrequency; /* plugin frequency, using the value  */
     bool removeOrigPkt; /* boolean to be set true if the plugin
                            needs to remove the original packet */
-
-    vector<Packet *> pktVector; /* std vector of Packet* used for created packets */
+    bool handleIncoming; /* set true in the constructor by the plugins
+                            implementing mangleIncoming */
 
     Plugin(const char *, uint16_t);
 
     judge_t pktRandomDamage(uint8_t, uint8_t);
     void upgradeChainFlag(Packet *);
+    void injectPacket(PacketHandle &);
+    bool takePacket(PacketHandle &);
 
     /* Plugin is an abstract class */
     virtual bool init(uint8_t, char *, struct sjEnviron *) = 0;
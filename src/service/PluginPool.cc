@@ -359,3 +359,15 @@ uint8_t PluginPool::enabledScrambles()
     return globalEnabledScrambles;
 }
 
+/* true if some plugin needs to see the incoming packets of its sessions */
+bool PluginPool::incomingRequired()
+{
+    for (vector<PluginTrack *>::iterator it = pool.begin(); it != pool.end(); ++it)
+    {
+        if ((*it)->selfObj->handleIncoming)
+            return true;
+    }
+
+    return false;
+}
+
@@ -63,6 +63,7 @@ public:
     PluginPool();
     ~PluginPool(void);
     uint8_t enabledScrambles();
+    bool incomingRequired();
     void initializeAll(struct sjEnviron *);
 
     vector<PluginTrack *> pool;
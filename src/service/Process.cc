@@ -24,6 +24,8 @@
 #include "UserConf.h"
 
 #include <fcntl.h>
+#include <sched.h>
+#include <sys/socket.h>
 
 extern auto_ptr<UserConf> userconf;
 
@@ -115,6 +117,56 @@ int Process::detach(void)
     }
 }
 
+/*
+ * forks a datapath worker of the service process; the two are linked by a
+ * SOCK_SEQPACKET socketpair, used to replay administration commands.
+ * returns the worker pid to the caller and 0 to the worker, in both
+ * cases workerfd is the process end of the socketpair.
+ */
+pid_t Process::forkWorker(int &workerfd)
+{
+    pid_t pid_worker;
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1)
+        RUNTIME_EXCEPTION("pid %d unable to open socketpair: %s", getpid(), strerror(errno));
+
+    if ((pid_worker = fork()) == -1)
+        RUNTIME_EXCEPTION("unable to fork a worker (calling pid %d): %s", getpid(), strerror(errno));
+
+    if (pid_worker)
+    {
+        close(sv[1]);
+        workerfd = sv[0];
+    }
+    else
+    {
+        close(sv[0]);
+        workerfd = sv[1];
+
+        LOG_DEBUG("forked worker process, pid %d", getpid());
+    }
+
+    return pid_worker;
+}
+
+void Process::cpuAffinity(uint16_t worker)
+{
+    cpu_set_t cpuset;
+    const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (ncpu < 1)
+        return;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(worker % ncpu, &cpuset);
+
+    if (sched_setaffinity(0, sizeof (cpuset), &cpuset) == -1)
+        LOG_ALL("unable to pin process %d on cpu %u: %s", getpid(), (uint32_t) (worker % ncpu), strerror(errno));
+    else
+        LOG_VERBOSE("process %d pinned on cpu %u", getpid(), (uint32_t) (worker % ncpu));
+}
+
 void Process::jail(void)
 {
     const char* chroot_dir = userconf->runcfg.working_dir;
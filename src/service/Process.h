@@ -52,6 +52,8 @@ public:
     void unlinkPidfile(bool);
 
     int detach(void);
+    pid_t forkWorker(int &);
+    void cpuAffinity(uint16_t);
     void jail(void);
     void privilegesDowngrade(void);
     void sigtrapSetup(sig_t);
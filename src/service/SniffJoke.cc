@@ -20,6 +20,7 @@
  *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "SniffJoke.h"
+#include "Checksum.h"
 
 #include <fcntl.h>
 #include <sys/types.h>
@@ -39,22 +40,37 @@ auto_ptr<PluginPool> plugin_pool;
 /* the main must implement it */
 void sigtrap(int);
 
+/* the commands changing the port configuration */
+static bool portCmd(const char *cmd)
+{
+    return (!memcmp(cmd, "set", strlen("set")) || !memcmp(cmd, "clear", strlen("clear")));
+}
+
 SniffJoke::SniffJoke(const struct sj_cmdline_opts &opts) :
 alive(true),
 opts(opts),
-service_pid(0)
+service_pid(0),
+admin_socket(-1),
+worker_socket(-1),
+root_socket(-1)
 {
     updateClock();
 
     userconf = auto_ptr<UserConf > (new UserConf(opts));
-    proc = auto_ptr<Process > (new Process);
+
+    PacketPool::useHugepages = userconf->runcfg.packet_hugepages;
 
     LOG_DEBUG("");
 }
 
 SniffJoke::~SniffJoke(void)
 {
-    if (getuid() || geteuid())
+    /* a replay doesn't create the service processes */
+    if (proc.get() == NULL)
+    {
+        LOG_DEBUG("no service process to clean [%d]", getpid());
+    }
+    else if (getuid() || geteuid())
     {
         LOG_DEBUG("service with user privileges [%d]", getpid());
         cleanServerUser();
@@ -70,6 +86,14 @@ SniffJoke::~SniffJoke(void)
 
 void SniffJoke::run(void)
 {
+    if (userconf->runcfg.replay[0])
+    {
+        runReplay();
+        return;
+    }
+
+    proc = auto_ptr<Process > (new Process);
+
     pid_t old_service_pid = proc->readPidfile();
     if (old_service_pid != 0)
     {
@@ -118,10 +142,21 @@ void SniffJoke::run(void)
     /* sigtrap handler mapped the same in both Sj processes */
     proc->sigtrapSetup(sigtrap);
 
+    int root_sv[2] = { -1, -1 };
+    if ((userconf->runcfg.selective_route || userconf->runcfg.net_selective_in)
+            && socketpair(AF_UNIX, SOCK_SEQPACKET, 0, root_sv) == -1)
+        RUNTIME_EXCEPTION("unable to open the root process socketpair: %s", strerror(errno));
+
     /* proc->detach: fork() into two processes,
        from now on the real configuration is the one mantained by the child */
     service_pid = proc->detach();
 
+    if (root_sv[0] != -1)
+    {
+        close(root_sv[service_pid ? 1 : 0]);
+        root_socket = root_sv[service_pid ? 0 : 1];
+    }
+
     /* this is the root privileges thread, need to run for restore the network
      * environment in shutdown */
     if (service_pid)
@@ -129,6 +164,11 @@ void SniffJoke::run(void)
         int deadtrace;
 
         proc->writePidfile();
+
+        /* returns when the service closes its side of the socket */
+        if (root_socket != -1)
+            handleRootSocket();
+
         if (waitpid(service_pid, &deadtrace, WUNTRACED) > 0)
         {
             if (WIFEXITED(deadtrace))
@@ -150,10 +190,22 @@ void SniffJoke::run(void)
 
         setupDebug();
 
+        Checksum::init();
+
         /* loading the plugins used for tcp hacking, MUST be done before proc->jail() */
         plugin_pool = auto_ptr<PluginPool > (new PluginPool);
         opt_pool = auto_ptr<OptionPool > (new OptionPool);
 
+        /* with --net-selective-in the incoming tcp of the hackable ports is intercepted only for these plugins */
+        if (userconf->runcfg.net_selective_in && plugin_pool->incomingRequired())
+        {
+            userconf->runcfg.plugins_incoming = true;
+            mitm->refreshFilter();
+
+            if (send(root_socket, ROOT_CMD_INCOMING, strlen(ROOT_CMD_INCOMING) + 1, 0) == -1)
+                LOG_ALL("unable to notify the incoming plugins to the root process: %s", strerror(errno));
+        }
+
         proc->jail();
         proc->privilegesDowngrade();
 
@@ -171,6 +223,9 @@ void SniffJoke::run(void)
 
         setupAdminSocket();
 
+        /* with more than one tun queue, from here we are one of the workers */
+        spawnWorkers();
+
         /* main block */
         while (alive)
         {
@@ -180,13 +235,61 @@ void SniffJoke::run(void)
 
             mitm->networkIO();
 
-            handleAdminSocket();
+            relayTTLReplies();
+
+            if (worker_socket == -1)
+            {
+                handleAdminSocket();
+                handleWorkerRelays();
+                checkWorkers();
+            }
+            else
+            {
+                handleWorkerSocket();
+            }
 
             proc->sigtrapEnable();
         }
     }
 }
 
+/*
+ * --replay: no fork, no chroot and no admin socket. the plugins and the
+ * conntrack are the usual ones, while the I/O is done by PcapIO, driving
+ * sj_clock with the capture timestamps until both the traces are over.
+ */
+void SniffJoke::runReplay(void)
+{
+    LOG_ALL("SniffJoke is going to replay the traces with prefix %s", userconf->runcfg.replay);
+
+    signal(SIGINT, sigtrap);
+    signal(SIGTERM, sigtrap);
+
+    setupDebug();
+
+    Checksum::init();
+
+    /* PcapIO sets the clock to the first captured packet: it must precede the maps */
+    PcapIO * const replay = new PcapIO(userconf->runcfg.replay);
+    mitm = auto_ptr<IOBackend > (replay);
+
+    plugin_pool = auto_ptr<PluginPool > (new PluginPool);
+    opt_pool = auto_ptr<OptionPool > (new OptionPool);
+
+    sessiontrack_map = auto_ptr<SessionTrackMap > (new SessionTrackMap);
+    ttlfocus_map = auto_ptr<TTLFocusMap > (new TTLFocusMap);
+    conntrack = auto_ptr<TCPTrack > (new TCPTrack);
+
+    mitm->prepareConntrack(conntrack.get());
+
+    createSjEnvironment();
+
+    plugin_pool->initializeAll(&autoptrList);
+
+    while (alive && !replay->exhausted())
+        mitm->networkIO();
+}
+
 void SniffJoke::updateClock(void)
 {
     sj_clock = time(NULL);
@@ -241,6 +344,14 @@ void SniffJoke::cleanServerRoot(void)
 void SniffJoke::cleanServerUser(void)
 {
     LOG_DEBUG("");
+
+    for (uint16_t i = 0; i < worker_pids.size(); ++i)
+    {
+        LOG_VERBOSE("stopping worker pid %d (from %d)", worker_pids[i], getpid());
+        kill(worker_pids[i], SIGTERM);
+        waitpid(worker_pids[i], NULL, WUNTRACED);
+        close(worker_sockets[i]);
+    }
 }
 
 void SniffJoke::setupAdminSocket(void)
@@ -290,6 +401,236 @@ void SniffJoke::setupAdminSocket(void)
     admin_socket = tmp;
 }
 
+/*
+ * forks a worker for every tun queue after the first one. every worker
+ * inherits a private copy of the conntrack, the session and ttl maps and
+ * the plugins, and keeps only its own tun queue and packet socket.
+ */
+void SniffJoke::spawnWorkers(void)
+{
+    uint16_t queue;
+    int sock;
+
+    for (queue = 1; queue < userconf->runcfg.tun_queues; ++queue)
+    {
+        pid_t pid = proc->forkWorker(sock);
+
+        if (!pid)
+        {
+            /* the worker never answers to the client */
+            close(admin_socket);
+            admin_socket = -1;
+
+            for (uint16_t i = 0; i < worker_sockets.size(); ++i)
+                close(worker_sockets[i]);
+
+            if (root_socket != -1)
+            {
+                close(root_socket);
+                root_socket = -1;
+            }
+
+            worker_pids.clear();
+            worker_sockets.clear();
+            worker_socket = sock;
+            break;
+        }
+
+        worker_pids.push_back(pid);
+        worker_sockets.push_back(sock);
+    }
+
+    if (queue == userconf->runcfg.tun_queues)
+        queue = 0;
+
+    if (userconf->runcfg.tun_queues > 1)
+    {
+        userconf->runcfg.tun_queue = queue;
+        mitm->selectQueue(queue);
+        proc->cpuAffinity(queue);
+    }
+}
+
+/*
+ * a worker executes the commands replayed by the first process, discarding
+ * the answer, and receives the ttl probe replies relayed to its queue
+ */
+void SniffJoke::handleWorkerSocket(void)
+{
+    ssize_t ret;
+
+    while (alive)
+    {
+        if ((ret = recv(worker_socket, relay_buf, sizeof (relay_buf) - 1, MSG_DONTWAIT)) == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            RUNTIME_EXCEPTION("unable to receive from worker socket: %s", strerror(errno));
+        }
+
+        if (!ret)
+        {
+            LOG_ALL("the first process closed the worker socket, going to shutdown");
+            alive = false;
+            return;
+        }
+
+        if (relay_buf[0] == WORKER_RELAY_TAG)
+        {
+            handleRelayedFrame(ret);
+            continue;
+        }
+
+        relay_buf[ret] = 0x00;
+
+        const char * const r_buf = (const char *) relay_buf;
+
+        LOG_VERBOSE("received replayed command: %s", r_buf);
+
+        handleCmd(r_buf);
+
+        if (portCmd(r_buf))
+            mitm->refreshFilter();
+
+        applyDelayedCmds();
+    }
+}
+
+/*
+ * the ttl probe replies found by TCPTrack::relayTTLReply() are sent on the
+ * worker sockets: a worker sends them to the first process, that forwards
+ * them to the owner worker or keeps them when the probe is its own.
+ */
+void SniffJoke::relayTTLReplies(void)
+{
+    Packet *pkt;
+    uint16_t queue;
+
+    while ((pkt = conntrack->readrelayed(queue)) != NULL)
+    {
+        if (pkt->pbuf.size() > sizeof (relay_buf) - WORKER_RELAY_HDRLEN)
+        {
+            LOG_DEBUG("ttl probe reply of %u bytes not relayed", (uint32_t) pkt->pbuf.size());
+            delete pkt;
+            continue;
+        }
+
+        relay_buf[0] = WORKER_RELAY_TAG;
+        relay_buf[1] = 0x00;
+        memcpy(&relay_buf[2], &queue, sizeof (queue));
+        memcpy(&relay_buf[WORKER_RELAY_HDRLEN], &(pkt->pbuf[0]), pkt->pbuf.size());
+
+        sendRelayedFrame(queue, WORKER_RELAY_HDRLEN + pkt->pbuf.size());
+
+        delete pkt;
+    }
+}
+
+void SniffJoke::sendRelayedFrame(uint16_t queue, size_t len)
+{
+    int fd = worker_socket;
+
+    if (fd == -1)
+    {
+        if (!queue || queue > worker_sockets.size())
+        {
+            LOG_DEBUG("ttl probe reply for the invalid queue %u", queue);
+            return;
+        }
+
+        fd = worker_sockets[queue - 1];
+    }
+
+    if (send(fd, relay_buf, len, MSG_DONTWAIT) == -1)
+        LOG_DEBUG("unable to relay a ttl probe reply to queue %u: %s", queue, strerror(errno));
+}
+
+/* a relayed frame of ret bytes is in relay_buf */
+void SniffJoke::handleRelayedFrame(ssize_t ret)
+{
+    uint16_t queue;
+
+    if (ret <= WORKER_RELAY_HDRLEN)
+        return;
+
+    memcpy(&queue, &relay_buf[2], sizeof (queue));
+
+    if (queue == userconf->runcfg.tun_queue)
+        conntrack->writepacket(NETWORK, &relay_buf[WORKER_RELAY_HDRLEN], ret - WORKER_RELAY_HDRLEN);
+    else if (worker_socket == -1)
+        sendRelayedFrame(queue, ret);
+}
+
+/* the first process reads from the workers only the ttl probe replies to relay */
+void SniffJoke::handleWorkerRelays(void)
+{
+    ssize_t ret;
+
+    for (uint16_t i = 0; i < worker_sockets.size(); ++i)
+    {
+        while ((ret = recv(worker_sockets[i], relay_buf, sizeof (relay_buf), MSG_DONTWAIT)) > 0)
+        {
+            if (relay_buf[0] == WORKER_RELAY_TAG)
+                handleRelayedFrame(ret);
+        }
+    }
+}
+
+/*
+ * the root process loop with --selective-route and --net-selective-in: the
+ * port changes received by the service are replayed on the root copy of
+ * the configuration, and the routing and iptables rules are rebuilt from it.
+ */
+void SniffJoke::handleRootSocket(void)
+{
+    char r_buf[MEDIUMBUF];
+    ssize_t ret;
+
+    while (alive)
+    {
+        memset(r_buf, 0x00, sizeof (r_buf));
+
+        if ((ret = recv(root_socket, r_buf, sizeof (r_buf) - 1, 0)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            LOG_ALL("unable to receive from the routing socket: %s", strerror(errno));
+            break;
+        }
+
+        if (!ret)
+            break;
+
+        LOG_VERBOSE("received configuration change for the system rules: %s", r_buf);
+
+        if (!strcmp(r_buf, ROOT_CMD_INCOMING))
+            userconf->runcfg.plugins_incoming = true;
+        else
+            handleCmd(r_buf);
+
+        mitm->refreshRules();
+    }
+
+    close(root_socket);
+    root_socket = -1;
+}
+
+/* a dead worker leaves a tun queue without reader: better to shutdown */
+void SniffJoke::checkWorkers(void)
+{
+    pid_t pid;
+
+    if (worker_pids.empty())
+        return;
+
+    if ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+    {
+        LOG_ALL("worker %d died, going to shutdown", pid);
+        alive = false;
+    }
+}
+
 void SniffJoke::createSjEnvironment(void)
 {
     autoptrList.instanced_proc = reinterpret_cast<void *> (proc.get());
@@ -342,7 +683,31 @@ void SniffJoke::handleAdminSocket(void)
     else
         RUNTIME_EXCEPTION("BUG: command handling of [%s] doesn't return any answer", r_buf);
 
-    /* delayed execution of requested commands (only debug level change ATM) */
+    /*
+     * every worker applies the same command on its own copy of the configuration;
+     * saveconf is the exception, the configuration files are written once.
+     */
+    for (uint16_t i = 0; i < worker_sockets.size() && memcmp(r_buf, "saveconf", strlen("saveconf")); ++i)
+    {
+        if (send(worker_sockets[i], r_buf, strlen(r_buf) + 1, MSG_DONTWAIT) == -1)
+            LOG_ALL("unable to replay the command to worker %d: %s", worker_pids[i], strerror(errno));
+    }
+
+    /* the port changes are applied on the socket filter, and by the root process on the system rules */
+    if (portCmd(r_buf))
+    {
+        mitm->refreshFilter();
+
+        if (root_socket != -1 && send(root_socket, r_buf, strlen(r_buf) + 1, MSG_DONTWAIT) == -1)
+            LOG_ALL("unable to forward the command to the root process: %s", strerror(errno));
+    }
+
+    applyDelayedCmds();
+}
+
+/* delayed execution of requested commands (only debug level change ATM) */
+void SniffJoke::applyDelayedCmds(void)
+{
     if (debug.debuglevel != userconf->runcfg.debug_level)
     {
         LOG_ALL("changing log level since %u to %u\n", debug.debuglevel, userconf->runcfg.debug_level);
@@ -610,6 +975,24 @@ void SniffJoke::writeSJStatus(uint8_t commandReceived)
     accumulen += appendSJStatus(&io_buf[accumulen], STAT_NO_TCP, sizeof (userconf->runcfg.no_tcp), userconf->runcfg.no_tcp);
     accumulen += appendSJStatus(&io_buf[accumulen], STAT_NO_UDP, sizeof (userconf->runcfg.no_udp), userconf->runcfg.no_udp);
 
+    /* the packet pool of this process: with more workers, the one answering the admin socket */
+    const PacketPool &pool = PacketPool::get();
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_POOL_SLOTS, sizeof (pool.slots), pool.slots);
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_POOL_SLOTSIZE, sizeof (pool.slot_size), pool.slot_size);
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_POOL_HUGEPAGES, sizeof (pool.hugepages), pool.hugepages);
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_POOL_USED, sizeof (pool.slots_used), pool.slots_used);
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_POOL_PEAK, sizeof (pool.slots_peak), pool.slots_peak);
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_POOL_HEAP, sizeof (pool.heap_used), pool.heap_used);
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_POOL_PKTS, sizeof (pool.objects_used), pool.objects_used);
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_POOL_PKTSPEAK, sizeof (pool.objects_peak), pool.objects_peak);
+
+    /* the received frames dropped by Packet::validate(), by reason */
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_REJ_IPHDR, sizeof (uint32_t), Packet::rejected[REJ_IPHDR]);
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_REJ_TCPHDR, sizeof (uint32_t), Packet::rejected[REJ_TCPHDR]);
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_REJ_UDPHDR, sizeof (uint32_t), Packet::rejected[REJ_UDPHDR]);
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_REJ_ICMPHDR, sizeof (uint32_t), Packet::rejected[REJ_ICMPHDR]);
+    accumulen += appendSJStatus(&io_buf[accumulen], STAT_REJ_GSO, sizeof (uint32_t), Packet::rejected[REJ_GSO]);
+
     if (userconf->runcfg.whitelist)
         accumulen += appendSJStatus(&io_buf[accumulen], STAT_WHITELIST, sizeof (userconf->runcfg.whitelist), userconf->runcfg.whitelist);
     else if (userconf->runcfg.blacklist)
@@ -693,6 +1076,19 @@ uint32_t SniffJoke::appendSJStatus(uint8_t *p, int32_t WHO, uint32_t len, uint16
     return len + sizeof (singleData);
 }
 
+uint32_t SniffJoke::appendSJStatus(uint8_t *p, int32_t WHO, uint32_t len, uint32_t value)
+{
+    struct single_block singleData;
+
+    singleData.len = len;
+    singleData.WHO = WHO;
+    memcpy(p, &singleData, sizeof (singleData));
+    p += sizeof (singleData);
+    memcpy(p, &value, len);
+
+    return len + sizeof (singleData);
+}
+
 uint32_t SniffJoke::appendSJStatus(uint8_t *p, int32_t WHO, uint32_t len, bool value)
 {
     struct single_block singleData;
@@ -26,7 +26,9 @@
 #include "Utils.h"
 #include "UserConf.h"
 #include "Process.h"
+#include "IOBackend.h"
 #include "NetIO.h"
+#include "PcapIO.h"
 #include "TCPTrack.h"
 #include "TTLFocus.h"
 #include "SessionTrack.h"
@@ -46,7 +48,7 @@ private:
     const sj_cmdline_opts &opts;
 
     auto_ptr<Process> proc;
-    auto_ptr<NetIO> mitm;
+    auto_ptr<IOBackend> mitm;
     auto_ptr<TCPTrack> conntrack;
 
     /* after detach:
@@ -59,12 +61,35 @@ private:
     int admin_socket_flags_blocking;
     int admin_socket_flags_nonblocking;
 
+    /*
+     * with --tun-queues the service process forks a worker for every
+     * additional queue: the first process keeps the admin socket and
+     * replays the commands on worker_sockets, while every worker reads
+     * them from its worker_socket.
+     */
+    vector<pid_t> worker_pids;
+    vector<int> worker_sockets;
+    int worker_socket;
+
+    /* a message on the worker sockets: a command or a relayed ttl probe reply (40 bytes probe) */
+    unsigned char relay_buf[WORKER_RELAY_HDRLEN + NET_IF_MTU];
+
+    /*
+     * with --selective-route and --net-selective-in the routing and the
+     * iptables rules can be changed only by the root process: the service
+     * forwards it the port changes, and the presence of plugins mangling
+     * the incoming packets (ROOT_CMD_INCOMING), on root_socket.
+     */
+    int root_socket;
+
     /* used to copy structs for command I/O */
     uint8_t io_buf[HUGEBUF * 4];
 
     /* used to make public the singleton to the plugins */
     struct sjEnviron autoptrList;
 
+    void runReplay(void);
+    void handleRootSocket(void);
     void updateClock(void);
     void setupDebug(void);
     void cleanDebug(void);
@@ -72,6 +97,14 @@ private:
     void cleanServerUser(void);
     void setupAdminSocket(void);
     void handleAdminSocket(void);
+    void spawnWorkers(void);
+    void handleWorkerSocket(void);
+    void relayTTLReplies(void);
+    void sendRelayedFrame(uint16_t, size_t);
+    void handleRelayedFrame(ssize_t);
+    void handleWorkerRelays(void);
+    void checkWorkers(void);
+    void applyDelayedCmds(void);
     void createSjEnvironment(void);
 
     /* internalProtocol handling */
@@ -98,6 +131,7 @@ private:
 
     /* called by writeSJ* functions = answer building */
     uint32_t appendSJStatus(uint8_t *, int32_t, uint32_t, uint16_t);
+    uint32_t appendSJStatus(uint8_t *, int32_t, uint32_t, uint32_t);
     uint32_t appendSJStatus(uint8_t *, int32_t, uint32_t, bool);
     uint32_t appendSJStatus(uint8_t *, int32_t, uint32_t, const char *);
     uint32_t appendSJPortBlock(uint8_t *, uint16_t, uint16_t, uint16_t);
@@ -49,6 +49,9 @@ TCPTrack::TCPTrack()
 TCPTrack::~TCPTrack(void)
 {
     LOG_DEBUG("");
+
+    for (vector<pair<uint16_t, Packet *> >::iterator it = relayed.begin(); it != relayed.end(); ++it)
+        delete it->second;
 }
 
 uint32_t TCPTrack::derivePercentage(uint32_t packet_number, uint16_t frequencyValue)
@@ -201,6 +204,19 @@ uint8_t TCPTrack::discernAvailScramble(const Packet &pkt)
     return retval;
 }
 
+/*
+ * the packets held in KEEP for a destination are moved in HACK once, when
+ * its ttlfocus leaves TTL_BRUTEFORCE: extractTTLinfo() and injectTTLProbe()
+ * call this on every status change, no scan of KEEP is needed.
+ */
+void TCPTrack::releaseKeepPackets(TTLFocus &ttlfocus)
+{
+    for (vector<Packet *>::iterator it = ttlfocus.keep_waiting.begin(); it != ttlfocus.keep_waiting.end(); ++it)
+        p_queue.insert(**it, HACK);
+
+    ttlfocus.keep_waiting.clear();
+}
+
 /*
  * this function is responsable of the ttl bruteforce stage used
  * to detect the hop distance between us and the remote peer.
@@ -243,6 +259,7 @@ void TCPTrack::injectTTLProbe(TTLFocus &ttlfocus)
                 ttlfocus.ttl_estimate = 0xFF;
                 ttlfocus.ttl_synack = 0;
                 ttlfocus.next_probe_time = sj_clock + TTLPROBE_RETRY_ON_UNKNOWN;
+                releaseKeepPackets(ttlfocus);
             }
             break;
         }
@@ -280,6 +297,11 @@ void TCPTrack::execTTLBruteforces(void)
     for (TTLFocusMap::iterator it = ttlfocus_map->begin(); it != ttlfocus_map->end(); ++it)
     {
         TTLFocus &ttlfocus = *((*it).second);
+
+        /* a destination with packets waiting in KEEP is in use */
+        if (!ttlfocus.keep_waiting.empty())
+            ttlfocus.access_timestamp = sj_clock;
+
         if ((ttlfocus.status != TTL_KNOWN) /* 1) the ttl is BRUTEFORCE or UNKNOWN */
                 && (ttlfocus.access_timestamp > (sj_clock - 30)) /* 2) the destination it's used in the last 30 seconds */
                 && (ttlfocus.next_probe_time <= sj_clock)) /* 3) the next probe time it's passed */
@@ -289,6 +311,60 @@ void TCPTrack::execTTLBruteforces(void)
     }
 }
 
+/*
+ * with --tun-queues the fanout hashes a ttl probe reply apart from the probe:
+ * the SYN/ACK and the ICMP TIME_EXCEEDED can reach a process not having the
+ * ttlfocus, that would pass them to the kernel (answering with a RST). the
+ * puppet port tells the owner of the probe (TTLFocus::selectPuppetPort) and
+ * the seq, small in every probe, excludes the real connections on the same
+ * ports. the function returns TRUE if the packet has been moved to relayed.
+ */
+bool TCPTrack::relayTTLReply(Packet &incompkt)
+{
+    uint16_t port;
+
+    if (userconf->runcfg.tun_queues < 2)
+        return false;
+
+    if (incompkt.proto == ICMP && incompkt.icmp->type == ICMP_TIME_EXCEEDED)
+    {
+        const struct iphdr * const badiph = (struct iphdr *) ((unsigned char *) incompkt.icmp + sizeof (struct icmphdr));
+        const struct tcphdr * badtcph;
+
+        if (incompkt.icmppayloadlen < sizeof (struct iphdr) || badiph->protocol != IPPROTO_TCP
+                || incompkt.icmppayloadlen < (badiph->ihl * 4) + 8)
+            return false;
+
+        badtcph = (struct tcphdr *) ((unsigned char *) badiph + (badiph->ihl * 4));
+
+        if (ntohl(badtcph->seq) >= TTLPROBE_SEQ_MAX)
+            return false;
+
+        port = ntohs(badtcph->source);
+    }
+    else if (incompkt.proto == TCP && incompkt.tcp->syn && incompkt.tcp->ack)
+    {
+        if (ntohl(incompkt.tcp->ack_seq) - 1 >= TTLPROBE_SEQ_MAX)
+            return false;
+
+        port = ntohs(incompkt.tcp->dest);
+    }
+    else
+    {
+        return false;
+    }
+
+    if (!TTLFocus::isPuppetPort(port) || TTLFocus::puppetPortOwner(port) == userconf->runcfg.tun_queue)
+        return false;
+
+    incompkt.SELFLOG("ttl probe reply relayed to queue %u", TTLFocus::puppetPortOwner(port));
+
+    p_queue.extract(incompkt);
+    relayed.push_back(make_pair(TTLFocus::puppetPortOwner(port), &incompkt));
+
+    return true;
+}
+
 /*
  *
  * extracts TTL information from an incoming packet
@@ -353,6 +429,7 @@ bool TCPTrack::extractTTLinfo(const Packet &incompkt)
                      */
                     ttlfocus->status = TTL_UNKNOWN;
                     ttlfocus->ttl_estimate = expired_ttl + 1;
+                    releaseKeepPackets(*ttlfocus);
                 }
             }
 
@@ -398,6 +475,7 @@ bool TCPTrack::extractTTLinfo(const Packet &incompkt)
         }
 
         ttlfocus->status = TTL_KNOWN;
+        releaseKeepPackets(*ttlfocus);
 
         incompkt.SELFLOG("incoming SYN/ACK puppet|%d ttl_estimate|%d ttl_synack|%d",
                          ttlfocus->puppet_port, ttlfocus->ttl_estimate, ttlfocus->ttl_synack);
@@ -444,9 +522,14 @@ bool TCPTrack::notifyIncoming(Packet &origpkt)
         pt->selfObj->mangleIncoming(origpkt);
 
         /* it will be rare for a hack mangleIncoming to generate one or more packet, anyway we keep this possibility possible */
-        for (vector<Packet*>::iterator hack_it = pt->selfObj->pktVector.begin(); hack_it < pt->selfObj->pktVector.end(); ++hack_it)
+        PacketHandle owned;
+        while (pt->selfObj->takePacket(owned))
         {
-            Packet &injpkt = **hack_it;
+            /* the packet is owned by the handle until it is queued */
+            Packet &injpkt = *owned;
+
+            /* a copy-on-write clone gets its own payload before the original is touched again */
+            injpkt.pbuf.unshare();
 
             if (!injpkt.selfIntegrityCheck(pt->selfObj->pluginName))
             {
@@ -458,13 +541,16 @@ bool TCPTrack::notifyIncoming(Packet &origpkt)
                     RUNTIME_EXCEPTION("%s: invalid pkt generated", pt->selfObj->pluginName);
 
                 /* otherwise, the error was reported and sniffjoke continue to work */
-                delete &injpkt;
+                owned.reset();
                 continue;
             }
 
             /* lastPktFix is called because the checksum will not be correct */
             if (!lastPktFix(injpkt))
+            {
+                owned.reset();
                 continue;
+            }
 
 #ifdef ENABLE_INCOMING_DEBUG
             injpkt.SELFLOG("%s: generated packet, the original (i%u) will be %s",
@@ -477,6 +563,9 @@ bool TCPTrack::notifyIncoming(Packet &origpkt)
              * ATM we inject in the SEND queue so every packet generated
              * in mangleIncoming is equal to be ANTICIPATION */
             p_queue.insert(injpkt, SEND);
+
+            /* the queue owns it now */
+            owned.release();
         }
 
         if (pt->selfObj->removeOrigPkt == true)
@@ -551,6 +640,22 @@ bool TCPTrack::injectHack(Packet &origpkt)
     if (!applicable_hacks.size() && (userconf->runcfg.debug_level == PACKET_LEVEL))
         origpkt.SELFLOG("NONE hack plugin has been passed the selection!");
 
+    /*
+     * a GSO super-packet is split only when some hack has been selected:
+     * the segments replace it in the queue and are hacked one by one.
+     */
+    if (origpkt.isGSO() && applicable_hacks.size())
+    {
+        origpkt.SELFLOG("%d hacks selected: splitting the GSO packet in segments of %u bytes",
+                        applicable_hacks.size(), origpkt.vnethdr.gso_size);
+        segmentGSO(origpkt);
+        return true;
+    }
+
+    /* the plugins could copy the raw bytes, as the fragments do: they need the full checksum */
+    if (applicable_hacks.size() && (origpkt.vnethdr.flags & VNET_HDR_F_NEEDS_CSUM))
+        origpkt.fixSum();
+
     /* -- RANDOMIZE HACKS APPLICATION */
     random_shuffle(applicable_hacks.begin(), applicable_hacks.end());
 
@@ -565,9 +670,15 @@ bool TCPTrack::injectHack(Packet &origpkt)
 
         pt->selfObj->apply(origpkt, availableScrambles);
 
-        for (vector<Packet*>::iterator hack_it = pt->selfObj->pktVector.begin(); hack_it < pt->selfObj->pktVector.end(); ++hack_it)
+        PacketHandle owned;
+        while (pt->selfObj->takePacket(owned))
         {
-            Packet &injpkt = **hack_it;
+            /* the packet is owned by the handle until it is queued */
+            Packet &injpkt = *owned;
+
+            /* a copy-on-write clone gets its own payload before the original is touched again */
+            injpkt.pbuf.unshare();
+
             /*
              * we trust in the external developer, but it's required a
              * simple safety check by sniffjoke :)
@@ -581,12 +692,13 @@ bool TCPTrack::injectHack(Packet &origpkt)
                     RUNTIME_EXCEPTION("%s invalid pkt generated: bad integrity", pt->selfObj->pluginName);
 
                 /* otherwise, the error was reported and sniffjoke continue to work */
-                delete &injpkt;
+                owned.reset();
                 continue;
             }
 
             if (!lastPktFix(injpkt))
             {
+                owned.reset();
                 continue;
             }
 
@@ -616,6 +728,9 @@ bool TCPTrack::injectHack(Packet &origpkt)
             case POSITIONUNASSIGNED:
                 RUNTIME_EXCEPTION("FATAL CODE [D4L1]: please send a notification to the developers");
             }
+
+            /* the queue owns it now */
+            owned.release();
         }
 
         if (pt->selfObj->removeOrigPkt == true)
@@ -627,6 +742,73 @@ bool TCPTrack::injectHack(Packet &origpkt)
     return removeOrig;
 }
 
+/*
+ * segmentGSO splits a TSO super-packet read from the tun in the segments
+ * the kernel would have sent, giving every segment its own chance to be
+ * hacked. the segments are inserted before the super-packet, that is
+ * removed by the caller.
+ */
+void TCPTrack::segmentGSO(Packet &superpkt)
+{
+    const uint16_t hdrlen = superpkt.iphdrlen + superpkt.tcphdrlen;
+    const uint16_t mss = superpkt.vnethdr.gso_size;
+    const uint32_t starting_seq = ntohl(superpkt.tcp->seq);
+    const uint16_t starting_id = ntohs(superpkt.ip->id);
+
+    SessionTrack &sessiontrack = sessiontrack_map->get(superpkt);
+
+    uint16_t segnum = 0;
+    for (uint32_t off = 0; off < superpkt.tcppayloadlen; off += mss, ++segnum)
+    {
+        const uint16_t seglen = (superpkt.tcppayloadlen - off > mss) ? mss : superpkt.tcppayloadlen - off;
+
+        /* the segment is built in the memory of its packet, that takes it without a copy */
+        PacketBuffer segbuf(hdrlen + seglen);
+        struct iphdr * const ip = (struct iphdr *) &segbuf[0];
+        struct tcphdr * const tcp = (struct tcphdr *) &segbuf[superpkt.iphdrlen];
+
+        memcpy(&segbuf[0], &superpkt.pbuf[0], hdrlen);
+        memcpy(&segbuf[hdrlen], &superpkt.tcppayload[off], seglen);
+
+        ip->tot_len = htons(hdrlen + seglen);
+        ip->id = htons(starting_id + segnum);
+        tcp->seq = htonl(starting_seq + off);
+
+        /* CWR (the upper bit of res2) only on the first segment, FIN and PSH only on the last */
+        if (segnum)
+            tcp->res2 &= 0x1;
+
+        if (off + seglen < superpkt.tcppayloadlen)
+        {
+            tcp->fin = 0;
+            tcp->psh = 0;
+        }
+
+        Packet * const seg = new Packet(segbuf);
+        seg->source = TUNNEL;
+        seg->wtf = superpkt.wtf;
+        seg->choosableScramble = superpkt.choosableScramble;
+        if (userconf->runcfg.net_csum_offload)
+            seg->offloadSum();
+        else
+            seg->fixSum();
+
+        p_queue.insertBefore(*seg, superpkt);
+
+        /* the super-packet has already been counted as the first segment */
+        if (segnum)
+            ++(sessiontrack.packet_number);
+
+        seg->SELFLOG("segment %u of the GSO packet i%u", segnum + 1, superpkt.SjPacketId);
+
+        if (injectHack(*seg))
+        {
+            seg->SELFLOG("removal requested by injectHack");
+            p_queue.drop(*seg);
+        }
+    }
+}
+
 /*
  * lastPktFix is the last modification applied to outgoing packets.
  * modification involve only TCP/UDP packets coming from TUNNEL
@@ -651,6 +833,8 @@ bool TCPTrack::injectHack(Packet &origpkt)
  * hacks application follows this order: PRESCRIPTION, MALFORMED, GUILTY.
  * a non applicable hack it's degraded to the next;
  * at worst GUILTY it's always applied.
+ *
+ * false tells that the packet has to be dropped: it's up to the owner.
  */
 bool TCPTrack::lastPktFix(Packet &pkt)
 {
@@ -661,14 +845,14 @@ bool TCPTrack::lastPktFix(Packet &pkt)
         /* WHAT VALUE OF TTL GIVE TO THE PACKET ? */
         if (pkt.wtf == PRESCRIPTION)
         {
-            pkt.ip->ttl = ttlfocus.ttl_estimate - (1 + (random() % 2)); /* [-1, -2], 2 values */
+            pkt.setTTL(ttlfocus.ttl_estimate - (1 + (random() % 2))); /* [-1, -2], 2 values */
         }
         else
         {
             /* MISTIFICATION FOR WTF != PRESCRIPTION */
             /* apply mystification if PRESCRIPTION is globally enabled */
             if (ISSET_TTL(plugin_pool->enabledScrambles()))
-                pkt.ip->ttl = ttlfocus.ttl_estimate + (random() % 4); /* [+0, +3], 4 values */
+                pkt.setTTL(ttlfocus.ttl_estimate + (random() % 4)); /* [+0, +3], 4 values */
         }
     }
     else
@@ -697,7 +881,7 @@ bool TCPTrack::lastPktFix(Packet &pkt)
             /* MISTIFICATION APPLY ON DOWNGRADE, RANDOMIZING A BIT THE ORIGINAL TTL VALUE */
             /* apply mystification if PRESCRIPTION is globally enabled */
             if (ISSET_TTL(plugin_pool->enabledScrambles()))
-                pkt.ip->ttl += (random() % 20) - 10; /* [-10, +10 ], 20 mystification values */
+                pkt.setTTL(pkt.ip->ttl + (random() % 20) - 10); /* [-10, +10 ], 20 mystification values */
         }
     }
 
@@ -760,8 +944,12 @@ bool TCPTrack::lastPktFix(Packet &pkt)
     {
         /* MISTIFICATION OF THE PACKET NOT YET CORRUPTED BY IP/TCP OPTIONS */
 
-        /* IP/TCP options scambling enabled globally (and/or for destination) */
-        if (ISSET_MALFORMED(plugin_pool->enabledScrambles()))
+        /*
+         * IP/TCP options scambling enabled globally (and/or for destination);
+         * not on GSO super-packets: the options would be replicated in every
+         * segment, pushing them beyond the mtu.
+         */
+        if (ISSET_MALFORMED(plugin_pool->enabledScrambles()) && !pkt.isGSO())
         {
             bool optmysty = false;
 
@@ -800,8 +988,14 @@ bool TCPTrack::lastPktFix(Packet &pkt)
      * this was not correct, because the plugins will supply a specific layer 5
      * payload, for this reason I've moved the function in the plugins */
 
-    /* fixing the mangled packet */
-    pkt.fixSum();
+    /*
+     * fixing the mangled packet: the checksums to be corrupted are computed
+     * here, the valid ones could be left to the nic.
+     */
+    if (userconf->runcfg.net_csum_offload && pkt.wtf != GUILTY)
+        pkt.offloadSum();
+    else
+        pkt.fixSum();
 
     /*
      * corrupted checksum application if required;
@@ -815,7 +1009,6 @@ bool TCPTrack::lastPktFix(Packet &pkt)
 
 drop_packet:
     pkt.SELFLOG("pkt dropped during fix");
-    p_queue.drop(pkt);
 
     return false;
 }
@@ -836,7 +1029,8 @@ drop_packet:
  *
  *   TUNNEL packets:
  *     - we analyze tcp/udp packets to see if can be moved into HACK queue or if they
- *       need to be hold in status KEEP waiting for some conditions.
+ *       need to be hold in status KEEP waiting for the ttl bruteforce of their
+ *       destination: they are released by releaseKeepPackets().
  *       every packets from the tunnel will be associated to a session (and session counter updated)
  *       and to a ttlfocus (if the ttlfocus not exists a new ttlbruteforce session is started).
  *
@@ -856,6 +1050,9 @@ void TCPTrack::handleYoungPackets(void)
              * every incoming packet, triggered or not by our TTLBRUTEFORCE routine
              * will have useful informations for TTL stats.
              */
+            if (relayTTLReply(*pkt))
+                continue;
+
             if (extractTTLinfo(*pkt))
             {
                 pkt->SELFLOG("removal requested by extractTTLinfo");
@@ -894,9 +1091,12 @@ void TCPTrack::handleYoungPackets(void)
                  * due to the actual ttl bruteforce implementation a
                  * pure UDP flaw could go in starvation.
                  */
-                if (pkt->proto == TCP && ttlfocus_map->get(*pkt).status == TTL_BRUTEFORCE)
+                TTLFocus &ttlfocus = ttlfocus_map->get(*pkt);
+
+                if (pkt->proto == TCP && ttlfocus.status == TTL_BRUTEFORCE)
                 {
                     p_queue.insert(*pkt, KEEP);
+                    ttlfocus.keep_waiting.push_back(pkt);
                 }
                 else
                 {
@@ -916,27 +1116,6 @@ void TCPTrack::handleYoungPackets(void)
     }
 }
 
-/*
- * here we analyze KEEP queue
- *
- * we handle only:
- *
- *   TUNNEL packets:
- *     - we analyze tcp/udp packets to see if can marked sendable or if they
- *       need to be hold in status KEEP waiting for some conditions.
- *
- *   any other pkt->source does scatter a fatal exception.
- */
-void TCPTrack::handleKeepPackets(void)
-{
-    Packet *pkt = NULL;
-    for (p_queue.select(KEEP); ((pkt = p_queue.getSource(TUNNEL)) != NULL);)
-    {
-        if (ttlfocus_map->get(*pkt).status != TTL_BRUTEFORCE)
-            p_queue.insert(*pkt, HACK);
-    }
-}
-
 /*
  * here we analyze HACK queue
  *
@@ -988,18 +1167,73 @@ void TCPTrack::handleHackPackets(void)
         p_queue.insert(*pkt, SEND);
 }
 
+/*
+ * the classification of writepacket() made on the received bytes, before
+ * building a Packet: true tells that the frame goes out untouched and the
+ * caller can forward it as it is. a frame refused by the Packet parsing is
+ * never bypassed: writepacket() drops it, as usual. the result of the
+ * validation is returned in reject and proto, to be given to writepacket()
+ * when the frame is queued.
+ */
+bool TCPTrack::bypass(const unsigned char *buff, int nbyte, const struct vnet_hdr *vnethdr, reject_t &reject, uint8_t &proto) const
+{
+    const struct iphdr * const ip = (const struct iphdr *) buff;
+
+    if ((reject = Packet::validate(buff, nbyte, vnethdr, proto)) != NOTREJECTED)
+        return false;
+
+    if (!userconf->runcfg.active || !(proto & mangled_proto_mask))
+        return true;
+
+    if (userconf->runcfg.use_blacklist)
+    {
+        return userconf->runcfg.blacklist->isPresent(ip->daddr) ||
+                userconf->runcfg.blacklist->isPresent(ip->saddr);
+    }
+
+    if (userconf->runcfg.use_whitelist)
+    {
+        return !userconf->runcfg.whitelist->isPresent(ip->daddr) &&
+                !userconf->runcfg.whitelist->isPresent(ip->saddr);
+    }
+
+    return false;
+}
+
 /* the packet is added in the packet queue here to be analyzed in a second time */
-void TCPTrack::writepacket(source_t source, const unsigned char *buff, int nbyte)
+void TCPTrack::writepacket(source_t source, const unsigned char *buff, int nbyte, const struct vnet_hdr *vnethdr)
+{
+    uint8_t proto;
+    const reject_t reject = Packet::validate(buff, nbyte, vnethdr, proto);
+
+    writepacket(source, buff, nbyte, vnethdr, reject, proto);
+}
+
+/* the same, with the Packet::validate() result already computed by bypass() */
+void TCPTrack::writepacket(source_t source, const unsigned char *buff, int nbyte, const struct vnet_hdr *vnethdr,
+                           reject_t reject, uint8_t proto)
 {
+    /* anomalous/malformed packets are dropped and counted, without exceptions */
+    if (reject != NOTREJECTED)
+    {
+        ++Packet::rejected[reject];
+        LOG_PACKET("malformed orig pkt dropped: reject reason %u", reject);
+        return;
+    }
+
     try
     {
-        Packet * const pkt = new Packet(buff, nbyte);
+        Packet * const pkt = new Packet(buff, nbyte, vnethdr);
         pkt->source = source;
         pkt->wtf = INNOCENT;
         pkt->choosableScramble = INNOCENT; /* on innocent pkts this variable is meaningless */
 
+        /* the kernel completes the checksums of the packets sent to the tunnel, unless they use the offload */
+        if (source == TUNNEL && !(pkt->vnethdr.flags & VNET_HDR_F_NEEDS_CSUM))
+            pkt->sumdirty = SUMVALID;
+
         /* Sniffjoke does handle only TCP, UDP and ICMP */
-        if (userconf->runcfg.active && (pkt->proto & mangled_proto_mask))
+        if (userconf->runcfg.active && (proto & mangled_proto_mask))
         {
             if (userconf->runcfg.use_blacklist)
             {
@@ -1029,8 +1263,7 @@ void TCPTrack::writepacket(source_t source, const unsigned char *buff, int nbyte
     }
     catch (exception &e)
     {
-        /* anomalous/malformed packets are flushed bypassing the queue */
-        LOG_ALL("malformed orig pkt dropped: %s", e.what());
+        LOG_ALL("orig pkt dropped: %s", e.what());
     }
 }
 
@@ -1039,23 +1272,24 @@ void TCPTrack::writepacket(source_t source, const unsigned char *buff, int nbyte
  */
 Packet * TCPTrack::readpacket(source_t destsource)
 {
-    uint8_t mask;
-    if (destsource == NETWORK)
-        mask = NETWORK;
-    else
-        mask = TUNNEL | PLUGIN | TRACEROUTE;
+    Packet * const pkt = p_queue.frontSEND(destsource);
 
-    Packet *pkt = NULL;
-    for (p_queue.select(SEND); ((pkt = p_queue.get()) != NULL);)
-    {
-        if (pkt->source & mask)
-        {
-            p_queue.extract(*pkt);
-            return pkt;
-        }
-    }
+    if (pkt != NULL)
+        p_queue.extract(*pkt);
+
+    return pkt;
+}
+
+Packet * TCPTrack::readrelayed(uint16_t &queue)
+{
+    if (relayed.empty())
+        return NULL;
+
+    Packet * const pkt = relayed.back().second;
+    queue = relayed.back().first;
+    relayed.pop_back();
 
-    return NULL;
+    return pkt;
 }
 
 void TCPTrack::analyzePacketQueue(void)
@@ -1065,7 +1299,6 @@ void TCPTrack::analyzePacketQueue(void)
         goto bypass_queue_analysis;
 
     handleYoungPackets();
-    handleKeepPackets();
     handleHackPackets();
 
 bypass_queue_analysis:
@@ -1078,7 +1311,7 @@ bypass_queue_analysis:
      * limits are passed, will delete the oldest records.
      * This is completely safe because send packets are just HACKed and there
      * is no problem if we does not schedule a ttlprobe for a cycle;
-     * KEEP packets will scatter a new ttlfocus at the next.
+     * a ttlfocus with KEEP packets waiting on it is never removed.
      */
 
     sessiontrack_map->manage();
@@ -43,21 +43,26 @@ private:
     PacketFilter packet_filter;
     PacketQueue p_queue;
 
+    /* --tun-queues: the ttl probe replies owned by another process, with the queue of the owner */
+    vector<pair<uint16_t, Packet *> > relayed;
+
     uint32_t derivePercentage(uint32_t, uint16_t);
     bool percentage(uint32_t, uint16_t, uint16_t);
     uint16_t getUserFrequency(const Packet &);
     uint8_t discernAvailScramble(const Packet &);
 
+    void releaseKeepPackets(TTLFocus &);
     void injectTTLProbe(TTLFocus &);
     void execTTLBruteforces(void);
     bool extractTTLinfo(const Packet &);
+    bool relayTTLReply(Packet &);
 
     bool notifyIncoming(Packet &);
     bool injectHack(Packet &);
+    void segmentGSO(Packet &);
     bool lastPktFix(Packet &);
 
     void handleYoungPackets(void);
-    void handleKeepPackets(void);
     void handleHackPackets(void);
 
 public:
@@ -65,9 +70,19 @@ public:
     TCPTrack(void);
     ~TCPTrack(void);
 
-    void writepacket(source_t, const unsigned char *, int);
+    bool bypass(const unsigned char *, int, const struct vnet_hdr *, reject_t &, uint8_t &) const;
+    void writepacket(source_t, const unsigned char *, int, const struct vnet_hdr * = NULL);
+    void writepacket(source_t, const unsigned char *, int, const struct vnet_hdr *, reject_t, uint8_t);
+    /* the packet extracted from the SEND queue is owned by the caller, deleting it once sent */
     Packet* readpacket(source_t);
+    /* the same for a ttl probe reply to relay to the process serving the returned queue */
+    Packet* readrelayed(uint16_t &);
     void analyzePacketQueue(void);
+
+    uint32_t queued(void)
+    {
+        return p_queue.size();
+    };
 };
 
 #endif /* SJ_TCPTRACK_H */
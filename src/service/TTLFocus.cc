@@ -21,6 +21,9 @@
  */
 
 #include "TTLFocus.h"
+#include "UserConf.h"
+
+extern auto_ptr<UserConf> userconf;
 
 TTLFocus::TTLFocus(const Packet &pkt) :
 access_timestamp(sj_clock),
@@ -83,13 +86,21 @@ TTLFocus::~TTLFocus(void)
     SELFLOG("");
 }
 
+/*
+ * with more tun queues the replies to a probe (SYN/ACK and ICMP TIME_EXCEEDED)
+ * are delivered by the fanout to any process, so the puppet port is chosen
+ * congruent to the queue of this process modulo the number of queues:
+ * puppetPortOwner() gives back the process owning the ttlfocus.
+ */
 uint16_t TTLFocus::selectPuppetPort(uint16_t realport)
 {
+    const uint16_t queues = userconf->runcfg.tun_queues ? userconf->runcfg.tun_queues : 1;
     uint16_t puppet_port;
 
     do
     {
-        puppet_port = (random() % (32767 - 1024)) + 1024;
+        puppet_port = (random() % ((TTLPROBE_PORT_MAX - TTLPROBE_PORT_MIN) / queues)) * queues;
+        puppet_port += TTLPROBE_PORT_MIN + userconf->runcfg.tun_queue;
     }
 
     while ((puppet_port >> 4) == (realport >> 4));
@@ -97,6 +108,16 @@ uint16_t TTLFocus::selectPuppetPort(uint16_t realport)
     return puppet_port;
 }
 
+bool TTLFocus::isPuppetPort(uint16_t port)
+{
+    return port >= TTLPROBE_PORT_MIN && port < TTLPROBE_PORT_MAX;
+}
+
+uint16_t TTLFocus::puppetPortOwner(uint16_t port)
+{
+    return (port - TTLPROBE_PORT_MIN) % userconf->runcfg.tun_queues;
+}
+
 void TTLFocus::selflog(const char *func, const char *format, ...) const
 {
     if (debug.level() == SUPPRESS_LEVEL)
@@ -134,14 +155,17 @@ manage_timeout(sj_clock)
 {
     LOG_DEBUG("with reference time (seconds) %u", uint32_t(sj_clock));
 
-    load();
+    /* a replay must neither depend on the network cache nor pollute it */
+    if (!userconf->runcfg.replay[0])
+        load();
 }
 
 TTLFocusMap::~TTLFocusMap(void)
 {
     uint32_t counter = 0;
 
-    dump();
+    if (!userconf->runcfg.replay[0])
+        dump();
 
     for (TTLFocusMap::iterator it = begin(); it != end();)
     {
@@ -182,7 +206,8 @@ void TTLFocusMap::manage(void)
         manage_timeout = sj_clock; /* update the next manage timeout */
         for (TTLFocusMap::iterator it = begin(); it != end();)
         {
-            if ((*it).second->access_timestamp + TTLFOCUS_EXPIRYTIME < sj_clock)
+            /* a ttlfocus with packets waiting in KEEP is still in use */
+            if ((*it).second->access_timestamp + TTLFOCUS_EXPIRYTIME < sj_clock && (*it).second->keep_waiting.empty())
                 erase(it++);
             else
                 ++it;
@@ -221,8 +246,12 @@ void TTLFocusMap::manage(void)
         while (++index != TTLFOCUSMAP_MEMORY_THRESHOLD / 2);
 
         do
-            delete tmp[index];
-
+        {
+            if (tmp[index]->keep_waiting.empty())
+                delete tmp[index];
+            else
+                insert(pair<uint32_t, TTLFocus*>((tmp[index])->daddr, tmp[index]));
+        }
         while (++index != map_size);
 
         delete[] tmp;
@@ -63,6 +63,9 @@ public:
                              on status UNKNOWN : represents the max expired ttl found */
     uint8_t ttl_synack; /* the value of the ttl read in the synack packet */
 
+    /* the packets held in KEEP until the status leaves TTL_BRUTEFORCE, released by TCPTrack */
+    vector<Packet *> keep_waiting;
+
     /* per-dest tracking of which IP|TCP options will be effective or became dropped */
     struct option_discovery OptMap[SUPPORTED_OPTIONS];
 
@@ -77,6 +80,10 @@ public:
     ~TTLFocus(void);
     uint16_t selectPuppetPort(uint16_t);
 
+    /* with --tun-queues the puppet port tells the queue whose process has sent the probe */
+    static bool isPuppetPort(uint16_t);
+    static uint16_t puppetPortOwner(uint16_t);
+
     /* utilities */
     void selflog(const char *func, const char *format, ...) const;
 };
@@ -56,6 +56,9 @@ cmdline_opts(cmdline_opts)
         selected_basedir = WORK_DIR;
     }
 
+    if (cmdline_opts.replay[0] && cmdline_opts.replay[0] != '/')
+        RUNTIME_EXCEPTION("--replay must have absolute resolution");
+
     if (cmdline_opts.location[0])
     {
         selected_location = cmdline_opts.location;
@@ -77,6 +80,8 @@ cmdline_opts(cmdline_opts)
     memset(&runcfg, 0x00, sizeof (sj_config));
     memcpy(runcfg.location, selected_location, strlen(selected_location));
 
+    memcpy(runcfg.replay, cmdline_opts.replay, sizeof (runcfg.replay));
+
     /* in main.cc, near getopt, basedir last char if set to be '/' */
     snprintf(runcfg.working_dir, sizeof (runcfg.working_dir), "%s%s", selected_basedir, selected_location);
 
@@ -130,6 +135,62 @@ cmdline_opts(cmdline_opts)
     if (runcfg.use_blacklist && runcfg.use_whitelist)
         RUNTIME_EXCEPTION("configuration conflict: both blacklist and whitelist seem to be enabled");
 
+    if (runcfg.net_mmap)
+    {
+        /* a ring block must be a power of two multiple of the page size */
+        if (!runcfg.mmap_ring_blocks)
+            RUNTIME_EXCEPTION("invalid mmap-ring-blocks: at least one block is required");
+
+        if ((runcfg.mmap_block_kb * 1024) % getpagesize() || (runcfg.mmap_block_kb & (runcfg.mmap_block_kb - 1)))
+            RUNTIME_EXCEPTION("invalid mmap-block-kb %u: must be a power of two multiple of the page size", runcfg.mmap_block_kb);
+    }
+
+    if (runcfg.net_mmap && runcfg.net_batch)
+        RUNTIME_EXCEPTION("configuration conflict: both net-mmap and net-batch seem to be enabled");
+
+    if (runcfg.net_batch && !runcfg.net_batch_size)
+        RUNTIME_EXCEPTION("invalid net-batch-size: at least one frame per batch is required");
+
+    if (!runcfg.tun_queues || runcfg.tun_queues > TUN_MAX_QUEUES)
+        RUNTIME_EXCEPTION("invalid tun-queues %u: permitted values are 1-%u", runcfg.tun_queues, TUN_MAX_QUEUES);
+
+    /* the mmap rings are bound to a single packet socket */
+    if (runcfg.tun_queues > 1 && runcfg.net_mmap)
+        RUNTIME_EXCEPTION("configuration conflict: net-mmap can't be used with more than one tun queue");
+
+    /* the AF_XDP socket replaces netfd: it excludes the other network backends */
+    if (runcfg.net_xdp && (runcfg.net_mmap || runcfg.net_batch))
+        RUNTIME_EXCEPTION("configuration conflict: net-xdp can't be used with net-mmap or net-batch");
+
+    if (runcfg.net_xdp && runcfg.tun_queues > 1)
+        RUNTIME_EXCEPTION("configuration conflict: net-xdp can't be used with more than one tun queue");
+
+    if (runcfg.xdp_zerocopy && !runcfg.net_xdp)
+        RUNTIME_EXCEPTION("configuration conflict: xdp-zerocopy requires net-xdp");
+
+    if (runcfg.io_uring && (runcfg.net_mmap || runcfg.net_batch || runcfg.net_xdp))
+        RUNTIME_EXCEPTION("configuration conflict: io-uring can't be used with net-mmap, net-batch or net-xdp");
+
+    if (runcfg.tun_vnet_hdr && (runcfg.net_mmap || runcfg.net_batch || runcfg.net_xdp || runcfg.io_uring))
+        RUNTIME_EXCEPTION("configuration conflict: tun-vnet-hdr can't be used with net-mmap, net-batch, net-xdp or io-uring");
+
+    if (runcfg.net_csum_offload && (runcfg.net_mmap || runcfg.net_batch || runcfg.net_xdp || runcfg.io_uring))
+        RUNTIME_EXCEPTION("configuration conflict: net-csum-offload can't be used with net-mmap, net-batch, net-xdp or io-uring");
+
+    /* the AF_XDP socket is fed by its own XDP program, not by a socket filter */
+    if (runcfg.net_filter_proto && runcfg.net_xdp)
+        RUNTIME_EXCEPTION("configuration conflict: net-filter-proto can't be used with net-xdp");
+
+    /* the AF_XDP program redirects every packet for our ip */
+    if (runcfg.net_selective_in && runcfg.net_xdp)
+        RUNTIME_EXCEPTION("configuration conflict: net-selective-in can't be used with net-xdp");
+
+    /* the replay has its own backend: the options of the live one make no sense */
+    if (runcfg.replay[0] && (runcfg.net_mmap || runcfg.net_batch || runcfg.net_xdp || runcfg.io_uring
+                             || runcfg.tun_queues > 1 || runcfg.tun_vnet_hdr || runcfg.net_csum_offload
+                             || runcfg.selective_route || runcfg.net_selective_in))
+        RUNTIME_EXCEPTION("configuration conflict: replay can't be used with the network I/O options");
+
     if (runcfg.onlyplugin[0])
     {
         LOG_VERBOSE("plugin %s override the plugins settings in %s", runcfg.onlyplugin,
@@ -417,6 +478,22 @@ bool UserConf::loadDiskConfiguration(void)
     parseMatch(runcfg.onlyplugin, "only-plugin", loadstream, cmdline_opts.onlyplugin, DEFAULT_ONLYPLUGIN);
     parseMatch(runcfg.max_ttl_probe, "max-ttl-probe", loadstream, cmdline_opts.max_ttl_probe, DEFAULT_MAX_TTLPROBE);
     parseMatch(runcfg.gw_mac_str, "gw-mac-addr", loadstream, cmdline_opts.gw_mac_str, DEFAULT_GW_MAC_ADDR);
+    parseMatch(runcfg.net_mmap, "net-mmap", loadstream, cmdline_opts.net_mmap, DEFAULT_NET_MMAP);
+    parseMatch(runcfg.mmap_ring_blocks, "mmap-ring-blocks", loadstream, cmdline_opts.mmap_ring_blocks, DEFAULT_MMAP_RING_BLOCKS);
+    parseMatch(runcfg.mmap_block_kb, "mmap-block-kb", loadstream, cmdline_opts.mmap_block_kb, DEFAULT_MMAP_BLOCK_KB);
+    parseMatch(runcfg.net_batch, "net-batch", loadstream, cmdline_opts.net_batch, DEFAULT_NET_BATCH);
+    parseMatch(runcfg.net_batch_size, "net-batch-size", loadstream, cmdline_opts.net_batch_size, DEFAULT_NET_BATCH_SIZE);
+    parseMatch(runcfg.tun_queues, "tun-queues", loadstream, cmdline_opts.tun_queues, DEFAULT_TUN_QUEUES);
+    parseMatch(runcfg.net_xdp, "net-xdp", loadstream, cmdline_opts.net_xdp, DEFAULT_NET_XDP);
+    parseMatch(runcfg.xdp_zerocopy, "xdp-zerocopy", loadstream, cmdline_opts.xdp_zerocopy, DEFAULT_XDP_ZEROCOPY);
+    parseMatch(runcfg.xdp_queue, "xdp-queue", loadstream, cmdline_opts.xdp_queue, DEFAULT_XDP_QUEUE);
+    parseMatch(runcfg.io_uring, "io-uring", loadstream, cmdline_opts.io_uring, DEFAULT_IO_URING);
+    parseMatch(runcfg.tun_vnet_hdr, "tun-vnet-hdr", loadstream, cmdline_opts.tun_vnet_hdr, DEFAULT_TUN_VNET_HDR);
+    parseMatch(runcfg.net_csum_offload, "net-csum-offload", loadstream, cmdline_opts.net_csum_offload, DEFAULT_NET_CSUM_OFFLOAD);
+    parseMatch(runcfg.net_filter_proto, "net-filter-proto", loadstream, cmdline_opts.net_filter_proto, DEFAULT_NET_FILTER_PROTO);
+    parseMatch(runcfg.selective_route, "selective-route", loadstream, cmdline_opts.selective_route, DEFAULT_SELECTIVE_ROUTE);
+    parseMatch(runcfg.net_selective_in, "net-selective-in", loadstream, cmdline_opts.net_selective_in, DEFAULT_NET_SELECTIVE_IN);
+    parseMatch(runcfg.packet_hugepages, "packet-hugepages", loadstream, cmdline_opts.packet_hugepages, DEFAULT_PACKET_HUGEPAGES);
 
     /* loading of IP lists, in future also the source IP address should be useful */
     if (runcfg.use_blacklist)
@@ -564,6 +641,22 @@ bool UserConf::syncDiskConfiguration(void)
     written += dumpIfPresent(out, "foreground", runcfg.go_foreground, DEFAULT_GO_FOREGROUND);
     written += dumpIfPresent(out, "debug", runcfg.debug_level, DEFAULT_DEBUG_LEVEL);
     written += dumpIfPresent(out, "max-ttl-probe", runcfg.max_ttl_probe, DEFAULT_MAX_TTLPROBE);
+    written += dumpIfPresent(out, "net-mmap", runcfg.net_mmap, DEFAULT_NET_MMAP);
+    written += dumpIfPresent(out, "mmap-ring-blocks", runcfg.mmap_ring_blocks, DEFAULT_MMAP_RING_BLOCKS);
+    written += dumpIfPresent(out, "mmap-block-kb", runcfg.mmap_block_kb, DEFAULT_MMAP_BLOCK_KB);
+    written += dumpIfPresent(out, "net-batch", runcfg.net_batch, DEFAULT_NET_BATCH);
+    written += dumpIfPresent(out, "net-batch-size", runcfg.net_batch_size, DEFAULT_NET_BATCH_SIZE);
+    written += dumpIfPresent(out, "tun-queues", runcfg.tun_queues, DEFAULT_TUN_QUEUES);
+    written += dumpIfPresent(out, "net-xdp", runcfg.net_xdp, DEFAULT_NET_XDP);
+    written += dumpIfPresent(out, "xdp-zerocopy", runcfg.xdp_zerocopy, DEFAULT_XDP_ZEROCOPY);
+    written += dumpIfPresent(out, "xdp-queue", runcfg.xdp_queue, DEFAULT_XDP_QUEUE);
+    written += dumpIfPresent(out, "io-uring", runcfg.io_uring, DEFAULT_IO_URING);
+    written += dumpIfPresent(out, "tun-vnet-hdr", runcfg.tun_vnet_hdr, DEFAULT_TUN_VNET_HDR);
+    written += dumpIfPresent(out, "net-csum-offload", runcfg.net_csum_offload, DEFAULT_NET_CSUM_OFFLOAD);
+    written += dumpIfPresent(out, "net-filter-proto", runcfg.net_filter_proto, DEFAULT_NET_FILTER_PROTO);
+    written += dumpIfPresent(out, "selective-route", runcfg.selective_route, DEFAULT_SELECTIVE_ROUTE);
+    written += dumpIfPresent(out, "net-selective-in", runcfg.net_selective_in, DEFAULT_NET_SELECTIVE_IN);
+    written += dumpIfPresent(out, "packet-hugepages", runcfg.packet_hugepages, DEFAULT_PACKET_HUGEPAGES);
 
     if (!syncPortsFiles() || !syncIPListsFiles())
     {
@@ -57,9 +57,28 @@ struct sj_cmdline_opts
     char onlyplugin[MEDIUMBUF];
     uint16_t max_ttl_probe;
     char gw_mac_str[SMALLBUF];
+    bool net_mmap;
+    uint16_t mmap_ring_blocks;
+    uint16_t mmap_block_kb;
+    bool net_batch;
+    uint16_t net_batch_size;
+    uint16_t tun_queues;
+    bool net_xdp;
+    bool xdp_zerocopy;
+    uint16_t xdp_queue;
+    bool io_uring;
+    bool tun_vnet_hdr;
+    bool net_csum_offload;
+    bool net_filter_proto;
+    bool selective_route;
+    bool net_selective_in;
+    bool packet_hugepages;
     /* END OF COMMON PART WITH sj_config THAT WILL BE SAVED IN CONF FILE */
 
     bool force_restart;
+
+    /* --replay: prefix of the capture files used in place of the network */
+    char replay[MEDIUMBUF];
 };
 
 /* this is the struct keeping the sniffjoke variables, is loaded
@@ -91,6 +110,22 @@ struct sj_config
     char onlyplugin[MEDIUMBUF];
     uint16_t max_ttl_probe;
     char gw_mac_str[SMALLBUF];
+    bool net_mmap;
+    uint16_t mmap_ring_blocks;
+    uint16_t mmap_block_kb;
+    bool net_batch;
+    uint16_t net_batch_size;
+    uint16_t tun_queues;
+    bool net_xdp;
+    bool xdp_zerocopy;
+    uint16_t xdp_queue;
+    bool io_uring;
+    bool tun_vnet_hdr;
+    bool net_csum_offload;
+    bool net_filter_proto;
+    bool selective_route;
+    bool net_selective_in;
+    bool packet_hugepages;
     /* END OF COMMON PART WITH sj_cmdline_opts THAT WILL BE SAVED IN CONF FILE */
 
     /* mangling policies */
@@ -108,6 +143,14 @@ struct sj_config
     uint16_t net_iface_mtu;
     uint16_t tun_iface_mtu;
 
+    /* a loaded plugin implements mangleIncoming, known after the plugins loading */
+    bool plugins_incoming;
+
+    /* the tun queue served by this process, set after the workers are forked */
+    uint16_t tun_queue;
+
+    /* --replay prefix, taken only from the command line */
+    char replay[MEDIUMBUF];
 };
 
 class UserConf
@@ -83,6 +83,9 @@ bool random_percent(int32_t percent);
 /* #define RUNTIME_EXCEPTION(...) throw runtime_exception(__func__, __FILE__, __LINE__, __VA_ARGS__) */
 #define RUNTIME_EXCEPTION(...) throw runtime_exception(__func__, __VA_ARGS__)
 
+/* the compile time assertion of C++98: an array of negative size when cond is false */
+#define COMPILE_ASSERT(cond, name) typedef char compile_assert_##name[(cond) ? 1 : -1]
+
 /* 
  * this struct is the SniffJoke executing environment, it contains pointer to 
  * the main singleton instanced classess, and an sjEnviron is used for share
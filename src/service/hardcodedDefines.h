@@ -53,6 +53,22 @@
 #define DEFAULT_DEBUG_LEVEL     2
 #define DEFAULT_MAX_TTLPROBE    35
 #define DEFAULT_GW_MAC_ADDR     ""
+#define DEFAULT_NET_MMAP        false
+#define DEFAULT_MMAP_RING_BLOCKS 64     /* blocks per PACKET_MMAP ring */
+#define DEFAULT_MMAP_BLOCK_KB   64      /* size of a single ring block, in KB */
+#define DEFAULT_NET_BATCH       false
+#define DEFAULT_NET_BATCH_SIZE  32      /* frames per recvmmsg/sendmmsg call */
+#define DEFAULT_TUN_QUEUES      1       /* >1 enables IFF_MULTI_QUEUE, one worker per queue */
+#define DEFAULT_NET_XDP         false
+#define DEFAULT_XDP_ZEROCOPY    false
+#define DEFAULT_XDP_QUEUE       0       /* nic rx queue bound to the AF_XDP socket */
+#define DEFAULT_IO_URING        false
+#define DEFAULT_TUN_VNET_HDR    false
+#define DEFAULT_NET_CSUM_OFFLOAD false
+#define DEFAULT_NET_FILTER_PROTO false
+#define DEFAULT_SELECTIVE_ROUTE false
+#define DEFAULT_NET_SELECTIVE_IN false
+#define DEFAULT_PACKET_HUGEPAGES false
 
 /* this is not configurabile anyway in some (wrong) local network the
  * class 1.0.0.0/8 is used and should be require change this puppet-IP */
@@ -74,6 +90,12 @@
 #define IPTCPOPT_TEST_PLUGIN    "HDRoptions_probe"
 #define GENERIC_MARKER_FILE     "THIS_IS_GENERIC"
 
+/* --replay <prefix>: the traces are <prefix> followed by these suffixes */
+#define PCAP_TUN_IN             ".tun.pcap"
+#define PCAP_NET_IN             ".net.pcap"
+#define PCAP_TUN_OUT            ".tun.out.pcap"
+#define PCAP_NET_OUT            ".net.out.pcap"
+
 #define SMALLBUF                64
 #define MEDIUMBUF               256
 #define LARGEBUF                1024
@@ -112,6 +134,22 @@
  */
 #define NET_IF_MTU              1492
 #define TUN_IF_MTU_DIFF         80
+#define TUN_MAX_QUEUES          256     /* MAX_TAP_QUEUES in the kernel */
+
+/* --selective-route: routing table with the tun as default route, and the priority of the first rule */
+#define SELECTIVE_ROUTE_TABLE   1198
+#define SELECTIVE_ROUTE_PRIO    10000
+#define SELECTIVE_ROUTE_MAXPORTRULES 128    /* over this number of tcp port ranges, all the tcp is routed to the tun */
+#define SELECTIVE_IN_MAXPORTRANGES 100      /* over this number, --net-selective-in intercepts all the incoming tcp */
+#define ROOT_CMD_INCOMING       "plugins-incoming"  /* internal command: some plugin mangles the incoming packets */
+
+/* the packet pool of every process: a slot keeps an MTU sized packet and its headroom */
+#define CACHELINE_SIZE          64
+#define PACKETPOOL_SLOTS        4096
+#define PACKETPOOL_HEADROOM     128     /* at least MAXIPOPTIONS + MAXTCPOPTIONS, see PacketBuffer */
+#define PACKETPOOL_ALIGN        CACHELINE_SIZE  /* of the slots and of the Packet objects */
+#define PACKETPOOL_OBJBLOCK     256     /* Packet objects allocated together when the free list is empty */
+#define PACKETPOOL_HUGEPAGE     (2 * 1024 * 1024)
 
 #define PORTSNUMBER             65536
 
@@ -188,6 +226,15 @@
 #define SUPPORTED_OPTIONS           (LAST_TCPOPT + 1)
 
 #define NETIOBURSTSIZE                          10      /* 10 CYCLES OF I/O (10 in + 10 out pkts max) */
+#define NETIO_OUTRING_SIZE                      1024    /* packets waiting for a writable fd, in every direction */
+#define NETMMAP_RETIRE_TIMEOUT                  1       /* ms after which a partially filled rx block is handed to us */
+#define XDP_UMEM_FRAME_SIZE                     4096    /* one UMEM chunk for every frame */
+#define XDP_UMEM_FRAME_NR                       4096    /* half for the fill ring, half for tx */
+#define XDP_RING_SIZE                           2048    /* entries of the fill/completion/rx/tx rings */
+#define URING_ENTRIES                           256     /* io_uring submission queue entries */
+#define URING_BUFFERS                           256     /* buffers in every provided buffer ring */
+#define PCAP_BURST_USEC                         10000   /* capture time handled by a single replay cycle (10ms) */
+#define PCAP_DRAIN_TIMEOUT                      60      /* virtual seconds given to the queues after the end of the traces */
 #define SESSIONTRACKMAP_MANAGE_ROUTINE_TIMER    300     /* (5 MINUTES */
 #define TTLFOCUSMAP_MANAGE_ROUTINE_TIMER        3600    /* (1 HOUR) */
 #define SESSIONTRACK_EXPIRYTIME                 200     /* access expire time in seconds (5 MINUTES) */
@@ -197,6 +244,13 @@
 #define TTLFOCUSMAP_MEMORY_THRESHOLD            1024    /* 1024 DESTINATIONS */
 #define SESSIONTRACKMAP_MEMORY_THRESHOLD        1024    /* 1024 TCP SESSIONS */
 #define TTLPROBE_RETRY_ON_UNKNOWN               600     /* schedule time on UNKNOWN TTL status (10 MINUTES) */
+#define TTLPROBE_PORT_MIN                       1024    /* range of the puppet ports used by the ttl probes */
+#define TTLPROBE_PORT_MAX                       32767
+#define TTLPROBE_SEQ_MAX                        512     /* rand_key + sent_probe: a probe seq is always under it */
+
+/* --tun-queues: a message on the worker sockets starting with this byte relays a ttl probe reply, see SniffJoke */
+#define WORKER_RELAY_TAG                        0x01
+#define WORKER_RELAY_HDRLEN                     4       /* tag, padding, uint16_t queue owning the probe */
 
 /* enable the intensive debug: DEVELOPERS AND TESTER ONLY! */
 #if 0
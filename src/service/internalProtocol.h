@@ -68,6 +68,19 @@ struct command_ret
 #define STAT_WHITELIST      19
 #define STAT_BLACKLIST      20
 #define STAT_ONLYP          21
+#define STAT_POOL_SLOTS     22
+#define STAT_POOL_SLOTSIZE  23
+#define STAT_POOL_HUGEPAGES 24
+#define STAT_POOL_USED      25
+#define STAT_POOL_PEAK      26
+#define STAT_POOL_HEAP      27
+#define STAT_POOL_PKTS      28
+#define STAT_POOL_PKTSPEAK  29
+#define STAT_REJ_IPHDR      30
+#define STAT_REJ_TCPHDR     31
+#define STAT_REJ_UDPHDR     32
+#define STAT_REJ_ICMPHDR    33
+#define STAT_REJ_GSO        34
 
 /* and in SJStatus are used this struct for describe the single block */
 struct single_block
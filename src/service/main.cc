@@ -59,6 +59,24 @@ static void sj_version(const char *pname)
     " --admin <ip>[:port]\tspecify administration IP address [default: %s:%d]\n"\
     " --force\t\tforce restart (usable when another sniffjoke service is running)\n"\
     " --gw-mac-addr\t\tspecify default gateway mac address [default: is autodetected]\n"\
+    " --net-mmap\t\tuse PACKET_MMAP rx/tx rings on the network side [default: %s]\n"\
+    " --mmap-ring-blocks <n>\tnumber of blocks in every mmap ring [default: %d]\n"\
+    " --mmap-block-kb <n>\tsize of a single mmap ring block in KB [default: %d]\n"\
+    " --net-batch\t\tuse recvmmsg/sendmmsg batches on the network side [default: %s]\n"\
+    " --net-batch-size <n>\tmax frames received or sent by a single batch [default: %d]\n"\
+    " --tun-queues <n>\tmulti-queue tun device, served by a worker per queue [default: %d]\n"\
+    " --net-xdp\t\tuse an AF_XDP socket on the network side [default: %s]\n"\
+    " --xdp-zerocopy\t\tbind the AF_XDP socket in zero-copy driver mode [default: %s]\n"\
+    " --xdp-queue <n>\tnic rx queue served by the AF_XDP socket [default: %d]\n"\
+    " --io-uring\t\tuse an io_uring engine for the tunnel and network I/O [default: %s]\n"\
+    " --tun-vnet-hdr\t\taccept TSO super-packets from the tun device [default: %s]\n"\
+    " --net-csum-offload\tleave the valid tcp/udp checksums to the nic [default: %s]\n"\
+    " --net-filter-proto\tcopy from the network only the protocols to mangle [default: %s]\n"\
+    " --selective-route\troute to the tun only the hackable destinations [default: %s]\n"\
+    " --net-selective-in\tcopy from the network only the packets sniffjoke needs [default: %s]\n"\
+    " --packet-hugepages\tback the packet pool with hugepages [default: %s]\n"\
+    " --replay <prefix>\treplay <prefix>.tun.pcap and <prefix>.net.pcap in place of the\n"\
+    "\t\t\tnetwork, writing <prefix>.tun.out.pcap and <prefix>.net.out.pcap\n"\
     " --version\t\tshow sniffjoke version\n"\
     " --help\t\t\tshow this help\n\n"\
     "\t\t\thttp://www.delirandom.net/sniffjoke\n"
@@ -76,19 +94,26 @@ static void sj_help(const char *pname)
            DEFAULT_CHAINING ? "enabled" : "disabled",
            SUPPRESS_LEVEL, PACKET_LEVEL, DEFAULT_DEBUG_LEVEL,
            SUPPRESS_LEVEL, ALL_LEVEL, VERBOSE_LEVEL, DEBUG_LEVEL, SESSION_LEVEL, PACKET_LEVEL,
-           DEFAULT_ADMIN_ADDRESS, DEFAULT_ADMIN_PORT
+           DEFAULT_ADMIN_ADDRESS, DEFAULT_ADMIN_PORT,
+           DEFAULT_NET_MMAP ? "enabled" : "disabled",
+           DEFAULT_MMAP_RING_BLOCKS, DEFAULT_MMAP_BLOCK_KB,
+           DEFAULT_NET_BATCH ? "enabled" : "disabled", DEFAULT_NET_BATCH_SIZE,
+           DEFAULT_TUN_QUEUES,
+           DEFAULT_NET_XDP ? "enabled" : "disabled",
+           DEFAULT_XDP_ZEROCOPY ? "enabled" : "disabled",
+           DEFAULT_XDP_QUEUE,
+           DEFAULT_IO_URING ? "enabled" : "disabled",
+           DEFAULT_TUN_VNET_HDR ? "enabled" : "disabled",
+           DEFAULT_NET_CSUM_OFFLOAD ? "enabled" : "disabled",
+           DEFAULT_NET_FILTER_PROTO ? "enabled" : "disabled",
+           DEFAULT_SELECTIVE_ROUTE ? "enabled" : "disabled",
+           DEFAULT_NET_SELECTIVE_IN ? "enabled" : "disabled",
+           DEFAULT_PACKET_HUGEPAGES ? "enabled" : "disabled"
            );
 }
 
 int main(int argc, char **argv)
 {
-
-    if (getuid() || geteuid())
-    {
-        printf("SniffJoke is too dangerous to be run by an humble user; go to fetch daddy root, now!\n");
-        exit(1);
-    }
-
     /*
      * set the default values in the configuration struct
      */
@@ -106,6 +131,22 @@ int main(int argc, char **argv)
     useropt.go_foreground = DEFAULT_GO_FOREGROUND;
     useropt.debug_level = DEFAULT_DEBUG_LEVEL;
     useropt.max_ttl_probe = DEFAULT_MAX_TTLPROBE;
+    useropt.net_mmap = DEFAULT_NET_MMAP;
+    useropt.mmap_ring_blocks = DEFAULT_MMAP_RING_BLOCKS;
+    useropt.mmap_block_kb = DEFAULT_MMAP_BLOCK_KB;
+    useropt.net_batch = DEFAULT_NET_BATCH;
+    useropt.net_batch_size = DEFAULT_NET_BATCH_SIZE;
+    useropt.tun_queues = DEFAULT_TUN_QUEUES;
+    useropt.net_xdp = DEFAULT_NET_XDP;
+    useropt.xdp_zerocopy = DEFAULT_XDP_ZEROCOPY;
+    useropt.xdp_queue = DEFAULT_XDP_QUEUE;
+    useropt.io_uring = DEFAULT_IO_URING;
+    useropt.tun_vnet_hdr = DEFAULT_TUN_VNET_HDR;
+    useropt.net_csum_offload = DEFAULT_NET_CSUM_OFFLOAD;
+    useropt.net_filter_proto = DEFAULT_NET_FILTER_PROTO;
+    useropt.selective_route = DEFAULT_SELECTIVE_ROUTE;
+    useropt.net_selective_in = DEFAULT_NET_SELECTIVE_IN;
+    useropt.packet_hugepages = DEFAULT_PACKET_HUGEPAGES;
     useropt.force_restart = false;
 
     /*
@@ -131,6 +172,23 @@ int main(int argc, char **argv)
         { "only-plugin", required_argument, NULL, 'p'}, /* not documented in --help */
         { "max-ttl-probe", required_argument, NULL, 'm'}, /* not documented too */
         { "gw-mac-addr", required_argument, NULL, 'e'},
+        { "net-mmap", no_argument, NULL, 'n'},
+        { "mmap-ring-blocks", required_argument, NULL, 'k'},
+        { "mmap-block-kb", required_argument, NULL, 'z'},
+        { "net-batch", no_argument, NULL, 'j'},
+        { "net-batch-size", required_argument, NULL, 'q'},
+        { "tun-queues", required_argument, NULL, 'y'},
+        { "net-xdp", no_argument, NULL, 'X'},
+        { "xdp-zerocopy", no_argument, NULL, 'Z'},
+        { "xdp-queue", required_argument, NULL, 'Q'},
+        { "io-uring", no_argument, NULL, 'I'},
+        { "tun-vnet-hdr", no_argument, NULL, 'V'},
+        { "net-csum-offload", no_argument, NULL, 'C'},
+        { "net-filter-proto", no_argument, NULL, 'F'},
+        { "selective-route", no_argument, NULL, 'S'},
+        { "net-selective-in", no_argument, NULL, 'N'},
+        { "packet-hugepages", no_argument, NULL, 'H'},
+        { "replay", required_argument, NULL, 'R'},
         { "version", no_argument, NULL, 'v'},
         { "help", no_argument, NULL, 'h'},
         { NULL, 0, NULL, 0}
@@ -207,6 +265,57 @@ int main(int argc, char **argv)
         case 'm':
             useropt.max_ttl_probe = atoi(optarg);
             break;
+        case 'n':
+            useropt.net_mmap = true;
+            break;
+        case 'k':
+            useropt.mmap_ring_blocks = atoi(optarg);
+            break;
+        case 'z':
+            useropt.mmap_block_kb = atoi(optarg);
+            break;
+        case 'j':
+            useropt.net_batch = true;
+            break;
+        case 'q':
+            useropt.net_batch_size = atoi(optarg);
+            break;
+        case 'y':
+            useropt.tun_queues = atoi(optarg);
+            break;
+        case 'X':
+            useropt.net_xdp = true;
+            break;
+        case 'Z':
+            useropt.xdp_zerocopy = true;
+            break;
+        case 'Q':
+            useropt.xdp_queue = atoi(optarg);
+            break;
+        case 'I':
+            useropt.io_uring = true;
+            break;
+        case 'V':
+            useropt.tun_vnet_hdr = true;
+            break;
+        case 'C':
+            useropt.net_csum_offload = true;
+            break;
+        case 'F':
+            useropt.net_filter_proto = true;
+            break;
+        case 'S':
+            useropt.selective_route = true;
+            break;
+        case 'N':
+            useropt.net_selective_in = true;
+            break;
+        case 'H':
+            useropt.packet_hugepages = true;
+            break;
+        case 'R':
+            snprintf(useropt.replay, sizeof (useropt.replay), "%s", optarg);
+            break;
         case 'v':
             sj_version(argv[0]);
             return 0;
@@ -221,6 +330,13 @@ sniffjoke_help:
         }
     }
 
+    /* a replay touches only capture files */
+    if (!useropt.replay[0] && (getuid() || geteuid()))
+    {
+        printf("SniffJoke is too dangerous to be run by an humble user; go to fetch daddy root, now!\n");
+        exit(1);
+    }
+
     init_random();
 
     try
@@ -0,0 +1,92 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2010 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SJ_CHECKUTILS_H
+#define SJ_CHECKUTILS_H
+
+/*
+ * what the checks working on Packet have in common: the failure counter,
+ * and the received frames they start from.
+ */
+
+#include "Packet.h"
+
+#include <linux/if_ether.h>
+
+static uint32_t failures;
+
+#define CHECK(cond, ...) \
+    do { if (!(cond)) { ++failures; fprintf(stderr, "%s:%d ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); } } while (0)
+
+/*
+ * a tcp or udp frame with the basic headers, as it is read from the
+ * tunnel: the addresses, the ports, the numbers and the payload are
+ * random, the lengths and the checksums are right.
+ */
+static inline Packet *newFrame(uint8_t proto, uint16_t payloadlen)
+{
+    const uint16_t l4hdrlen = (proto == IPPROTO_TCP) ? sizeof (struct tcphdr) : sizeof (struct udphdr);
+    vector<unsigned char> buf(sizeof (struct iphdr) + l4hdrlen + payloadlen);
+
+    memset_random(&buf[0], buf.size());
+
+    struct iphdr * const ip = (struct iphdr *) &buf[0];
+    ip->ihl = sizeof (struct iphdr) / 4;
+    ip->version = 4;
+    ip->tot_len = htons(buf.size());
+    ip->frag_off = htons(IP_DF);
+    ip->ttl = 1 + random() % 255;
+    ip->protocol = proto;
+
+    if (proto == IPPROTO_TCP)
+    {
+        struct tcphdr * const tcp = (struct tcphdr *) &buf[sizeof (struct iphdr)];
+        tcp->doff = sizeof (struct tcphdr) / 4;
+        tcp->res1 = 0;
+        tcp->urg = 0;
+        tcp->urg_ptr = 0;
+    }
+    else
+    {
+        struct udphdr * const udp = (struct udphdr *) &buf[sizeof (struct iphdr)];
+        udp->len = htons(l4hdrlen + payloadlen);
+    }
+
+    Packet * const pkt = new Packet(&buf[0], buf.size());
+    pkt->fixSum();
+
+    return pkt;
+}
+
+static inline int checkResult(const char *name, const char *passed)
+{
+    if (failures)
+    {
+        fprintf(stderr, "%s: %u failures\n", name, failures);
+        return 1;
+    }
+
+    printf("%s: %s\n", name, passed);
+    return 0;
+}
+
+#endif /* SJ_CHECKUTILS_H */
@@ -0,0 +1,158 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2008 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * microbenchmark of the Checksum kernels on the packet sizes, from a bare
+ * 40 bytes TCP header to a full 1500 bytes frame: the nanoseconds per call
+ * of the old word by word Packet::computeHalfSum() loop and of every
+ * kernel available on this cpu, for halfSum() and copySum().
+ *
+ *     checksum-bench [iterations]
+ */
+
+#include "Checksum.h"
+
+time_t sj_clock;
+char sj_clock_str[MEDIUMBUF];
+Debug debug;
+
+#define DEFAULT_ITERATIONS      1000000
+
+typedef uint32_t(*sum_f)(const unsigned char *, uint32_t);
+typedef uint32_t(*copysum_f)(unsigned char *, const unsigned char *, uint32_t);
+
+struct kernel
+{
+    const char *name;
+    sum_f sum;
+    copysum_f copySum;
+};
+
+static const uint32_t sizes[] = {40, 52, 64, 128, 256, 512, 576, 1024, 1280, 1460, 1500};
+
+/* the results are accumulated here, the compiler can't drop the calls */
+static volatile uint32_t sink;
+
+/* Packet::computeHalfSum() before the kernels */
+static uint32_t referenceSum(const unsigned char *data, uint32_t len)
+{
+    const uint16_t *usdata = (const uint16_t *) data;
+    const uint16_t *end = (const uint16_t *) data + (len / sizeof (uint16_t));
+    uint32_t sum = 0;
+
+    while (usdata != end)
+        sum += *usdata++;
+
+    if (len % 2)
+        sum += *(const uint8_t *) usdata;
+
+    return sum;
+}
+
+static double elapsedNs(const struct timespec &start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start.tv_sec) * 1e9 + (now.tv_nsec - start.tv_nsec);
+}
+
+static double benchSum(sum_f sum, const unsigned char *data, uint32_t len, uint32_t iterations)
+{
+    struct timespec start;
+    uint32_t acc = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t i = 0; i < iterations; ++i)
+        acc += sum(data, len);
+
+    sink = acc;
+
+    return elapsedNs(start) / iterations;
+}
+
+static double benchCopySum(copysum_f copySum, unsigned char *dst, const unsigned char *src, uint32_t len, uint32_t iterations)
+{
+    struct timespec start;
+    uint32_t acc = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t i = 0; i < iterations; ++i)
+        acc += copySum(dst, src, len);
+
+    sink = acc;
+
+    return elapsedNs(start) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t iterations = (argc > 1) ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+    vector<struct kernel> kernels;
+    vector<unsigned char> src(2048), dst(2048);
+
+    struct kernel portable = {"portable", &Checksum::portableSum, &Checksum::portableCopySum};
+    kernels.push_back(portable);
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        struct kernel sse2 = {"sse2", &Checksum::sse2Sum, &Checksum::sse2CopySum};
+        kernels.push_back(sse2);
+    }
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        struct kernel avx2 = {"avx2", &Checksum::avx2Sum, &Checksum::avx2CopySum};
+        kernels.push_back(avx2);
+    }
+#endif
+
+    srandom(1);
+    for (uint32_t i = 0; i < src.size(); ++i)
+        src[i] = random();
+
+    printf("ns per call, %u iterations\n%6s %10s", iterations, "bytes", "reference");
+    for (uint32_t k = 0; k < kernels.size(); ++k)
+        printf(" %10s %10s", kernels[k].name, "+copy");
+    printf("\n");
+
+    for (uint32_t s = 0; s < sizeof (sizes) / sizeof (sizes[0]); ++s)
+    {
+        printf("%6u %10.1f", sizes[s], benchSum(&referenceSum, &src[0], sizes[s], iterations));
+
+        for (uint32_t k = 0; k < kernels.size(); ++k)
+        {
+            printf(" %10.1f", benchSum(kernels[k].sum, &src[0], sizes[s], iterations));
+            printf(" %10.1f", benchCopySum(kernels[k].copySum, &dst[0], &src[0], sizes[s], iterations));
+        }
+
+        printf("\n");
+    }
+
+    return 0;
+}
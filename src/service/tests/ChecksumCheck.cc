@@ -0,0 +1,169 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2008 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * bit-exact check of the Checksum kernels: every kernel available on this
+ * cpu is compared with the word by word sum of the old
+ * Packet::computeHalfSum(), on random buffers of every length up to
+ * EVERYLEN and of random lengths up to the uint16_t limit of the old
+ * routine, starting at every offset of a 32 bit word so that all the odd
+ * tails and the unaligned loads are covered. copySum() must give the same
+ * sum and a byte exact copy, without writing past the end.
+ */
+
+#include "Checksum.h"
+
+time_t sj_clock;
+char sj_clock_str[MEDIUMBUF];
+Debug debug;
+
+#define EVERYLEN        2048
+#define RANDOMLENS      4000
+#define MAXLEN          65535
+#define OFFSETS         4
+
+typedef uint32_t(*sum_f)(const unsigned char *, uint32_t);
+typedef uint32_t(*copysum_f)(unsigned char *, const unsigned char *, uint32_t);
+
+struct kernel
+{
+    const char *name;
+    sum_f sum;
+    copysum_f copySum;
+};
+
+/* Packet::computeHalfSum() before the kernels, reading the words with memcpy */
+static uint32_t referenceSum(const unsigned char *data, uint16_t len)
+{
+    uint32_t sum = 0;
+    uint16_t w;
+
+    for (; len >= sizeof (w); data += sizeof (w), len -= sizeof (w))
+    {
+        memcpy(&w, data, sizeof (w));
+        sum += w;
+    }
+
+    if (len)
+        sum += *data;
+
+    return sum;
+}
+
+static uint32_t fold16(uint32_t sum)
+{
+    while (sum >> 16)
+        sum = (sum >> 16) + (sum & 0xFFFF);
+
+    return sum;
+}
+
+static bool check(const struct kernel &k, const unsigned char *src, uint32_t len, unsigned char *dst)
+{
+    const uint32_t expected = fold16(referenceSum(src, len));
+    uint32_t sum;
+
+    if ((sum = k.sum(src, len)) != expected)
+    {
+        fprintf(stderr, "%s: halfSum of %u bytes at offset %u is %04x, expected %04x\n",
+                k.name, len, (uint32_t) ((uintptr_t) src % OFFSETS), sum, expected);
+        return false;
+    }
+
+    memset(dst, 0xAA, len + 1);
+
+    if ((sum = k.copySum(dst, src, len)) != expected)
+    {
+        fprintf(stderr, "%s: copySum of %u bytes at offset %u is %04x, expected %04x\n",
+                k.name, len, (uint32_t) ((uintptr_t) src % OFFSETS), sum, expected);
+        return false;
+    }
+
+    if (memcmp(dst, src, len) || dst[len] != 0xAA)
+    {
+        fprintf(stderr, "%s: copySum of %u bytes has not copied them exactly\n", k.name, len);
+        return false;
+    }
+
+    return true;
+}
+
+int main(void)
+{
+    vector<struct kernel> kernels;
+    vector<unsigned char> src(MAXLEN + OFFSETS), dst(MAXLEN + OFFSETS + 1);
+    uint32_t checked = 0;
+
+    struct kernel portable = {"portable", &Checksum::portableSum, &Checksum::portableCopySum};
+    kernels.push_back(portable);
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        struct kernel sse2 = {"sse2", &Checksum::sse2Sum, &Checksum::sse2CopySum};
+        kernels.push_back(sse2);
+    }
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        struct kernel avx2 = {"avx2", &Checksum::avx2Sum, &Checksum::avx2CopySum};
+        kernels.push_back(avx2);
+    }
+#endif
+
+    srandom(1);
+
+    for (uint32_t pass = 0; pass < 3; ++pass)
+    {
+        /* random bytes, then all ones (the most carries) and all zeros */
+        for (uint32_t i = 0; i < src.size(); ++i)
+            src[i] = (pass == 0) ? random() : (pass == 1) ? 0xFF : 0x00;
+
+        for (uint32_t n = 0; n <= EVERYLEN + RANDOMLENS; ++n)
+        {
+            const uint32_t len = (n <= EVERYLEN) ? n : (uint32_t) (random() % (MAXLEN + 1));
+
+            if (pass && n > EVERYLEN)
+                break;
+
+            for (uint32_t off = 0; off < OFFSETS; ++off)
+            {
+                for (uint32_t k = 0; k < kernels.size(); ++k)
+                {
+                    if (!check(kernels[k], &src[off], len, &dst[off]))
+                        return 1;
+                }
+
+                ++checked;
+            }
+        }
+    }
+
+    printf("checksum-check: %u buffers matched the reference with", checked);
+    for (uint32_t k = 0; k < kernels.size(); ++k)
+        printf(" %s", kernels[k].name);
+    printf("\n");
+
+    return 0;
+}
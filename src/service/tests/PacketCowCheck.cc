@@ -0,0 +1,203 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2010 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * check of the copy-on-write clones, Packet(const Packet &, CLONE_COW): a
+ * segmentation made of clones copies every byte of the payload once, a
+ * clone unshared as TCPTrack does is a packet of its own, and the
+ * references to the shared memory are dropped with the packets, in any
+ * order, from the arena slots and from the heap.
+ */
+
+#include "CheckUtils.h"
+
+/* the signal handler of the service, defined in main.cc */
+void sigtrap(int)
+{
+}
+
+#define CLONES          5
+#define SLOT_PAYLOAD    1000    /* the frame fits in a slot of the arena */
+#define HEAP_PAYLOAD    3000    /* the frame is bigger than a slot, it is on the heap */
+
+static bool samePayload(const Packet &pkt, const unsigned char *data, uint16_t len)
+{
+    return pkt.tcppayloadlen == len && ntohs(pkt.ip->tot_len) == pkt.pbuf.size()
+            && !memcmp(pkt.tcppayload, data, len);
+}
+
+static uint32_t copiedSince(uint64_t copied)
+{
+    return PacketPool::get().clone_copied - copied;
+}
+
+/*
+ * a clone copies only the headers when it is created: a change of the
+ * original payload, made here before the clone is unshared against the
+ * rule, is still seen by the clone.
+ */
+static void checkLazyCopy(uint16_t payloadlen)
+{
+    Packet * const orig = newFrame(IPPROTO_TCP, payloadlen);
+    const uint64_t copied = PacketPool::get().clone_copied;
+    Packet * const clone = new Packet(*orig, CLONE_COW);
+    const vector<unsigned char> changed(payloadlen, 0xEE);
+
+    CHECK(copiedSince(copied) == (uint32_t) orig->iphdrlen + orig->tcphdrlen,
+          "the clone of %u bytes of payload copied %u bytes", payloadlen, copiedSince(copied));
+
+    memset(orig->tcppayload, 0xEE, payloadlen);
+    clone->pbuf.unshare();
+
+    CHECK(samePayload(*clone, &changed[0], payloadlen), "the clone copied the payload of %u bytes when created", payloadlen);
+
+    delete clone;
+    delete orig;
+}
+
+/* the clones keep the headers of the original, each one replaces the payload with its slice */
+static void checkSegmentation(uint16_t payloadlen)
+{
+    Packet * const orig = newFrame(IPPROTO_TCP, payloadlen);
+    const vector<unsigned char> payload(orig->tcppayload, orig->tcppayload + payloadlen);
+    const uint16_t slice = payloadlen / CLONES;
+    const uint64_t copied = PacketPool::get().clone_copied;
+    Packet *segs[CLONES];
+
+    for (uint32_t i = 0; i < CLONES; ++i)
+    {
+        segs[i] = new Packet(*orig, CLONE_COW);
+        segs[i]->tcppayloadSet(&orig->tcppayload[i * slice], slice);
+        segs[i]->setSeq(htonl(ntohl(orig->tcp->seq) + i * slice));
+    }
+
+    /* the slices are copied by tcppayloadSet(): the clones copy only the headers */
+    CHECK(copiedSince(copied) == CLONES * ((uint32_t) orig->iphdrlen + orig->tcphdrlen),
+          "the segmentation of %u bytes copied %u bytes beside the slices", payloadlen, copiedSince(copied));
+
+    delete orig;
+
+    for (uint32_t i = 0; i < CLONES; ++i)
+    {
+        CHECK(samePayload(*segs[i], &payload[i * slice], slice), "the segment %u has not its slice of %u bytes", i, payloadlen);
+        delete segs[i];
+    }
+}
+
+/* the last clone is a clone of a clone: it shares the memory of the original too */
+static void cloneAll(Packet *orig, Packet **clones)
+{
+    for (uint32_t i = 0; i < CLONES - 1; ++i)
+        clones[i] = new Packet(*orig, CLONE_COW);
+
+    clones[CLONES - 1] = new Packet(*clones[0], CLONE_COW);
+}
+
+static void checkWriteIsolation(uint16_t payloadlen)
+{
+    Packet * const orig = newFrame(IPPROTO_TCP, payloadlen);
+    const vector<unsigned char> payload(orig->tcppayload, orig->tcppayload + payloadlen);
+    Packet *clones[CLONES];
+
+    cloneAll(orig, clones);
+
+    const uint64_t copied = PacketPool::get().clone_copied;
+
+    for (uint32_t i = 0; i < CLONES; ++i)
+        clones[i]->pbuf.unshare();
+
+    CHECK(copiedSince(copied) == (uint32_t) CLONES * payloadlen,
+          "unsharing %u clones of %u bytes copied %u bytes", CLONES, payloadlen, copiedSince(copied));
+
+    for (uint32_t i = 0; i < CLONES; ++i)
+    {
+        CHECK(samePayload(*clones[i], &payload[0], payloadlen), "the clone %u of %u bytes differs from the original", i, payloadlen);
+
+        memset(clones[i]->tcppayload, i + 1, payloadlen);
+        clones[i]->setSeq(htonl(i + 1));
+    }
+
+    for (uint32_t i = 0; i < CLONES; ++i)
+    {
+        vector<unsigned char> mine(payloadlen, i + 1);
+
+        CHECK(samePayload(*clones[i], &mine[0], payloadlen) && clones[i]->tcp->seq == htonl(i + 1),
+              "the clone %u of %u bytes has been changed by the writes to the others", i, payloadlen);
+    }
+
+    CHECK(samePayload(*orig, &payload[0], payloadlen), "the original of %u bytes has been changed by the clones", payloadlen);
+
+    for (uint32_t i = 0; i < CLONES; ++i)
+        delete clones[i];
+
+    delete orig;
+}
+
+/* the shared memory outlives the original, until the clones leave it */
+static void checkOriginalFirst(uint16_t payloadlen)
+{
+    Packet * const orig = newFrame(IPPROTO_TCP, payloadlen);
+    const vector<unsigned char> payload(orig->tcppayload, orig->tcppayload + payloadlen);
+    Packet *clones[CLONES];
+
+    cloneAll(orig, clones);
+
+    delete orig;
+
+    /* half of them is deleted still sharing */
+    for (uint32_t i = 0; i < CLONES; ++i)
+    {
+        if (i % 2)
+        {
+            clones[i]->pbuf.unshare();
+            CHECK(samePayload(*clones[i], &payload[0], payloadlen),
+                  "the clone %u of %u bytes lost the payload of the deleted original", i, payloadlen);
+        }
+
+        delete clones[i];
+    }
+}
+
+int main(void)
+{
+    /* the pool is sized on the mtu when it is first used */
+    Packet::netMTU = ETH_DATA_LEN;
+    srandom(1);
+
+    const PacketPool &pool = PacketPool::get();
+
+    const uint16_t sizes[] = {SLOT_PAYLOAD, HEAP_PAYLOAD};
+
+    for (uint32_t s = 0; s < sizeof (sizes) / sizeof (sizes[0]); ++s)
+    {
+        checkLazyCopy(sizes[s]);
+        checkSegmentation(sizes[s]);
+        checkWriteIsolation(sizes[s]);
+        checkOriginalFirst(sizes[s]);
+    }
+
+    CHECK(pool.slots_used == 0, "%u slots of the arena are still used", pool.slots_used);
+    CHECK(pool.heap_used == 0, "%u heap buffers are still used", pool.heap_used);
+    CHECK(pool.objects_used == 0, "%u Packet objects are still used", pool.objects_used);
+
+    return checkResult("packetcow-check", "the copy-on-write clones share and copy as expected");
+}
@@ -0,0 +1,128 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2010, 2011 vecna <vecna@delirandom.net>
+ *                            evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * microbenchmark of the queue traversals on the Packet layout: the walk of
+ * TCPTrack over a KEEP queue with getSource(TUNNEL), reading the fields of
+ * the hot line used by the stages. the queues are walked in allocation
+ * order and shuffled, from a size fitting in the cache to one well out of
+ * it. it uses only the public fields, so the same file built on a tree
+ * before the hot/cold split of Packet gives the numbers to compare.
+ *
+ *     packetlayout-bench [visits]
+ */
+
+#include "PacketQueue.h"
+
+/* the signal handler of the service, defined in main.cc */
+void sigtrap(int)
+{
+}
+
+#define DEFAULT_VISITS  (1 << 23)
+
+static const uint32_t sizes[] = {1024, 8192, 32768, 262144};
+
+/* the results are accumulated here, the compiler can't drop the reads */
+static volatile uint32_t sink;
+
+static double nowNs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/* one packet every eight is a PLUGIN one, skipped by getSource(TUNNEL) */
+static void fill(PacketQueue &q, uint32_t packets, bool shuffled)
+{
+    unsigned char buf[40] = {0x45, 0x00, 0x00, 40};
+    buf[8] = 64;
+    buf[9] = IPPROTO_TCP;
+    buf[32] = 5 << 4;
+
+    vector<Packet *> pkts;
+
+    for (uint32_t i = 0; i < packets; ++i)
+    {
+        Packet * const pkt = new Packet(buf, sizeof (buf));
+        pkt->source = (i % 8) ? TUNNEL : PLUGIN;
+        pkts.push_back(pkt);
+    }
+
+    if (shuffled)
+        random_shuffle(pkts.begin(), pkts.end());
+
+    for (uint32_t i = 0; i < packets; ++i)
+        q.insert(*pkts[i], KEEP);
+}
+
+/* returns the ns per visited packet, after a first walk warming the caches */
+static double walk(PacketQueue &q, uint32_t packets, uint32_t visits)
+{
+    const uint32_t rounds = (visits / packets) ? visits / packets : 1;
+    uint32_t acc = 0;
+    Packet *pkt;
+    double start = 0;
+
+    for (uint32_t r = 0; r <= rounds; ++r)
+    {
+        if (r == 1)
+            start = nowNs();
+
+        for (q.select(KEEP); (pkt = q.getSource(TUNNEL)) != NULL;)
+            acc += pkt->proto + pkt->wtf + pkt->choosableScramble + pkt->tcppayloadlen + pkt->fragment;
+    }
+
+    sink = acc;
+
+    return (nowNs() - start) / ((double) rounds * packets);
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t visits = (argc > 1) ? atoi(argv[1]) : DEFAULT_VISITS;
+
+    srand(1);
+
+    printf("ns per packet, sizeof(Packet) %u, %u visits\n", (uint32_t) sizeof (Packet), visits);
+    printf("%8s %10s %10s\n", "packets", "allocation", "shuffled");
+
+    for (uint32_t s = 0; s < sizeof (sizes) / sizeof (sizes[0]); ++s)
+    {
+        printf("%8u", sizes[s]);
+
+        for (uint32_t shuffled = 0; shuffled < 2; ++shuffled)
+        {
+            PacketQueue q;
+
+            fill(q, sizes[s], shuffled);
+            printf(" %10.1f", walk(q, sizes[s], visits));
+        }
+
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2010 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * microbenchmark of TCPTrack::readpacket() on a SEND queue of mixed
+ * directions, 10000 packets by default: the front of the lane, taken by
+ * PacketQueue::frontSEND(), against the scan of SEND for the first packet
+ * of the direction, as readpacket() did before the lanes. both directions
+ * are drained, one after the other, in the two orders.
+ *
+ *     packetqueue-bench [packets]
+ */
+
+#include "PacketQueue.h"
+
+/* the signal handler of the service, defined in main.cc */
+void sigtrap(int)
+{
+}
+
+#define DEFAULT_PACKETS 10000
+
+/* the readpacket() before the lanes */
+static Packet *scanSEND(PacketQueue &q, source_t destsource)
+{
+    const uint8_t mask = (destsource == NETWORK) ? NETWORK : TUNNEL | PLUGIN | TRACEROUTE;
+    Packet *pkt;
+
+    for (q.select(SEND); (pkt = q.get()) != NULL;)
+    {
+        if (pkt->source & mask)
+        {
+            q.extract(*pkt);
+            return pkt;
+        }
+    }
+
+    return NULL;
+}
+
+static Packet *frontSEND(PacketQueue &q, source_t destsource)
+{
+    Packet * const pkt = q.frontSEND(destsource);
+
+    if (pkt != NULL)
+        q.extract(*pkt);
+
+    return pkt;
+}
+
+static double nowNs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void fill(PacketQueue &q, uint32_t packets)
+{
+    /* a bare 40 bytes TCP packet */
+    unsigned char buf[40] = {0x45, 0x00, 0x00, 40};
+    buf[8] = 64;
+    buf[9] = IPPROTO_TCP;
+    buf[32] = 5 << 4;
+
+    static const source_t sources[] = {TUNNEL, NETWORK, PLUGIN, NETWORK, TRACEROUTE, NETWORK};
+
+    for (uint32_t i = 0; i < packets; ++i)
+    {
+        Packet * const pkt = new Packet(buf, sizeof (buf));
+        pkt->source = sources[i % (sizeof (sources) / sizeof (sources[0]))];
+        q.insert(*pkt, SEND);
+    }
+}
+
+/* drains first and then second, returns the ns per packet */
+static double drain(Packet * (*read)(PacketQueue &, source_t), uint32_t packets, source_t first, source_t second)
+{
+    PacketQueue q;
+    Packet *pkt;
+    uint32_t drained = 0;
+
+    fill(q, packets);
+
+    const double start = nowNs();
+
+    while ((pkt = read(q, first)) != NULL)
+    {
+        delete pkt;
+        ++drained;
+    }
+
+    while ((pkt = read(q, second)) != NULL)
+    {
+        delete pkt;
+        ++drained;
+    }
+
+    const double elapsed = nowNs() - start;
+
+    if (drained != packets)
+        fprintf(stderr, "drained %u packets of %u\n", drained, packets);
+
+    return elapsed / packets;
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t packets = (argc > 1) ? atoi(argv[1]) : DEFAULT_PACKETS;
+
+    printf("ns per packet, %u packets in SEND\n", packets);
+    printf("%-28s %10s %10s\n", "drain order", "scan", "lanes");
+    printf("%-28s %10.1f %10.1f\n", "to the tunnel, then network",
+           drain(&scanSEND, packets, NETWORK, TUNNEL), drain(&frontSEND, packets, NETWORK, TUNNEL));
+    printf("%-28s %10.1f %10.1f\n", "to the network, then tunnel",
+           drain(&scanSEND, packets, TUNNEL, NETWORK), drain(&frontSEND, packets, TUNNEL, NETWORK));
+
+    return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2010 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * order check of the PacketQueue lanes: SEND is kept in a lane for every
+ * direction, and every lane must stay in insertion order through the
+ * operations of TCPTrack. the packets are told apart by SjPacketId, that
+ * grows with the creation.
+ */
+
+#include "PacketQueue.h"
+#include "CheckUtils.h"
+
+/* the signal handler of the service, defined in main.cc */
+void sigtrap(int)
+{
+}
+
+static Packet *newPacket(source_t source)
+{
+    /* a bare 40 bytes TCP packet */
+    unsigned char buf[40] = {0x45, 0x00, 0x00, 40};
+    buf[8] = 64;
+    buf[9] = IPPROTO_TCP;
+    buf[32] = 5 << 4;
+
+    Packet * const pkt = new Packet(buf, sizeof (buf));
+    pkt->source = source;
+
+    return pkt;
+}
+
+static vector<uint32_t> walk(PacketQueue &q, queue_t queue)
+{
+    vector<uint32_t> ids;
+    Packet *pkt;
+
+    for (q.select(queue); (pkt = q.get()) != NULL;)
+        ids.push_back(pkt->SjPacketId);
+
+    return ids;
+}
+
+/* as TCPTrack::readpacket() */
+static vector<uint32_t> drain(PacketQueue &q, source_t source)
+{
+    vector<uint32_t> ids;
+    Packet *pkt;
+
+    while ((pkt = q.frontSEND(source)) != NULL)
+    {
+        q.extract(*pkt);
+        ids.push_back(pkt->SjPacketId);
+        delete pkt;
+    }
+
+    return ids;
+}
+
+static const source_t mixed[] = {TUNNEL, NETWORK, PLUGIN, NETWORK, TRACEROUTE, TUNNEL, NETWORK};
+
+#define MIXED (sizeof (mixed) / sizeof (mixed[0]))
+
+/* the packets of mixed[] inserted in SEND, with the ids expected in the two lanes */
+static void fillMixed(PacketQueue &q, vector<Packet *> &pkts, vector<uint32_t> &to_net, vector<uint32_t> &to_tun)
+{
+    for (uint32_t i = 0; i < MIXED; ++i)
+    {
+        Packet * const pkt = newPacket(mixed[i]);
+
+        pkts.push_back(pkt);
+        q.insert(*pkt, SEND);
+        (mixed[i] == NETWORK ? to_tun : to_net).push_back(pkt->SjPacketId);
+    }
+}
+
+static void checkMixedSources(void)
+{
+    PacketQueue q;
+    vector<Packet *> pkts;
+    vector<uint32_t> to_net, to_tun;
+
+    fillMixed(q, pkts, to_net, to_tun);
+
+    CHECK(q.size() == MIXED, "size %u after %u inserts", q.size(), (uint32_t) MIXED);
+    CHECK(q.frontSEND(TUNNEL) == pkts[0], "front of the network direction is not the first packet");
+    CHECK(q.frontSEND(PLUGIN) == pkts[0], "the direction of PLUGIN differs from TUNNEL");
+    CHECK(q.frontSEND(NETWORK) == pkts[1], "front of the tunnel direction is not the first NETWORK packet");
+
+    CHECK(drain(q, NETWORK) == to_tun, "the tunnel direction is not in insertion order");
+    CHECK(drain(q, TUNNEL) == to_net, "the network direction is not in insertion order");
+    CHECK(q.size() == 0, "size %u after the drain", q.size());
+
+    /* the other queues keep a single lane for every source */
+    Packet * const a = newPacket(NETWORK);
+    Packet * const b = newPacket(TUNNEL);
+    q.insert(*a, HACK);
+    q.insert(*b, HACK);
+
+    vector<uint32_t> hack;
+    hack.push_back(a->SjPacketId);
+    hack.push_back(b->SjPacketId);
+    CHECK(walk(q, HACK) == hack, "HACK is not a single lane");
+    CHECK(walk(q, SEND).empty(), "SEND is not empty");
+}
+
+/* select(SEND) walks the lane toward the network, then the one toward the tunnel */
+static void checkSelectWalk(void)
+{
+    PacketQueue q;
+    vector<Packet *> pkts;
+    vector<uint32_t> to_net, to_tun;
+
+    fillMixed(q, pkts, to_net, to_tun);
+
+    vector<uint32_t> expected(to_net);
+    expected.insert(expected.end(), to_tun.begin(), to_tun.end());
+
+    CHECK(walk(q, SEND) == expected, "select(SEND) does not walk the lanes in order");
+
+    /* getSource() continues the same walk */
+    Packet *pkt;
+    uint32_t found = 0;
+    for (q.select(SEND); (pkt = q.getSource(NETWORK)) != NULL; ++found)
+        CHECK(pkt->SjPacketId == to_tun[found], "getSource(NETWORK) out of order");
+    CHECK(found == to_tun.size(), "getSource(NETWORK) found %u packets of %u", found, (uint32_t) to_tun.size());
+
+    /* an empty lane toward the network does not stop the walk */
+    drain(q, TUNNEL);
+    CHECK(walk(q, SEND) == to_tun, "select(SEND) skips the tunnel direction");
+}
+
+static void checkInsertAcrossLanes(void)
+{
+    PacketQueue q;
+    vector<Packet *> pkts;
+    vector<uint32_t> to_net, to_tun;
+
+    fillMixed(q, pkts, to_net, to_tun);
+
+    /* a reference in the other lane: the packet goes to the back of its own */
+    Packet * const before = newPacket(PLUGIN);
+    q.insertBefore(*before, *pkts[1]);
+    to_net.push_back(before->SjPacketId);
+
+    Packet * const after = newPacket(NETWORK);
+    q.insertAfter(*after, *pkts[0]);
+    to_tun.push_back(after->SjPacketId);
+
+    /* a reference in the same lane: the packet stays next to it */
+    Packet * const before_same = newPacket(PLUGIN);
+    q.insertBefore(*before_same, *pkts[2]);
+    to_net.insert(find(to_net.begin(), to_net.end(), pkts[2]->SjPacketId), before_same->SjPacketId);
+
+    Packet * const after_same = newPacket(NETWORK);
+    q.insertAfter(*after_same, *pkts[3]);
+    to_tun.insert(find(to_tun.begin(), to_tun.end(), pkts[3]->SjPacketId) + 1, after_same->SjPacketId);
+
+    /* at the front and at the back of a lane */
+    Packet * const front = newPacket(NETWORK);
+    q.insertBefore(*front, *pkts[1]);
+    to_tun.insert(to_tun.begin(), front->SjPacketId);
+
+    Packet * const back = newPacket(TUNNEL);
+    q.insertAfter(*back, *before);
+    to_net.push_back(back->SjPacketId);
+
+    CHECK(q.size() == MIXED + 6, "size %u after the inserts", q.size());
+
+    vector<uint32_t> expected(to_net);
+    expected.insert(expected.end(), to_tun.begin(), to_tun.end());
+    CHECK(walk(q, SEND) == expected, "insertBefore/insertAfter broke the lane order");
+
+    CHECK(drain(q, NETWORK) == to_tun, "the tunnel direction is not in order after the inserts");
+    CHECK(drain(q, TUNNEL) == to_net, "the network direction is not in order after the inserts");
+}
+
+static void checkExtractMiddle(void)
+{
+    PacketQueue q;
+    vector<Packet *> pkts;
+    vector<uint32_t> to_net, to_tun;
+
+    fillMixed(q, pkts, to_net, to_tun);
+
+    /* pkts[2] and pkts[3] are in the middle of their lanes */
+    q.extract(*pkts[2]);
+    to_net.erase(find(to_net.begin(), to_net.end(), pkts[2]->SjPacketId));
+    q.extract(*pkts[3]);
+    to_tun.erase(find(to_tun.begin(), to_tun.end(), pkts[3]->SjPacketId));
+
+    CHECK(q.size() == MIXED - 2, "size %u after two extracts", q.size());
+
+    vector<uint32_t> expected(to_net);
+    expected.insert(expected.end(), to_tun.begin(), to_tun.end());
+    CHECK(walk(q, SEND) == expected, "extract from the middle broke the lane order");
+
+    /* the extracted packets can be queued again, at the back */
+    q.insert(*pkts[2], SEND);
+    to_net.push_back(pkts[2]->SjPacketId);
+    q.insert(*pkts[3], SEND);
+    to_tun.push_back(pkts[3]->SjPacketId);
+
+    /* an extract during the walk, as TCPTrack does, does not break it */
+    Packet *pkt;
+    uint32_t walked = 0;
+    for (q.select(SEND); (pkt = q.get()) != NULL; ++walked)
+    {
+        if (pkt == pkts[5] || pkt == pkts[6])
+        {
+            q.extract(*pkt);
+            delete pkt;
+        }
+    }
+    CHECK(walked == MIXED, "the walk with extracts visited %u packets of %u", walked, (uint32_t) MIXED);
+
+    to_net.erase(find(to_net.begin(), to_net.end(), pkts[5]->SjPacketId));
+    to_tun.erase(find(to_tun.begin(), to_tun.end(), pkts[6]->SjPacketId));
+
+    CHECK(drain(q, NETWORK) == to_tun, "the tunnel direction is not in order after the extracts");
+    CHECK(drain(q, TUNNEL) == to_net, "the network direction is not in order after the extracts");
+}
+
+int main(void)
+{
+    checkMixedSources();
+    checkSelectWalk();
+    checkInsertAcrossLanes();
+    checkExtractMiddle();
+
+    return checkResult("packetqueue-check", "the SEND lanes keep the insertion order");
+}
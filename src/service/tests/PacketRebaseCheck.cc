@@ -0,0 +1,212 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2010 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * check of Packet::rebaseMetadata(): random sequences of header and
+ * payload resizes on tcp and udp packets, where after every resize the
+ * metadata derived without parsing must be the same of a full
+ * updatePacketMetadata(0, 0). the bytes are compared with a model of the
+ * packet edited as a plain vector, so the resizes moving the headers into
+ * the headroom of the PacketBuffer are checked too.
+ */
+
+#include "CheckUtils.h"
+#include "HDRoptions.h"
+
+#include <stddef.h>
+
+/* the signal handler of the service, defined in main.cc */
+void sigtrap(int)
+{
+}
+
+#define PACKETS     5000
+#define RESIZES     30
+
+struct metadata
+{
+    proto_t proto;
+    const void *ip;
+    const void *ippayload;
+    const void *tcp; /* udp */
+    const void *tcppayload; /* udppayload */
+    uint16_t ippayloadlen;
+    uint16_t tcppayloadlen; /* udppayloadlen */
+    uint8_t iphdrlen;
+    uint8_t tcphdrlen; /* udphdrlen */
+
+    metadata(const Packet &pkt) :
+    proto(pkt.proto),
+    ip(pkt.ip),
+    ippayload(pkt.ippayload),
+    tcp(pkt.tcp),
+    tcppayload(pkt.tcppayload),
+    ippayloadlen(pkt.ippayloadlen),
+    tcppayloadlen(pkt.tcppayloadlen),
+    iphdrlen(pkt.iphdrlen),
+    tcphdrlen(pkt.tcphdrlen)
+    {
+    };
+
+    bool operator==(const metadata &m) const
+    {
+        return proto == m.proto && ip == m.ip && ippayload == m.ippayload && tcp == m.tcp
+                && tcppayload == m.tcppayload && ippayloadlen == m.ippayloadlen
+                && tcppayloadlen == m.tcppayloadlen && iphdrlen == m.iphdrlen && tcphdrlen == m.tcphdrlen;
+    };
+};
+
+enum resize_t
+{
+    RESIZE_IPHDR, RESIZE_TCPHDR, RESIZE_IPPAYLOAD, RESIZE_L4PAYLOAD, RESIZES_KIND
+};
+
+static const char *resizeName[RESIZES_KIND] = {
+    "iphdrResize", "tcphdrResize", "ippayloadResize", "tcp/udp payloadResize"
+};
+
+static void setTotLen(vector<unsigned char> &model)
+{
+    const uint16_t tot_len = htons(model.size());
+
+    memcpy(&model[offsetof(struct iphdr, tot_len)], &tot_len, sizeof (tot_len));
+}
+
+/* the same edit of iphdrResize() and tcphdrResize(): the options are padded with NOPs */
+static void resizeHeader(vector<unsigned char> &model, uint32_t start, uint32_t oldlen, uint32_t newlen, unsigned char pad)
+{
+    if (newlen > oldlen)
+        model.insert(model.begin() + start + oldlen, newlen - oldlen, pad);
+    else
+        model.erase(model.begin() + start + newlen, model.begin() + start + oldlen);
+
+    setTotLen(model);
+}
+
+static void resizePayload(vector<unsigned char> &model, uint32_t newlen)
+{
+    model.resize(newlen, 0x00);
+    setTotLen(model);
+}
+
+/* a random size, multiple of 4, of a header with up to maxopts bytes of options */
+static uint8_t randomHdrlen(uint8_t minlen, uint8_t maxopts)
+{
+    return minlen + 4 * (random() % (maxopts / 4 + 1));
+}
+
+/* returns false when the resize is not possible: the checks are left by Packet to the caller */
+static bool resize(Packet &pkt, vector<unsigned char> &model, resize_t what)
+{
+    const uint16_t pktlen = pkt.pbuf.size();
+    const bool tcp = (pkt.proto == TCP);
+    uint16_t size;
+
+    switch (what)
+    {
+    case RESIZE_IPHDR:
+        size = randomHdrlen(sizeof (struct iphdr), MAXIPOPTIONS);
+        if ((uint32_t) (pktlen - pkt.iphdrlen + size) > Packet::netMTU)
+            return false;
+
+        resizeHeader(model, 0, pkt.iphdrlen, size, IPOPT_NOOP);
+        model[0] = (model[0] & 0xF0) | (size / 4);
+        pkt.iphdrResize(size);
+        break;
+    case RESIZE_TCPHDR:
+        size = randomHdrlen(sizeof (struct tcphdr), MAXTCPOPTIONS);
+        if (!tcp || (uint32_t) (pktlen - pkt.tcphdrlen + size) > Packet::netMTU)
+            return false;
+
+        resizeHeader(model, pkt.iphdrlen, pkt.tcphdrlen, size, TCPOPT_NOP);
+        model[pkt.iphdrlen + 12] = (model[pkt.iphdrlen + 12] & 0x0F) | ((size / 4) << 4);
+        pkt.tcphdrResize(size);
+        break;
+    case RESIZE_IPPAYLOAD:
+        /* the udp length would not follow, and the next parse would refuse it */
+        if (!tcp)
+            return false;
+
+        size = pkt.tcphdrlen + random() % (Packet::netMTU - pkt.iphdrlen - pkt.tcphdrlen + 1);
+        resizePayload(model, pkt.iphdrlen + size);
+        pkt.ippayloadResize(size);
+        break;
+    case RESIZE_L4PAYLOAD:
+    default:
+        size = random() % (Packet::netMTU - pkt.iphdrlen - pkt.tcphdrlen + 1);
+        resizePayload(model, pkt.iphdrlen + pkt.tcphdrlen + size);
+
+        if (tcp)
+        {
+            pkt.tcppayloadResize(size);
+        }
+        else
+        {
+            const uint16_t udplen = htons(pkt.udphdrlen + size);
+            memcpy(&model[pkt.iphdrlen + offsetof(struct udphdr, len)], &udplen, sizeof (udplen));
+            pkt.udppayloadResize(size);
+        }
+        break;
+    }
+
+    return true;
+}
+
+static void checkResizes(uint8_t proto)
+{
+    for (uint32_t p = 0; p < PACKETS; ++p)
+    {
+        Packet * const pkt = newFrame(proto, random() % (Packet::netMTU - 60));
+        vector<unsigned char> model(&pkt->pbuf[0], &pkt->pbuf[0] + pkt->pbuf.size());
+
+        for (uint32_t r = 0; r < RESIZES; ++r)
+        {
+            const resize_t what = (resize_t) (random() % RESIZES_KIND);
+
+            if (!resize(*pkt, model, what))
+                continue;
+
+            const metadata rebased(*pkt);
+            pkt->updatePacketMetadata(0, 0);
+            const metadata parsed(*pkt);
+
+            CHECK(rebased == parsed, "%s: after %s the metadata differs from the parsed ones (iphdrlen %u, l4 header %u, payload %u)",
+                  (proto == IPPROTO_TCP) ? "tcp" : "udp", resizeName[what], parsed.iphdrlen, parsed.tcphdrlen, parsed.tcppayloadlen);
+            CHECK(model.size() == pkt->pbuf.size() && !memcmp(&model[0], &pkt->pbuf[0], model.size()),
+                  "%s: after %s the bytes differ from the model (%u bytes, %u expected)",
+                  (proto == IPPROTO_TCP) ? "tcp" : "udp", resizeName[what], pkt->pbuf.size(), (uint32_t) model.size());
+        }
+
+        delete pkt;
+    }
+}
+
+int main(void)
+{
+    Packet::netMTU = ETH_DATA_LEN;
+    srandom(1);
+
+    checkResizes(IPPROTO_TCP);
+    checkResizes(IPPROTO_UDP);
+
+    return checkResult("packetrebase-check", "the rebased metadata are the same of the parsed ones");
+}
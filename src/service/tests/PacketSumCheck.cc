@@ -0,0 +1,179 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2010 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * check of the incremental checksums (RFC 1624) kept by the setters of
+ * Packet, by markSumDirty() and by l4sumrest: random sequences of header
+ * and payload edits on tcp and udp packets, read as from the tunnel. after
+ * every edit fixSum() completes what is dirty, and the checksums must be
+ * the same of a clone, born dirty, on which fixSum() sums everything.
+ */
+
+#include "CheckUtils.h"
+
+/* the signal handler of the service, defined in main.cc */
+void sigtrap(int)
+{
+}
+
+#define PACKETS     2000
+#define EDITS       50
+
+enum edit_t
+{
+    EDIT_TTL, EDIT_IPID, EDIT_SEQ, EDIT_ACKSEQ, EDIT_WINDOW, EDIT_L4HDR,
+    EDIT_PAYLOAD_BYTE, EDIT_PAYLOAD_RESIZE, EDIT_PAYLOAD_FILL, EDIT_PAYLOAD_SET, EDITS_KIND
+};
+
+static const char *editName[EDITS_KIND] = {
+    "setTTL", "setIPID", "setSeq", "setAckSeq", "setWindow", "l4 header write",
+    "payload byte write", "payload resize", "payload random fill", "tcppayloadSet"
+};
+
+static uint16_t payloadlen(const Packet &pkt)
+{
+    return (pkt.proto == TCP) ? pkt.tcppayloadlen : pkt.udppayloadlen;
+}
+
+static unsigned char *payload(Packet &pkt)
+{
+    return (pkt.proto == TCP) ? pkt.tcppayload : pkt.udppayload;
+}
+
+static uint16_t randomPayloadlen(const Packet &pkt)
+{
+    const uint16_t hdrlen = pkt.iphdrlen + ((pkt.proto == TCP) ? pkt.tcphdrlen : pkt.udphdrlen);
+
+    return random() % (Packet::netMTU - hdrlen + 1);
+}
+
+static void edit(Packet &pkt, edit_t what)
+{
+    const bool tcp = (pkt.proto == TCP);
+
+    switch (what)
+    {
+    case EDIT_TTL:
+        pkt.setTTL(random());
+        break;
+    case EDIT_IPID:
+        pkt.setIPID(random());
+        break;
+    case EDIT_SEQ:
+        pkt.setSeq(random());
+        break;
+    case EDIT_ACKSEQ:
+        pkt.setAckSeq(random());
+        break;
+    case EDIT_WINDOW:
+        pkt.setWindow(random());
+        break;
+    case EDIT_L4HDR:
+        pkt.markSumDirty(SUM_L4HDR);
+        if (tcp)
+        {
+            pkt.tcp->psh ^= 1;
+            pkt.tcp->urg_ptr = random();
+        }
+        else
+        {
+            pkt.udp->source = random();
+        }
+        break;
+    case EDIT_PAYLOAD_BYTE:
+        if (payloadlen(pkt))
+        {
+            pkt.markSumDirty(SUM_L4DATA);
+            payload(pkt)[random() % payloadlen(pkt)] = random();
+        }
+        break;
+    case EDIT_PAYLOAD_RESIZE:
+        if (tcp)
+            pkt.tcppayloadResize(randomPayloadlen(pkt));
+        else
+            pkt.udppayloadResize(randomPayloadlen(pkt));
+        break;
+    case EDIT_PAYLOAD_FILL:
+        pkt.payloadRandomFill();
+        break;
+    case EDIT_PAYLOAD_SET:
+        if (tcp)
+        {
+            vector<unsigned char> data(randomPayloadlen(pkt) + 1);
+            memset_random(&data[0], data.size());
+            pkt.tcppayloadSet(&data[0], data.size() - 1);
+        }
+        else
+        {
+            pkt.udppayloadRandomFill();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void checkEdits(uint8_t proto)
+{
+    for (uint32_t p = 0; p < PACKETS; ++p)
+    {
+        Packet * const pkt = newFrame(proto, random() % (Packet::netMTU - 60));
+
+        for (uint32_t e = 0; e < EDITS; ++e)
+        {
+            edit_t what = (edit_t) (random() % EDITS_KIND);
+
+            /* the tcp header setters become an ip id change on udp */
+            if (proto == IPPROTO_UDP && (what == EDIT_SEQ || what == EDIT_ACKSEQ || what == EDIT_WINDOW))
+                what = EDIT_IPID;
+
+            edit(*pkt, what);
+            pkt->fixSum();
+
+            Packet * const full = new Packet(*pkt);
+            full->fixSum();
+
+            const uint16_t check = (proto == IPPROTO_TCP) ? pkt->tcp->check : pkt->udp->check;
+            const uint16_t fullcheck = (proto == IPPROTO_TCP) ? full->tcp->check : full->udp->check;
+
+            CHECK(pkt->ip->check == full->ip->check, "%s: ip checksum %04x after %s, recomputed %04x",
+                  (proto == IPPROTO_TCP) ? "tcp" : "udp", pkt->ip->check, editName[what], full->ip->check);
+            CHECK(check == fullcheck, "%s: checksum %04x after %s on %u bytes of payload, recomputed %04x",
+                  (proto == IPPROTO_TCP) ? "tcp" : "udp", check, editName[what], payloadlen(*pkt), fullcheck);
+
+            delete full;
+        }
+
+        delete pkt;
+    }
+}
+
+int main(void)
+{
+    Packet::netMTU = ETH_DATA_LEN;
+    srandom(1);
+
+    checkEdits(IPPROTO_TCP);
+    checkEdits(IPPROTO_UDP);
+
+    return checkResult("packetsum-check", "the incremental checksums are the same of the full ones");
+}
@@ -0,0 +1,181 @@
+/*
+ *   SniffJoke is a software able to confuse the Internet traffic analysis,
+ *   developed with the aim to improve digital privacy in communications and
+ *   to show and test some securiy weakness in traffic analysis software.
+ *
+ *   Copyright (C) 2010 vecna <vecna@delirandom.net>
+ *                      evilaliv3 <giovanni.pellerano@evilaliv3.org>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * check of Packet::validate(), the test of the received frames made
+ * without exceptions: on random frames it must reject exactly the ones
+ * the throwing constructor refuses, and tell the same proto on the
+ * others. a hand built frame for every reject_t reason follows.
+ */
+
+#include "CheckUtils.h"
+
+/* the signal handler of the service, defined in main.cc */
+void sigtrap(int)
+{
+}
+
+#define FRAMES      200000
+#define MAXFRAME    128     /* two headers with all the options, and some payload */
+
+static const char *rejectName[REJECT_REASONS] = {
+    "NOTREJECTED", "REJ_IPHDR", "REJ_TCPHDR", "REJ_UDPHDR", "REJ_ICMPHDR", "REJ_GSO"
+};
+
+/* the constructor throws where validate() rejects, and parses the same proto */
+static reject_t compare(const unsigned char *buf, uint32_t size, const struct vnet_hdr *vhdr)
+{
+    uint8_t proto = PROTOUNASSIGNED;
+    const reject_t reject = Packet::validate(buf, size, vhdr, proto);
+    Packet *pkt = NULL;
+
+    try
+    {
+        pkt = new Packet(buf, size, vhdr);
+    }
+    catch (runtime_error &e)
+    {
+        CHECK(reject != NOTREJECTED, "a frame of %u bytes accepted by validate() is refused: %s", size, e.what());
+        return reject;
+    }
+
+    CHECK(reject == NOTREJECTED, "a frame of %u bytes accepted by the constructor is rejected with %s", size, rejectName[reject]);
+    CHECK(reject != NOTREJECTED || proto == pkt->proto, "a frame of %u bytes is validated as proto %u, parsed as %u", size, proto, pkt->proto);
+
+    delete pkt;
+
+    return reject;
+}
+
+/*
+ * the random bytes hit only the first checks: the fields the checks read
+ * are chosen among the values close to their limits.
+ */
+static uint32_t randomFrame(unsigned char *buf, struct vnet_hdr &vhdr)
+{
+    static const uint8_t protos[] = {IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP, IPPROTO_GRE};
+    static const uint8_t gsos[] = {VNET_HDR_GSO_NONE, VNET_HDR_GSO_TCPV4, 3 /* UDP */, 4 /* TCPV6 */};
+    const uint32_t size = random() % (MAXFRAME + 1);
+
+    memset_random(buf, MAXFRAME);
+
+    struct iphdr * const ip = (struct iphdr *) buf;
+    ip->version = 4;
+    ip->ihl = (random() % 4) ? 5 + random() % 11 : random() % 16;
+    ip->protocol = protos[random() % (sizeof (protos) / sizeof (protos[0]))];
+
+    const uint32_t hdrlen = ip->ihl * 4;
+
+    if (hdrlen + sizeof (struct udphdr) <= MAXFRAME)
+    {
+        ((struct udphdr *) &buf[hdrlen])->len = htons(random() % (MAXFRAME + 1));
+        if (hdrlen + sizeof (struct tcphdr) <= MAXFRAME)
+            ((struct tcphdr *) &buf[hdrlen])->doff = random() % 16;
+    }
+
+    memset(&vhdr, 0x00, sizeof (vhdr));
+    vhdr.gso_type = gsos[random() % (sizeof (gsos) / sizeof (gsos[0]))];
+    vhdr.gso_size = (random() % 4) ? 1 + random() % 1460 : 0;
+
+    return size;
+}
+
+static void checkRandomFrames(void)
+{
+    uint32_t seen[REJECT_REASONS] = {0};
+    unsigned char buf[MAXFRAME];
+    struct vnet_hdr vhdr;
+
+    for (uint32_t i = 0; i < FRAMES; ++i)
+    {
+        const uint32_t size = randomFrame(buf, vhdr);
+
+        ++seen[compare(buf, size, (random() % 2) ? &vhdr : NULL)];
+    }
+
+    for (uint32_t r = 0; r < REJECT_REASONS; ++r)
+        CHECK(seen[r], "no random frame gave %s", rejectName[r]);
+}
+
+static void checkReason(reject_t expected, const unsigned char *buf, uint32_t size, const struct vnet_hdr *vhdr)
+{
+    const reject_t reject = compare(buf, size, vhdr);
+
+    CHECK(reject == expected, "the frame built for %s gave %s", rejectName[expected], rejectName[reject]);
+}
+
+static void checkReasons(void)
+{
+    unsigned char buf[MAXFRAME] = {0};
+    struct iphdr * const ip = (struct iphdr *) buf;
+    struct tcphdr * const tcp = (struct tcphdr *) &buf[sizeof (struct iphdr)];
+    struct udphdr * const udp = (struct udphdr *) &buf[sizeof (struct iphdr)];
+    struct vnet_hdr vhdr;
+
+    memset(&vhdr, 0x00, sizeof (vhdr));
+    vhdr.gso_type = VNET_HDR_GSO_TCPV4;
+    vhdr.gso_size = 1448;
+
+    ip->version = 4;
+    ip->ihl = 5;
+    ip->ttl = 64;
+
+    /* a tcp super-packet, with a full header */
+    ip->protocol = IPPROTO_TCP;
+    tcp->doff = 5;
+    checkReason(NOTREJECTED, buf, 60, &vhdr);
+
+    /* the ip options are longer than the frame */
+    ip->ihl = 15;
+    checkReason(REJ_IPHDR, buf, 40, NULL);
+    ip->ihl = 5;
+
+    /* the tcp options are longer than the frame */
+    tcp->doff = 15;
+    checkReason(REJ_TCPHDR, buf, 40, NULL);
+    tcp->doff = 5;
+
+    /* the udp length is longer than the frame */
+    ip->protocol = IPPROTO_UDP;
+    udp->len = htons(100);
+    checkReason(REJ_UDPHDR, buf, 60, NULL);
+    udp->len = htons(8);
+
+    /* an icmp header cut in half */
+    ip->protocol = IPPROTO_ICMP;
+    checkReason(REJ_ICMPHDR, buf, sizeof (struct iphdr) + 4, NULL);
+
+    /* only the tcp segmentation offload is enabled on the tun */
+    ip->protocol = IPPROTO_UDP;
+    checkReason(REJ_GSO, buf, 60, &vhdr);
+}
+
+int main(void)
+{
+    Packet::netMTU = ETH_DATA_LEN;
+    srandom(1);
+
+    checkRandomFrames();
+    checkReasons();
+
+    return checkResult("packetvalidate-check", "validate() rejects the frames refused by the constructor");
+}